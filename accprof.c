@@ -0,0 +1,306 @@
+/* accprof.c
+ *
+ * Per-register access profiling and the prof command.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "accprof.h"
+
+/* Key: BAR, bulk flag, width and offset, never 0 */
+#define KEY(bar, bulk, width, addr) \
+	((1ULL << 63) | ((unsigned long long)((bar) & 0xFF) << 48) | \
+	 ((unsigned long long)(bulk) << 47) | ((unsigned long long)((width) & 0xFF) << 32) | \
+	 (addr))
+
+#define KEY_BAR(k)    ((unsigned int)(((k) >> 48) & 0xFF))
+#define KEY_BULK(k)   ((int)(((k) >> 47) & 1))
+#define KEY_WIDTH(k)  ((int)(((k) >> 32) & 0xFF))
+#define KEY_ADDR(k)   ((unsigned int)(k))
+
+static unsigned int
+slot_of(
+	const struct accprof *p,
+	unsigned long long    key)
+{
+	/* Fibonacci hashing: neighbouring offsets land far apart */
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (p->size - 1);
+}
+
+static accprof_entry_t *
+accprof_find(
+	struct accprof     *p,
+	unsigned long long  key)
+{
+	unsigned int i = slot_of(p, key);
+
+	while ((p->slot[i].key != 0) && (p->slot[i].key != key)) {
+		i = (i + 1) & (p->size - 1);
+	}
+	return &p->slot[i];
+}
+
+/* Double the table, -1 when out of memory (the table stays usable) */
+static int
+accprof_grow(
+	struct accprof *p)
+{
+	accprof_entry_t *old = p->slot;
+	unsigned int size = p->size;
+	unsigned int i;
+
+	p->slot = (accprof_entry_t *)calloc(2 * size, sizeof(accprof_entry_t));
+	if (p->slot == NULL) {
+		p->slot = old;
+		return -1;
+	}
+	p->size = 2 * size;
+	for (i = 0; i < size; i++) {
+		if (old[i].key != 0) {
+			*accprof_find(p, old[i].key) = old[i];
+		}
+	}
+	free(old);
+	return 0;
+}
+
+void
+accprof_record(
+	device_t           *dev,
+	unsigned long long  t0,
+	unsigned int        addr,
+	int                 width,
+	int                 op,
+	int                 bulk,
+	unsigned int        bytes)
+{
+	struct accprof *p = dev->accprof;
+	unsigned long long t1 = accprof_now();
+	accprof_entry_t *e;
+	unsigned long long key;
+
+	if (!pthread_equal(pthread_self(), p->owner)) {
+		return;
+	}
+	key = KEY(dev->bar, bulk, width, addr);
+	e = accprof_find(p, key);
+	if (e->key == 0) {
+		if ((4 * (p->used + 1) > 3 * p->size) && (accprof_grow(p) == 0)) {
+			e = accprof_find(p, key);
+		}
+		/* Full and cannot grow: drop new registers, keep counting */
+		if (p->used + 1 == p->size) {
+			return;
+		}
+		e->key = key;
+		p->used++;
+	}
+	e->count[op]++;
+	e->bytes += bytes;
+	e->ns += t1 - t0;
+}
+
+int
+accprof_start(
+	device_t *dev)
+{
+	struct accprof *p;
+
+	if (dev->accprof != NULL) {
+		return 0;
+	}
+	p = (struct accprof *)calloc(1, sizeof(struct accprof));
+	if (p != NULL) {
+		p->slot = (accprof_entry_t *)calloc(ACCPROF_SLOTS, sizeof(accprof_entry_t));
+	}
+	if ((p == NULL) || (p->slot == NULL)) {
+		printf("Error: out of memory\n");
+		free(p);
+		return -1;
+	}
+	p->size = ACCPROF_SLOTS;
+	p->owner = pthread_self();
+	p->start_ns = accprof_now();
+	dev->accprof = p;
+	return 0;
+}
+
+void
+accprof_stop(
+	device_t *dev)
+{
+	if (dev->accprof == NULL) {
+		return;
+	}
+	free(dev->accprof->slot);
+	free(dev->accprof);
+	dev->accprof = NULL;
+}
+
+static int
+by_time(
+	const void *a,
+	const void *b)
+{
+	const accprof_entry_t *x = *(const accprof_entry_t * const *)a;
+	const accprof_entry_t *y = *(const accprof_entry_t * const *)b;
+
+	return (x->ns < y->ns) - (x->ns > y->ns);
+}
+
+static int
+by_key(
+	const void *a,
+	const void *b)
+{
+	const accprof_entry_t *x = *(const accprof_entry_t * const *)a;
+	const accprof_entry_t *y = *(const accprof_entry_t * const *)b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/* Narrow single reads of adjacent registers, in key (address) order */
+static void
+suggest_coalesce(
+	accprof_entry_t **e,
+	unsigned int      n,
+	FILE             *fp)
+{
+	unsigned long long reads;
+	unsigned int i;
+	unsigned int j;
+	int width;
+
+	for (i = 0; i < n; i = j) {
+		width = KEY_WIDTH(e[i]->key);
+		reads = e[i]->count[ACCPROF_READ];
+		for (j = i + 1; j < n; j++) {
+			if (KEY_BULK(e[j]->key) || (KEY_WIDTH(e[j]->key) != width) ||
+			    (KEY_BAR(e[j]->key) != KEY_BAR(e[i]->key)) ||
+			    (e[j]->count[ACCPROF_READ] == 0) ||
+			    (KEY_ADDR(e[j]->key) != KEY_ADDR(e[j - 1]->key) + width / 8)) {
+				break;
+			}
+			reads += e[j]->count[ACCPROF_READ];
+		}
+		if (KEY_BULK(e[i]->key) || (width > 16) || (e[i]->count[ACCPROF_READ] == 0) ||
+		    (j - i < ACCPROF_COALESCE_RUN)) {
+			continue;
+		}
+		fprintf(fp, "  coalesce: %.8X-%.8X, %llu %d-bit reads of %u adjacent registers"
+			" (if plain memory: coalesce %X %X)\n",
+			KEY_ADDR(e[i]->key), KEY_ADDR(e[j - 1]->key) + width / 8 - 1,
+			reads, width, j - i, KEY_ADDR(e[i]->key), (j - i) * width / 8);
+	}
+}
+
+void
+accprof_report(
+	device_t *dev,
+	int       top,
+	FILE     *fp)
+{
+	struct accprof *p = dev->accprof;
+	accprof_entry_t **e;
+	unsigned long long total_ns = 0;
+	unsigned long long accesses = 0;
+	unsigned int n = 0;
+	unsigned int i;
+	double elapsed;
+	const accprof_entry_t *x;
+	int cache = 0;
+
+	if (p == NULL) {
+		fprintf(fp, "Access profiling: off (prof on, or -a)\n");
+		return;
+	}
+	e = (accprof_entry_t **)malloc((p->used + 1) * sizeof(accprof_entry_t *));
+	if (e == NULL) {
+		return;
+	}
+	for (i = 0; i < p->size; i++) {
+		if (p->slot[i].key != 0) {
+			e[n++] = &p->slot[i];
+			total_ns += p->slot[i].ns;
+			accesses += p->slot[i].count[0] + p->slot[i].count[1];
+		}
+	}
+	elapsed = (accprof_now() - p->start_ns) / 1e9;
+	fprintf(fp, "Access profile: %llu accesses to %u registers, %.3f s of %.3f s in MMIO\n",
+		accesses, n, total_ns / 1e9, elapsed);
+	if (n == 0) {
+		free(e);
+		return;
+	}
+
+	qsort(e, n, sizeof(*e), by_time);
+	fprintf(fp, "  BAR offset     width      reads     writes       bytes     time ms   avg ns  time%%\n");
+	for (i = 0; (i < n) && ((int)i < top); i++) {
+		x = e[i];
+		fprintf(fp, "  %3u %.8X %4s %3d %10llu %10llu %11llu %11.3f %8.0f %5.1f%%\n",
+			KEY_BAR(x->key), KEY_ADDR(x->key), KEY_BULK(x->key) ? "bulk" : "    ",
+			KEY_WIDTH(x->key), x->count[ACCPROF_READ], x->count[ACCPROF_WRITE],
+			x->bytes, x->ns / 1e6, (double)x->ns / (x->count[0] + x->count[1]),
+			(total_ns > 0) ? 100.0 * x->ns / total_ns : 0.0);
+	}
+	if (n > (unsigned int)top) {
+		fprintf(fp, "  ... %u more\n", n - top);
+	}
+
+	/* Hints, cheapest win first */
+	for (i = 0; i < n; i++) {
+		x = e[i];
+		if (!KEY_BULK(x->key) && (x->count[ACCPROF_WRITE] == 0) &&
+		    (x->count[ACCPROF_READ] >= ACCPROF_CACHE_READS)) {
+			if (cache++ == top) {
+				break;
+			}
+			fprintf(fp, "  cache?   %.8X, read %llu times and never written (%.3f ms):"
+				" keep the value if it is constant\n", KEY_ADDR(x->key),
+				x->count[ACCPROF_READ], x->ns / 1e6);
+		}
+	}
+	qsort(e, n, sizeof(*e), by_key);
+	suggest_coalesce(e, n, fp);
+	free(e);
+}
+
+int
+accprof_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	char word[100];
+	int top = ACCPROF_TOP;
+	FILE *fp;
+
+	/* prof, prof on, prof off, prof reset, prof N, prof file */
+	if (sscanf(cmd, "%*s %99s", word) != 1) {
+		accprof_report(dev, top, stdout);
+	} else if (strcmp(word, "on") == 0) {
+		accprof_start(dev);
+	} else if (strcmp(word, "off") == 0) {
+		accprof_stop(dev);
+	} else if (strcmp(word, "reset") == 0) {
+		if (dev->accprof != NULL) {
+			accprof_stop(dev);
+			accprof_start(dev);
+		}
+	} else if (sscanf(word, "%d", &top) == 1) {
+		accprof_report(dev, top, stdout);
+	} else {
+		fp = fopen(word, "w");
+		if (fp == NULL) {
+			printf("Open failed for file '%s': errno %d, %s\n",
+				word, errno, strerror(errno));
+			return 0;
+		}
+		accprof_report(dev, ACCPROF_TOP, fp);
+		fclose(fp);
+	}
+	return 0;
+}
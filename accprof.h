@@ -0,0 +1,101 @@
+/* accprof.h
+ *
+ * Per-register access profiling.
+ *
+ * With -a (or "prof on") every MMIO access made by the commands is
+ * counted per (BAR, offset, width) in an open addressing hash table,
+ * along with the time spent in it. A bulk transfer (large d/f, tune,
+ * link bw) counts as one access of its strategy width at its start
+ * address, with its byte count. "prof" prints the entries that took
+ * the most time and flags registers worth caching (read over and over,
+ * never written) and runs of narrow reads that "coalesce" would serve
+ * with wide loads; -a prints the same report at exit.
+ *
+ * Only the thread that enabled profiling is counted: the background
+ * sampler and the per-device threads of msample/link are not.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef ACCPROF_H
+#define ACCPROF_H
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "pci_debug.h"
+
+#define ACCPROF_READ          0
+#define ACCPROF_WRITE         1
+
+/* Entries in the report */
+#define ACCPROF_TOP           20
+
+/* Hash slots to start with, doubled when 3/4 full */
+#define ACCPROF_SLOTS         1024
+
+/* Caching is suggested from this many reads of a never written register */
+#define ACCPROF_CACHE_READS   100
+
+/* Coalescing is suggested for this many adjacent narrow registers */
+#define ACCPROF_COALESCE_RUN  4
+
+typedef struct {
+	unsigned long long key;        /* 0: free slot */
+	unsigned long long count[2];   /* reads, writes */
+	unsigned long long bytes;
+	unsigned long long ns;
+} accprof_entry_t;
+
+struct accprof {
+	pthread_t          owner;
+	unsigned long long start_ns;
+	unsigned int       size;       /* slots, a power of two */
+	unsigned int       used;
+	accprof_entry_t   *slot;
+};
+
+static inline unsigned long long
+accprof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Counts the access (dev->mmio_ops) and returns the time stamp for
+ * accprof_end(), 0 when not profiling
+ */
+static inline unsigned long long
+accprof_begin(
+	device_t *dev)
+{
+	dev->mmio_ops++;
+	return (dev->accprof != NULL) ? accprof_now() : 0;
+}
+
+/* bulk: a transfer of bytes rather than a single access */
+void accprof_record(device_t *dev, unsigned long long t0, unsigned int addr,
+	int width, int op, int bulk, unsigned int bytes);
+
+static inline void
+accprof_end(
+	device_t           *dev,
+	unsigned long long  t0,
+	unsigned int        addr,
+	int                 width,
+	int                 op)
+{
+	if (dev->accprof != NULL) {
+		accprof_record(dev, t0, addr, width, op, 0, width / 8);
+	}
+}
+
+int accprof_start(device_t *dev);
+void accprof_stop(device_t *dev);
+void accprof_report(device_t *dev, int top, FILE *fp);
+
+int accprof_cmd(device_t *dev, char *cmd);
+
+#endif /* ACCPROF_H */
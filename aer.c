@@ -0,0 +1,121 @@
+/* aer.c
+ *
+ * AER error counters from sysfs.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "aer.h"
+#include "config.h"
+
+const char *aer_files[AER_NFILES] = {
+	"aer_dev_correctable", "aer_dev_nonfatal", "aer_dev_fatal"
+};
+
+const char *aer_totals[AER_NFILES] = {
+	"TOTAL_ERR_COR", "TOTAL_ERR_NONFATAL", "TOTAL_ERR_FATAL"
+};
+
+int
+aer_open(
+	device_t   *dev,
+	const char *file)
+{
+	char path[160];
+	int fd;
+
+	if (config_dir(dev, path, 128) < 0) {
+		printf("Error: %s has no AER counters (file stand-in)\n",
+			dev->filename);
+		return -1;
+	}
+	strcat(path, "/");
+	strcat(path, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+	}
+	return fd;
+}
+
+/* sysfs regenerates the file on each read from offset 0 */
+int
+aer_load(
+	int   fd,
+	char *buf)
+{
+	ssize_t n;
+
+	n = pread(fd, buf, AER_BUF - 1, 0);
+	if (n < 0) {
+		return -1;
+	}
+	buf[n] = '\0';
+	return 0;
+}
+
+int
+aer_find(
+	const char *buf,
+	const char *key,
+	uint64_t   *count)
+{
+	size_t len = strlen(key);
+	const char *p = buf;
+
+	while (p != NULL) {
+		if ((strncmp(p, key, len) == 0) && (p[len] == ' ')) {
+			*count = strtoull(p + len + 1, NULL, 10);
+			return 0;
+		}
+		p = strchr(p, '\n');
+		if (p != NULL) {
+			p++;
+		}
+	}
+	return -1;
+}
+
+int
+aer_read(
+	int         fd,
+	const char *key,
+	uint64_t   *count)
+{
+	char buf[AER_BUF];
+
+	if (aer_load(fd, buf) < 0) {
+		return -1;
+	}
+	return aer_find(buf, key, count);
+}
+
+int
+aer_keys(
+	int  fd,
+	char keys[][24],
+	int  max)
+{
+	char buf[AER_BUF];
+	char *line;
+	char *save;
+	int n = 0;
+
+	if (aer_load(fd, buf) < 0) {
+		return 0;
+	}
+	for (line = strtok_r(buf, "\n", &save); (line != NULL) && (n < max);
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (sscanf(line, "%23s", keys[n]) == 1) {
+			n++;
+		}
+	}
+	return n;
+}
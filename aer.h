@@ -0,0 +1,57 @@
+/* aer.h
+ *
+ * AER error counters from sysfs.
+ *
+ * The kernel keeps per-device Advanced Error Reporting counters in
+ * aer_dev_correctable, aer_dev_nonfatal and aer_dev_fatal, one
+ * "name count" line per error type plus a TOTAL_ERR_xxx line. "sample
+ * aer" adds them to the sample set as pseudo registers: the files stay
+ * open (one descriptor per file, shared by its counters), each sweep
+ * re-reads every file once with pread, picks all its counters from
+ * that read and records the number of new errors since the previous
+ * sweep, so error bursts (replays, bad
+ * TLPs on a marginal slot) line up with the register values in
+ * histograms, captures and live rings.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef AER_H
+#define AER_H
+
+#include <stdint.h>
+
+#include "pci_debug.h"
+
+/* capture_col_t bar of a counter that is not a BAR register */
+#define AER_COLUMN_BAR  0xFFFFFFFF
+
+#define AER_NFILES      3
+
+/* The three files are a few hundred bytes each */
+#define AER_BUF         1024
+
+extern const char *aer_files[AER_NFILES];   /* aer_dev_correctable, ... */
+extern const char *aer_totals[AER_NFILES];  /* TOTAL_ERR_COR, ... */
+
+/* Opens one counter file of the device, -1 (and a message) when the
+ * device has none (stand-in, no AER capability or older kernel)
+ */
+int aer_open(device_t *dev, const char *file);
+
+/* The whole file in buf (AER_BUF bytes), NUL terminated, -1 when the
+ * read fails
+ */
+int aer_load(int fd, char *buf);
+
+/* Value of counter key in a loaded file, -1 when key is absent */
+int aer_find(const char *buf, const char *key, uint64_t *count);
+
+/* Value of counter key, -1 when the read fails or key is absent */
+int aer_read(int fd, const char *key, uint64_t *count);
+
+/* Names of the counters in an open file (at most max), returns the
+ * count
+ */
+int aer_keys(int fd, char keys[][24], int max);
+
+#endif /* AER_H */
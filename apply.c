@@ -0,0 +1,563 @@
+/* apply.c
+ *
+ * Minimal-write apply of a desired register state.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <byteswap.h>
+#include <pthread.h>
+
+#include "apply.h"
+#include "bulk.h"
+#include "coalesce.h"
+#include "config.h"
+#include "msample.h"
+
+typedef struct {
+	unsigned int addr;
+	int          width;
+	uint32_t     val;
+	uint32_t     mask;
+	int          line;
+	int          merged;    /* folded into a later line for the same register */
+} apply_entry_t;
+
+typedef struct {
+	apply_entry_t *e;
+	int            count;
+	int            alloc;
+	int           *order;   /* indexes sorted by address */
+} apply_state_t;
+
+/* Per entry outcome */
+#define APPLY_SAME     0
+#define APPLY_DIFF     1   /* differs, not written (-n) */
+#define APPLY_WRITTEN  2
+#define APPLY_STUCK    3   /* written, read back different */
+#define APPLY_OUT      4   /* beyond this card's BAR */
+#define APPLY_MERGED   5
+#define APPLY_RESULTS  6
+
+/* Where a card was interrupted (Ctrl-C) */
+#define APPLY_INT_READ   1   /* reading the current values, nothing written */
+#define APPLY_INT_WRITE  2   /* between writes, the rest not written */
+
+/* Per card */
+typedef struct {
+	device_t            *dev;
+	pthread_t            thread;
+	const apply_state_t *state;
+	int                  dry_run;
+
+	uint32_t            *cur;       /* by entry, before */
+	uint32_t            *after;     /* by entry, read back */
+	unsigned char       *result;    /* by entry, APPLY_xxx */
+	int                  error;
+	int                  interrupted;   /* APPLY_INT_xxx, 0 when complete */
+	int                  count[APPLY_RESULTS];
+	unsigned int         reads;     /* bulk reads of the current values */
+	double               ms;
+} apply_job_t;
+
+static uint32_t
+width_mask(
+	int width)
+{
+	return (width == 32) ? 0xFFFFFFFFU : ((1U << width) - 1);
+}
+
+static int
+entry_cmp(
+	const void *a,
+	const void *b)
+{
+	const apply_entry_t *x = *(const apply_entry_t * const *)a;
+	const apply_entry_t *y = *(const apply_entry_t * const *)b;
+
+	if (x->addr != y->addr) {
+		return (x->addr < y->addr) ? -1 : 1;
+	}
+	return x->line - y->line;
+}
+
+static void
+state_free(
+	apply_state_t *st)
+{
+	free(st->e);
+	free(st->order);
+	memset(st, 0, sizeof(apply_state_t));
+}
+
+/* Returns 0 when the file was read, a message is printed otherwise */
+static int
+state_load(
+	device_t      *dev,
+	const char    *path,
+	apply_state_t *st)
+{
+	apply_entry_t **sorted;
+	apply_entry_t *e;
+	apply_entry_t *prev;
+	char line[256];
+	unsigned int addr;
+	unsigned int val;
+	unsigned int mask;
+	int lineno = 0;
+	int width;
+	int bar;
+	int status;
+	int i;
+	FILE *fp;
+
+	memset(st, 0, sizeof(apply_state_t));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Error: cannot open %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((line[strspn(line, " \t\r\n")] == '\0') || (line[0] == '#')) {
+			continue;
+		}
+		if (sscanf(line, "bar%d", &bar) == 1) {
+			if (bar != dev->bar) {
+				printf("Error: %s is for BAR%d, not BAR%d\n", path, bar, dev->bar);
+				fclose(fp);
+				return -1;
+			}
+			continue;
+		}
+		width = 32;
+		mask = 0xFFFFFFFFU;
+		if ((line[0] == 'c') && (line[1] == ' ')) {
+			status = sscanf(line, "%*c %x %x %x", &addr, &val, &mask) + 1;
+		} else if (line[0] == 'c') {
+			status = sscanf(line, "%*c%d %x %x %x", &width, &addr, &val, &mask);
+		} else {
+			status = 0;
+		}
+		if ((status < 3) || ((width != 8) && (width != 16) && (width != 32)) ||
+		    (addr % (width / 8))) {
+			printf("Error: %s:%d: expected c[8|16|32] addr value [mask], "
+				"aligned\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		if (st->count == st->alloc) {
+			st->alloc = (st->alloc > 0) ? st->alloc * 2 : 256;
+			e = (apply_entry_t *)realloc(st->e, st->alloc * sizeof(apply_entry_t));
+			if (e == NULL) {
+				printf("Error: out of memory\n");
+				fclose(fp);
+				return -1;
+			}
+			st->e = e;
+		}
+		e = &st->e[st->count++];
+		e->addr = addr;
+		e->width = width;
+		e->mask = mask & width_mask(width);
+		e->val = val & e->mask;
+		e->line = lineno;
+		e->merged = 0;
+	}
+	fclose(fp);
+	if (st->count == 0) {
+		printf("Error: no register in %s\n", path);
+		return -1;
+	}
+
+	st->order = (int *)malloc(st->count * sizeof(int));
+	sorted = (apply_entry_t **)malloc(st->count * sizeof(apply_entry_t *));
+	if ((st->order == NULL) || (sorted == NULL)) {
+		printf("Error: out of memory\n");
+		free(sorted);
+		return -1;
+	}
+	for (i = 0; i < st->count; i++) {
+		sorted[i] = &st->e[i];
+	}
+	qsort(sorted, st->count, sizeof(apply_entry_t *), entry_cmp);
+	for (i = 0; i < st->count; i++) {
+		st->order[i] = (int)(sorted[i] - st->e);
+	}
+	free(sorted);
+
+	/* The same register twice: the later line wins where its mask is
+	 * set. Partly overlapping registers are a mistake in the file.
+	 */
+	prev = NULL;
+	for (i = 0; i < st->count; i++) {
+		e = &st->e[st->order[i]];
+		if ((prev != NULL) && (prev->addr == e->addr) && (prev->width == e->width)) {
+			e->val = (prev->val & ~e->mask) | e->val;
+			e->mask |= prev->mask;
+			prev->merged = 1;
+		} else if ((prev != NULL) && (prev->addr + prev->width / 8 > e->addr)) {
+			printf("Error: %s:%d overlaps line %d\n", path, e->line, prev->line);
+			return -1;
+		}
+		prev = e;
+	}
+	return 0;
+}
+
+/* Register value from bytes in BAR order, in the current endian mode */
+static uint32_t
+get_value(
+	const unsigned char *b,
+	int                  width)
+{
+	uint16_t d16;
+	uint32_t d32;
+
+	switch (width) {
+		case 8:
+			return b[0];
+		case 16:
+			memcpy(&d16, b, 2);
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d16 = bswap_16(d16);
+			}
+			return d16;
+		default:
+			memcpy(&d32, b, 4);
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d32 = bswap_32(d32);
+			}
+			return d32;
+	}
+}
+
+static void
+put_value(
+	unsigned char *b,
+	int            width,
+	uint32_t       val)
+{
+	uint16_t d16;
+
+	switch (width) {
+		case 8:
+			b[0] = (unsigned char)val;
+			break;
+		case 16:
+			d16 = (uint16_t)val;
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d16 = bswap_16(d16);
+			}
+			memcpy(b, &d16, 2);
+			break;
+		default:
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				val = bswap_32(val);
+			}
+			memcpy(b, &val, 4);
+			break;
+	}
+}
+
+/* One access of the register's width, as c/d would do */
+static void
+single_strategy(
+	strategy_t *s,
+	int         width)
+{
+	s->width = width;
+	s->map = MAP_UC;
+	s->threads = 1;
+	s->chunk = 65536;
+	s->fence = FENCE_ACCESS;
+}
+
+/* Current values: one bulk read per run of adjacent registers of the
+ * same width, wide reads where the run lies in a coalesced range
+ */
+static int
+apply_read(
+	apply_job_t *j)
+{
+	const apply_state_t *st = j->state;
+	const apply_entry_t *e;
+	const apply_entry_t *head;
+	strategy_t s;
+	unsigned char *buf;
+	unsigned int end;
+	int i;
+	int k;
+
+	buf = (unsigned char *)malloc(st->count * 4);
+	if (buf == NULL) {
+		return -1;
+	}
+	i = 0;
+	while (i < st->count) {
+		head = &st->e[st->order[i]];
+		if (head->merged) {
+			j->result[st->order[i++]] = APPLY_MERGED;
+			continue;
+		}
+		end = head->addr + head->width / 8;
+		for (k = i + 1; k < st->count; k++) {
+			e = &st->e[st->order[k]];
+			if (e->merged) {
+				continue;
+			}
+			if ((e->addr != end) || (e->width != head->width) ||
+			    (end + e->width / 8 > j->dev->size)) {
+				break;
+			}
+			end += e->width / 8;
+		}
+		if (end > j->dev->size) {
+			for (; i < k; i++) {
+				j->result[st->order[i]] =
+					st->e[st->order[i]].merged ? APPLY_MERGED : APPLY_OUT;
+			}
+			continue;
+		}
+		if (!coalesce_lookup(j->dev, head->addr, end - head->addr, &s)) {
+			single_strategy(&s, head->width);
+		}
+		if (bulk_read(j->dev, &s, head->addr, buf, end - head->addr, NULL) <
+		    end - head->addr) {
+			j->interrupted = APPLY_INT_READ;
+			break;
+		}
+		j->reads++;
+		for (; i < k; i++) {
+			e = &st->e[st->order[i]];
+			if (e->merged) {
+				j->result[st->order[i]] = APPLY_MERGED;
+				continue;
+			}
+			j->cur[st->order[i]] = get_value(buf + (e->addr - head->addr), e->width);
+			j->result[st->order[i]] = APPLY_SAME;
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void *
+apply_thread(
+	void *arg)
+{
+	apply_job_t *j = (apply_job_t *)arg;
+	const apply_state_t *st = j->state;
+	const apply_entry_t *e;
+	unsigned char b[4];
+	unsigned int len;
+	strategy_t s;
+	uint32_t val;
+	double t0 = now_ms();
+	int i;
+
+	if (apply_read(j) < 0) {
+		j->error = 1;
+		return NULL;
+	}
+	if (j->interrupted) {
+		return NULL;
+	}
+
+	/* Writes in file order: the state file may rely on it */
+	for (i = 0; i < st->count; i++) {
+		e = &st->e[i];
+		if ((j->result[i] != APPLY_SAME) ||
+		    (((j->cur[i] ^ e->val) & e->mask) == 0)) {
+			continue;
+		}
+		if (j->dry_run) {
+			j->result[i] = APPLY_DIFF;
+			continue;
+		}
+		val = (j->cur[i] & ~e->mask) | e->val;
+		len = e->width / 8;
+		single_strategy(&s, e->width);
+		put_value(b, e->width, val);
+		if ((bulk_write(j->dev, &s, e->addr, b, len, NULL) < len) ||
+		    (bulk_read(j->dev, &s, e->addr, b, len, NULL) < len)) {
+			j->interrupted = APPLY_INT_WRITE;
+			break;
+		}
+		j->after[i] = get_value(b, e->width);
+		j->result[i] = (((j->after[i] ^ e->val) & e->mask) == 0) ?
+			APPLY_WRITTEN : APPLY_STUCK;
+	}
+	for (i = 0; i < st->count; i++) {
+		j->count[j->result[i]]++;
+	}
+	j->ms = now_ms() - t0;
+	return NULL;
+}
+
+static void
+apply_print(
+	int          index,
+	apply_job_t *j)
+{
+	const apply_entry_t *e;
+	char name[128];
+	int digits;
+	int i;
+
+	if (config_dir(j->dev, name, sizeof(name)) == 0) {
+		snprintf(name, sizeof(name), "%04x:%02x:%02x.%1x",
+			j->dev->domain, j->dev->bus, j->dev->slot, j->dev->function);
+	} else {
+		snprintf(name, sizeof(name), "%s", j->dev->filename);
+	}
+	printf("dev%d %s: ", index, name);
+	if (j->error) {
+		printf("out of memory\n");
+		return;
+	}
+	if (j->interrupted == APPLY_INT_READ) {
+		printf("interrupted while reading, nothing written\n");
+		return;
+	}
+	printf("%d registers read in %u bulk reads, ",
+		j->state->count - j->count[APPLY_MERGED] - j->count[APPLY_OUT], j->reads);
+	if (j->dry_run) {
+		printf("%d differ", j->count[APPLY_DIFF]);
+	} else {
+		printf("%d written", j->count[APPLY_WRITTEN] + j->count[APPLY_STUCK]);
+	}
+	printf(", %.3f ms%s\n", j->ms,
+		(j->interrupted == APPLY_INT_WRITE) ? ", interrupted" : "");
+
+	for (i = 0; i < j->state->count; i++) {
+		e = &j->state->e[i];
+		digits = e->width / 4;
+		switch (j->result[i]) {
+			case APPLY_DIFF:
+			case APPLY_WRITTEN:
+			case APPLY_STUCK:
+				printf("  %.8X c%-2d %0*X -> %0*X", e->addr, e->width,
+					digits, j->cur[i],
+					digits, (j->cur[i] & ~e->mask) | e->val);
+				if (e->mask != width_mask(e->width)) {
+					printf("  mask %0*X", digits, e->mask);
+				}
+				if (j->result[i] == APPLY_STUCK) {
+					printf("  did not stick, reads %0*X", digits, j->after[i]);
+				}
+				printf("  (line %d)\n", e->line);
+				break;
+			case APPLY_OUT:
+				printf("  %.8X c%-2d beyond the BAR (line %d)\n",
+					e->addr, e->width, e->line);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+int
+apply_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	device_t *devs[MSAMPLE_MAX_DEVS];
+	apply_job_t jobs[MSAMPLE_MAX_DEVS];
+	int started[MSAMPLE_MAX_DEVS];
+	apply_state_t st;
+	char arg[3][256];
+	char *path = NULL;
+	int dry_run = 0;
+	int all = 0;
+	int status;
+	int changed = 0;
+	int n;
+	int d;
+	int i;
+
+	/* apply [-n] file [all] */
+	status = sscanf(cmd, "%*s %255s %255s %255s", arg[0], arg[1], arg[2]);
+	for (i = 0; i < status; i++) {
+		if (strcmp(arg[i], "-n") == 0) {
+			dry_run = 1;
+		} else if ((path != NULL) && (strcmp(arg[i], "all") == 0)) {
+			all = 1;
+		} else if (path == NULL) {
+			path = arg[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	if (path == NULL) {
+		printf("Syntax error: apply [-n] file [all]\n");
+		return 0;
+	}
+	if (state_load(dev, path, &st) < 0) {
+		state_free(&st);
+		return 0;
+	}
+
+	n = all ? msample_devices(dev, devs, MSAMPLE_MAX_DEVS) : 1;
+	devs[0] = dev;
+	memset(jobs, 0, sizeof(jobs));
+	for (d = 0; d < n; d++) {
+		jobs[d].dev = devs[d];
+		jobs[d].state = &st;
+		jobs[d].dry_run = dry_run;
+		jobs[d].cur = (uint32_t *)calloc(st.count, sizeof(uint32_t));
+		jobs[d].after = (uint32_t *)calloc(st.count, sizeof(uint32_t));
+		jobs[d].result = (unsigned char *)calloc(st.count, 1);
+		jobs[d].error = (jobs[d].cur == NULL) || (jobs[d].after == NULL) ||
+			(jobs[d].result == NULL);
+	}
+
+	/* One thread per card */
+	for (d = 0; d < n; d++) {
+		started[d] = 0;
+		if (jobs[d].error) {
+			continue;
+		}
+		started[d] = (pthread_create(&jobs[d].thread, NULL, apply_thread, &jobs[d]) == 0);
+		if (!started[d]) {
+			apply_thread(&jobs[d]);
+		}
+	}
+	for (d = 0; d < n; d++) {
+		if (started[d]) {
+			pthread_join(jobs[d].thread, NULL);
+		}
+	}
+
+	for (d = 0; d < n; d++) {
+		apply_print(d, &jobs[d]);
+		if (jobs[d].count[APPLY_DIFF] + jobs[d].count[APPLY_WRITTEN] +
+		    jobs[d].count[APPLY_STUCK] > 0) {
+			changed++;
+		}
+		free(jobs[d].cur);
+		free(jobs[d].after);
+		free(jobs[d].result);
+	}
+	if (n > 1) {
+		printf("%d of %d card(s) %s\n", changed, n,
+			dry_run ? "differ from the state" : "changed");
+	}
+	state_free(&st);
+	return 0;
+}
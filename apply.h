@@ -0,0 +1,30 @@
+/* apply.h
+ *
+ * Minimal-write apply of a desired register state.
+ *
+ * "apply file" reads a state file of register writes, the same lines
+ * as in a commands file:
+ *
+ *   bar0                    optional, must match the BAR in use
+ *   c32 10 00000003 0000000F  width, address, value, optional mask
+ *   c 44 1                  (c alone is 32-bit)
+ *   # comment
+ *
+ * so an init script can serve as the golden state. The current values
+ * are read with one bulk read per run of adjacent registers (wide reads
+ * in coalesced ranges), compared under the masks, and only registers
+ * that differ are written: (current & ~mask) | (value & mask), in file
+ * order, each read back to catch bits that do not stick. "-n" only
+ * reports. With "all" the same state is applied to this card and the
+ * msample cards in parallel, one thread each, reports printed per card.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef APPLY_H
+#define APPLY_H
+
+#include "pci_debug.h"
+
+int apply_cmd(device_t *dev, char *cmd);
+
+#endif /* APPLY_H */
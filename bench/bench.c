@@ -0,0 +1,568 @@
+/* bench.c
+ *
+ * pci_debug micro and macro benchmarks on a file-backed stand-in BAR.
+ *
+ * pci_debug.c is included (with its main renamed) so that the static
+ * read_xx/write_xx helpers and the command handlers can be timed
+ * directly. Everything runs against a plain file mapped like a
+ * resourceN node (by default in /dev/shm), no hardware needed.
+ *
+ * Results are written as JSON with a fixed key order and a fixed
+ * benchmark list, so runs can be diffed and compared over time.
+ *
+ * With -b, the regression workload set (fills, dumps, formatting,
+ * parsing and command files) is compared with this host's baseline
+ * and the exit status is non-zero when anything got slower than the
+ * tolerance (-T, percent). -u records a new baseline.
+ *
+ * Usage: pci_debug_bench [-r file] [-s size] [-t seconds] [-o file]
+ *                        [-b baselines [-T tolerance] [-u]]
+ *
+ * ----------------------------------------------------------------
+ */
+#define main pci_debug_main
+#include "pci_debug.c"
+#undef main
+
+#include <stdint.h>
+#include <limits.h>
+
+#include "bench.h"
+#include "ramcap.h"
+
+#define BENCH_SCHEMA       1
+#define BENCH_DEFAULT_BAR  "/dev/shm/pci_debug_bench.bar"
+#define BENCH_DEFAULT_SIZE (16*1024*1024)
+#define BENCH_REPS         5
+#define BENCH_MAX_RESULTS  64
+
+/* Micro benchmarks walk this much of the BAR per run */
+#define BENCH_MICRO_BYTES  (1024*1024)
+
+/* RAM capture ring benchmarks: ring size, registers per record and
+ * records stored per run
+ */
+#define BENCH_RAMCAP_SIZE     (256*1024*1024)
+#define BENCH_RAMCAP_REGS     4
+#define BENCH_RAMCAP_RECORDS  (1024*1024)
+
+static bench_result_t results[BENCH_MAX_RESULTS];
+static int nresults = 0;
+
+/* Minimum time of one timed run */
+static double min_time = 0.05;
+
+/* Saved stdout, the handlers' output goes to /dev/null */
+static int out_fd = -1;
+
+static double
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+cmp_double(
+	const void *a,
+	const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* ----------------------------------------------------------------
+ * Timed bodies
+ * ----------------------------------------------------------------
+ */
+typedef struct bench bench_t;
+
+struct bench {
+	const char *group;
+	const char *name;
+	/* Runs the body once, returns ops done and sets *bytes */
+	unsigned long long (*run)(device_t *dev, const bench_t *b,
+		unsigned long long *bytes);
+	int         width;
+	int         big;
+	const char *cmd;
+	/* Part of the regression workload set */
+	int         check;
+};
+
+static unsigned long long
+run_read(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	volatile unsigned int sink = 0;
+	unsigned int a;
+	unsigned int step = b->width / 8;
+
+	for (a = 0; a < BENCH_MICRO_BYTES; a += step) {
+		switch (b->width) {
+			case 8:
+				sink += read_8(dev, a);
+				break;
+			case 16:
+				sink += b->big ? read_be16(dev, a) : read_le16(dev, a);
+				break;
+			default:
+				sink += b->big ? read_be32(dev, a) : read_le32(dev, a);
+				break;
+		}
+	}
+	(void)sink;
+	*bytes = BENCH_MICRO_BYTES;
+	return BENCH_MICRO_BYTES / step;
+}
+
+static unsigned long long
+run_write(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	unsigned int a;
+	unsigned int step = b->width / 8;
+
+	for (a = 0; a < BENCH_MICRO_BYTES; a += step) {
+		switch (b->width) {
+			case 8:
+				write_8(dev, a, (unsigned char)a);
+				break;
+			case 16:
+				if (b->big) {
+					write_be16(dev, a, (unsigned short)a);
+				} else {
+					write_le16(dev, a, (unsigned short)a);
+				}
+				break;
+			default:
+				if (b->big) {
+					write_be32(dev, a, a);
+				} else {
+					write_le32(dev, a, a);
+				}
+				break;
+		}
+	}
+	*bytes = BENCH_MICRO_BYTES;
+	return BENCH_MICRO_BYTES / step;
+}
+
+/* One command through process_command (parsing and dispatch) */
+static unsigned long long
+run_command(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	char cmd[128];
+	unsigned int len = 0;
+	unsigned int addr;
+	unsigned int val;
+	int width;
+
+	big_endian = b->big;
+	snprintf(cmd, sizeof(cmd), "%s", b->cmd);
+	process_command(dev, cmd);
+
+	/* Bytes moved by d/f commands */
+	*bytes = 0;
+	if ((cmd[0] == 'd') && (sscanf(cmd, "d%d %x %x", &width, &addr, &len) == 3)) {
+		*bytes = len;
+	} else if ((cmd[0] == 'f') &&
+	           (sscanf(cmd, "f%d %x %x %x", &width, &addr, &val, &len) == 4)) {
+		*bytes = len;
+	}
+	return 1;
+}
+
+/* A batch of short commands, as a parsing benchmark */
+static unsigned long long
+run_parse(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	char cmd[64];
+	int i;
+
+	big_endian = b->big;
+	for (i = 0; i < 1000; i++) {
+		snprintf(cmd, sizeof(cmd), "%s", b->cmd);
+		process_command(dev, cmd);
+	}
+	*bytes = 0;
+	return 1000;
+}
+
+static char cmdfile_path[PATH_MAX];
+#define BENCH_CMDFILE_LINES  10000
+
+static unsigned long long
+run_cmdfile(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	big_endian = b->big;
+	useCmdFile(dev, cmdfile_path);
+	*bytes = 0;
+	return BENCH_CMDFILE_LINES;
+}
+
+static int
+make_cmdfile(
+	device_t   *dev,
+	const char *bar_path)
+{
+	FILE *fp;
+	int i;
+
+	snprintf(cmdfile_path, sizeof(cmdfile_path), "%s.cmd", bar_path);
+	fp = fopen(cmdfile_path, "w");
+	if (fp == NULL) {
+		return -1;
+	}
+	fprintf(fp, "bar%d\n", dev->bar);
+	for (i = 0; i < BENCH_CMDFILE_LINES; i++) {
+		/* Mostly register writes, some reads, like an init script */
+		if ((i % 8) == 7) {
+			fprintf(fp, "d32 %X 10\n", (i * 4) & 0xFFFF);
+		} else {
+			fprintf(fp, "c32 %X %X\n", (i * 4) & 0xFFFF, i * 0x01010101u);
+		}
+	}
+	return fclose(fp);
+}
+
+/* Sampler-side cost of one sweep record in the RAM ring, width selects
+ * hugepages (1) or plain 4 KiB pages (0)
+ */
+static ramcap_t *bench_rings[2];
+
+static unsigned long long
+run_ramcap(
+	device_t           *dev,
+	const bench_t      *b,
+	unsigned long long *bytes)
+{
+	uint64_t values[BENCH_RAMCAP_REGS] = { 0 };
+	ramcap_t *r = bench_rings[b->width];
+	unsigned long long i;
+
+	if (r == NULL) {
+		r = ramcap_create(BENCH_RAMCAP_SIZE, b->width);
+		if (r == NULL) {
+			*bytes = 0;
+			return 1;
+		}
+		ramcap_reset(r, BENCH_RAMCAP_REGS);
+		fprintf(stderr, "%s: %s\n", b->name, ramcap_pages_str(r));
+		bench_rings[b->width] = r;
+	}
+	for (i = 0; i < BENCH_RAMCAP_RECORDS; i++) {
+		values[i & (BENCH_RAMCAP_REGS - 1)] = i;
+		ramcap_add(r, i, values);
+	}
+	*bytes = (unsigned long long)BENCH_RAMCAP_RECORDS * r->rec;
+	return BENCH_RAMCAP_RECORDS;
+}
+
+static const bench_t benches[] = {
+	/* read_xx/write_xx helpers by width and endianness */
+	{ "micro", "read_8",     run_read,  8,  0, NULL, 0 },
+	{ "micro", "read_le16",  run_read,  16, 0, NULL, 0 },
+	{ "micro", "read_be16",  run_read,  16, 1, NULL, 0 },
+	{ "micro", "read_le32",  run_read,  32, 0, NULL, 0 },
+	{ "micro", "read_be32",  run_read,  32, 1, NULL, 0 },
+	{ "micro", "write_8",    run_write, 8,  0, NULL, 0 },
+	{ "micro", "write_le16", run_write, 16, 0, NULL, 0 },
+	{ "micro", "write_be16", run_write, 16, 1, NULL, 0 },
+	{ "micro", "write_le32", run_write, 32, 0, NULL, 0 },
+	{ "micro", "write_be32", run_write, 32, 1, NULL, 0 },
+
+	/* RAM capture ring record stores, per sample */
+	{ "micro", "ramcap_store_4k",   run_ramcap, 0, 0, NULL, 0 },
+	{ "micro", "ramcap_store_huge", run_ramcap, 1, 0, NULL, 0 },
+
+	/* process_command parsing and dispatch */
+	{ "parse", "parse_d32_empty",  run_parse, 0, 0, "d32 0 0", 1 },
+	{ "parse", "parse_c32",        run_parse, 0, 0, "c32 10 A5A5A5A5", 1 },
+	{ "parse", "parse_endian",     run_parse, 0, 0, "el", 1 },
+
+	/* display_mem formatting (small dumps, output discarded) */
+	{ "format", "display_d8_4k",   run_command, 0, 0, "d8 0 1000", 1 },
+	{ "format", "display_d16_4k",  run_command, 0, 0, "d16 0 1000", 1 },
+	{ "format", "display_d32_4k",  run_command, 0, 0, "d32 0 1000", 1 },
+	{ "format", "display_d32_4k_be", run_command, 0, 1, "d32 0 1000", 1 },
+
+	/* useCmdFile on a generated init script */
+	{ "script", "cmdfile_10k_lines", run_cmdfile, 0, 0, NULL, 1 },
+
+	/* End to end d/f over the stand-in BAR */
+	{ "macro", "dump_d8_1m",       run_command, 0, 0, "d8 0 100000", 1 },
+	{ "macro", "dump_d32_4m",      run_command, 0, 0, "d32 0 400000", 1 },
+	{ "macro", "dump_d32_4m_be",   run_command, 0, 1, "d32 0 400000", 1 },
+	{ "macro", "fill_f8_16m_inc",  run_command, 0, 0, "f8 0 1 1000000 1", 1 },
+	{ "macro", "fill_f32_16m_inc", run_command, 0, 0, "f32 0 1 1000000 1", 1 },
+	{ "macro", "fill_f32_16m_inc_be", run_command, 0, 1, "f32 0 1 1000000 1", 1 },
+	{ "macro", "fill_f32_16m_const", run_command, 0, 0, "f32 0 0 1000000 0", 1 },
+	{ "macro", "fill_f32_4k_inc",  run_command, 0, 0, "f32 0 1 1000 1", 1 },
+	{ NULL, NULL, NULL, 0, 0, NULL, 0 }
+};
+
+/* ----------------------------------------------------------------
+ * Driver
+ * ----------------------------------------------------------------
+ */
+static void
+bench_one(
+	device_t      *dev,
+	const bench_t *b)
+{
+	double samples[BENCH_REPS];
+	unsigned long long ops = 0;
+	unsigned long long bytes = 0;
+	unsigned long long runs;
+	unsigned long long rops;
+	unsigned long long rbytes;
+	double start;
+	double elapsed;
+	bench_result_t *r;
+	int rep;
+
+	/* Warm up (page faults, branch predictors, stdio buffers) */
+	b->run(dev, b, &bytes);
+
+	for (rep = 0; rep < BENCH_REPS; rep++) {
+		runs = 0;
+		rops = 0;
+		rbytes = 0;
+		start = bench_now();
+		do {
+			rops += b->run(dev, b, &bytes);
+			rbytes += bytes;
+			runs++;
+			elapsed = bench_now() - start;
+		} while (elapsed < min_time);
+		fflush(stdout);
+		samples[rep] = elapsed * 1e9 / rops;
+		ops = rops / runs;
+		bytes = rbytes / runs;
+	}
+	qsort(samples, BENCH_REPS, sizeof(double), cmp_double);
+
+	if (nresults == BENCH_MAX_RESULTS) {
+		return;
+	}
+	r = &results[nresults++];
+	r->group = b->group;
+	r->name = b->name;
+	r->ops = ops;
+	r->bytes = bytes;
+	r->ns_per_op = samples[BENCH_REPS / 2];
+	r->mb_per_s = (bytes > 0) ? (bytes / (double)ops) / r->ns_per_op * 1e3 : 0;
+	r->best_ns_per_op = samples[0];
+	r->best_mb_per_s = (bytes > 0) ? (bytes / (double)ops) / r->best_ns_per_op * 1e3 : 0;
+	r->check = b->check;
+}
+
+/* Baselines are per host */
+static void
+bench_host(
+	char   *host,
+	size_t  len)
+{
+	if (gethostname(host, len) != 0) {
+		snprintf(host, len, "unknown");
+	}
+	host[len - 1] = '\0';
+}
+
+static void
+bench_report(
+	FILE       *fp,
+	device_t   *dev)
+{
+	char host[256];
+	char stamp[32];
+	time_t t;
+	int i;
+
+	bench_host(host, sizeof(host));
+	t = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"schema\": %d,\n", BENCH_SCHEMA);
+	fprintf(fp, "  \"host\": \"%s\",\n", host);
+	fprintf(fp, "  \"timestamp\": \"%s\",\n", stamp);
+	fprintf(fp, "  \"bar_size\": %u,\n", dev->size);
+	fprintf(fp, "  \"swab\": \"%s\",\n", swab_impl());
+	fprintf(fp, "  \"results\": [\n");
+	for (i = 0; i < nresults; i++) {
+		fprintf(fp, "    {\"group\": \"%s\", \"name\": \"%s\", "
+			"\"ops\": %llu, \"bytes\": %llu, "
+			"\"ns_per_op\": %.3f, \"mb_per_s\": %.3f, "
+			"\"best_ns_per_op\": %.3f, \"best_mb_per_s\": %.3f}%s\n",
+			results[i].group, results[i].name,
+			results[i].ops, results[i].bytes,
+			results[i].ns_per_op, results[i].mb_per_s,
+			results[i].best_ns_per_op, results[i].best_mb_per_s,
+			(i + 1 < nresults) ? "," : "");
+	}
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+}
+
+/* Map a file as a stand-in BAR, the way main() maps resourceN */
+static int
+bench_open(
+	device_t     *dev,
+	const char   *path,
+	unsigned int  size)
+{
+	memset(dev, 0, sizeof(*dev));
+	snprintf(dev->filename, sizeof(dev->filename), "%s", path);
+	dev->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (dev->fd < 0) {
+		fprintf(stderr, "Open failed for file '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(dev->fd, size) < 0) {
+		fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+		close(dev->fd);
+		return -1;
+	}
+	dev->size = size;
+	dev->maddr = (unsigned char *)mmap(NULL, size, PROT_READ|PROT_WRITE,
+		MAP_SHARED, dev->fd, 0);
+	if (dev->maddr == (unsigned char *)MAP_FAILED) {
+		fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+		close(dev->fd);
+		return -1;
+	}
+	dev->addr = dev->maddr;
+	dev->wc_fd = -1;
+	return 0;
+}
+
+int
+main(
+	int   argc,
+	char *argv[])
+{
+	const char *bar_path = BENCH_DEFAULT_BAR;
+	const char *out_path = NULL;
+	const char *baseline_path = NULL;
+	double tolerance = 20.0;
+	int update = 0;
+	int status = 0;
+	char host[256];
+	unsigned int size = BENCH_DEFAULT_SIZE;
+	device_t device;
+	device_t *dev = &device;
+	const bench_t *b;
+	FILE *out;
+	int null_fd;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:s:t:o:b:T:uh")) != -1) {
+		switch (opt) {
+			case 'r':
+				bar_path = optarg;
+				break;
+			case 's':
+				size = strtoul(optarg, NULL, 0);
+				break;
+			case 't':
+				min_time = atof(optarg);
+				break;
+			case 'o':
+				out_path = optarg;
+				break;
+			case 'b':
+				baseline_path = optarg;
+				break;
+			case 'T':
+				tolerance = atof(optarg);
+				break;
+			case 'u':
+				update = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-r file] [-s size] [-t seconds] [-o file]\n"
+					"       [-b baselines [-T tolerance] [-u]]\n",
+					argv[0]);
+				return -1;
+		}
+	}
+	if (size < BENCH_DEFAULT_SIZE) {
+		fprintf(stderr, "Stand-in BAR must be at least %d bytes\n", BENCH_DEFAULT_SIZE);
+		return -1;
+	}
+	if (bench_open(dev, bar_path, size) < 0) {
+		return -1;
+	}
+	if (make_cmdfile(dev, bar_path) < 0) {
+		fprintf(stderr, "Cannot write '%s.cmd'\n", bar_path);
+		return -1;
+	}
+
+	/* Quiet tool, handler output goes to /dev/null */
+	verbosity = 0;
+	quit = 1;
+	fflush(stdout);
+	out_fd = dup(STDOUT_FILENO);
+	null_fd = open("/dev/null", O_WRONLY);
+	if ((out_fd < 0) || (null_fd < 0) || (dup2(null_fd, STDOUT_FILENO) < 0)) {
+		fprintf(stderr, "Cannot redirect stdout\n");
+		return -1;
+	}
+	close(null_fd);
+
+	for (b = benches; b->name != NULL; b++) {
+		fprintf(stderr, "%-8s %s\n", b->group, b->name);
+		bench_one(dev, b);
+	}
+	big_endian = 0;
+
+	fflush(stdout);
+	dup2(out_fd, STDOUT_FILENO);
+	close(out_fd);
+
+	if (out_path != NULL) {
+		out = fopen(out_path, "w");
+		if (out == NULL) {
+			fprintf(stderr, "Cannot write '%s': %s\n", out_path, strerror(errno));
+			return -1;
+		}
+		bench_report(out, dev);
+		fclose(out);
+	} else {
+		bench_report(stdout, dev);
+	}
+
+	if (baseline_path != NULL) {
+		bench_host(host, sizeof(host));
+		status = regress_check(baseline_path, host, results, nresults,
+			tolerance, update);
+	}
+
+	unlink(cmdfile_path);
+	munmap(dev->maddr, dev->size);
+	close(dev->fd);
+	/* Do not leave 16 MiB behind in /dev/shm */
+	if (strcmp(bar_path, BENCH_DEFAULT_BAR) == 0) {
+		unlink(bar_path);
+	}
+	return (status == 0) ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+/* bench.h
+ *
+ * pci_debug benchmark results and the performance regression check.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct {
+	const char        *group;
+	const char        *name;
+	unsigned long long ops;       /* per run */
+	unsigned long long bytes;     /* per run, 0 if not meaningful */
+	double             ns_per_op; /* median over BENCH_REPS */
+	double             mb_per_s;
+	double             best_ns_per_op; /* fastest of BENCH_REPS */
+	double             best_mb_per_s;
+	int                check;     /* part of the regression workload set */
+} bench_result_t;
+
+/* Compare the checked results with this host's baseline in path.
+ *
+ * Throughput (MB/s) is compared for results that move bytes, latency
+ * (ns/op) for the others, both taken from the fastest run, which is
+ * far less sensitive to other load on the host than the median.
+ * Returns the number of results that got worse by more than tolerance
+ * percent, or -1 on error. When update is set, or the host has no
+ * baseline yet, the results are recorded as the new baseline instead
+ * (other hosts' lines are kept).
+ */
+int regress_check(const char *path, const char *host,
+	const bench_result_t *results, int n, double tolerance, int update);
+
+#endif /* BENCH_H */
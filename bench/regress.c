@@ -0,0 +1,209 @@
+/* regress.c
+ *
+ * Performance regression check against per-host baselines.
+ *
+ * The baseline file is plain text, one line per host and result:
+ *
+ *   host group name ns_per_op mb_per_s
+ *
+ * (the fastest of the repetitions, not the median).
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define REGRESS_MAX_LINES  4096
+
+typedef struct {
+	char   host[128];
+	char   group[32];
+	char   name[64];
+	double ns_per_op;
+	double mb_per_s;
+} baseline_t;
+
+static int
+baseline_load(
+	const char  *path,
+	baseline_t **lines)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	baseline_t *b;
+	int n = 0;
+
+	*lines = (baseline_t *)calloc(REGRESS_MAX_LINES, sizeof(baseline_t));
+	if (*lines == NULL) {
+		return -1;
+	}
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		/* No baselines yet */
+		return (errno == ENOENT) ? 0 : -1;
+	}
+	while ((getline(&line, &len, fp) != -1) && (n < REGRESS_MAX_LINES)) {
+		b = &(*lines)[n];
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%127s %31s %63s %lf %lf", b->host, b->group,
+		           b->name, &b->ns_per_op, &b->mb_per_s) == 5) {
+			n++;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return n;
+}
+
+static int
+baseline_save(
+	const char           *path,
+	const char           *host,
+	const baseline_t     *lines,
+	int                   nlines,
+	const bench_result_t *results,
+	int                   n)
+{
+	char tmppath[4096];
+	FILE *fp;
+	int i;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	fp = fopen(tmppath, "w");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "# pci_debug performance baselines\n");
+	fprintf(fp, "# host group name ns_per_op mb_per_s\n");
+	for (i = 0; i < nlines; i++) {
+		if (strcmp(lines[i].host, host) != 0) {
+			fprintf(fp, "%s %s %s %.3f %.3f\n", lines[i].host,
+				lines[i].group, lines[i].name,
+				lines[i].ns_per_op, lines[i].mb_per_s);
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (results[i].check) {
+			fprintf(fp, "%s %s %s %.3f %.3f\n", host,
+				results[i].group, results[i].name,
+				results[i].best_ns_per_op, results[i].best_mb_per_s);
+		}
+	}
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "Cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	if (rename(tmppath, path) != 0) {
+		fprintf(stderr, "Cannot update '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static const baseline_t *
+baseline_find(
+	const baseline_t *lines,
+	int               nlines,
+	const char       *host,
+	const char       *name)
+{
+	int i;
+
+	for (i = 0; i < nlines; i++) {
+		if ((strcmp(lines[i].host, host) == 0) &&
+		    (strcmp(lines[i].name, name) == 0)) {
+			return &lines[i];
+		}
+	}
+	return NULL;
+}
+
+int
+regress_check(
+	const char           *path,
+	const char           *host,
+	const bench_result_t *results,
+	int                   n,
+	double                tolerance,
+	int                   update)
+{
+	baseline_t *lines;
+	const baseline_t *b;
+	int nlines;
+	int known = 0;
+	int failed = 0;
+	double then;
+	double now;
+	double change;
+	double worse;
+	const char *metric;
+	const char *verdict;
+	int i;
+
+	nlines = baseline_load(path, &lines);
+	if (nlines < 0) {
+		fprintf(stderr, "Cannot read '%s': %s\n", path, strerror(errno));
+		free(lines);
+		return -1;
+	}
+	for (i = 0; i < nlines; i++) {
+		if (strcmp(lines[i].host, host) == 0) {
+			known = 1;
+		}
+	}
+	if (update || !known) {
+		i = baseline_save(path, host, lines, nlines, results, n);
+		fprintf(stderr, "%s baseline for %s in %s\n",
+			known ? "Updated" : "Recorded", host, path);
+		free(lines);
+		return (i < 0) ? -1 : 0;
+	}
+
+	fprintf(stderr, "%-24s %-6s %14s %14s %8s\n",
+		"workload", "metric", "baseline", "now", "change");
+	for (i = 0; i < n; i++) {
+		if (!results[i].check) {
+			continue;
+		}
+		b = baseline_find(lines, nlines, host, results[i].name);
+		if (b == NULL) {
+			fprintf(stderr, "%-24s (no baseline)\n", results[i].name);
+			continue;
+		}
+		/* Relative change of the metric, and how much worse it got */
+		if (results[i].bytes > 0) {
+			metric = "MB/s";
+			then = b->mb_per_s;
+			now = results[i].best_mb_per_s;
+			change = (then > 0) ? 100.0 * (now - then) / then : 0;
+			worse = -change;
+		} else {
+			metric = "ns/op";
+			then = b->ns_per_op;
+			now = results[i].best_ns_per_op;
+			change = (then > 0) ? 100.0 * (now - then) / then : 0;
+			worse = change;
+		}
+		if (worse > tolerance) {
+			verdict = "REGRESSION";
+			failed++;
+		} else if (worse < -tolerance) {
+			verdict = "faster";
+		} else {
+			verdict = "ok";
+		}
+		fprintf(stderr, "%-24s %-6s %14.3f %14.3f %+7.1f%% %s\n",
+			results[i].name, metric, then, now, change, verdict);
+	}
+	fprintf(stderr, "%d regression(s) beyond %.1f%%\n", failed, tolerance);
+	free(lines);
+	return failed;
+}
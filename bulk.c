@@ -0,0 +1,637 @@
+/* bulk.c
+ *
+ * Chunked, optionally multi-threaded, transfers to and from a BAR.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bulk.h"
+#include "accprof.h"
+#include "cancel.h"
+#include "swab.h"
+
+/* 128-bit loads and stores through the GCC vector extension: SSE2
+ * movdqa on x86-64, q-register ldr/str on AArch64
+ */
+typedef uint64_t vec128_t __attribute__((vector_size(16)));
+
+#define OP_READ   0
+#define OP_WRITE  1
+#define OP_FILL   2
+
+typedef struct {
+	const strategy_t   *s;
+	int                 op;
+
+	/* BAR window (mapping + addr) */
+	volatile unsigned char *bar;
+	unsigned int        len;
+
+	/* OP_READ destination, OP_WRITE source */
+	unsigned char      *rbuf;
+	const unsigned char *wbuf;
+
+	/* OP_FILL pattern */
+	int                 width;
+	int                 big;
+	unsigned int        val;
+	unsigned int        inc;
+
+	/* Chunk dispenser */
+	unsigned int        nchunks;
+	atomic_uint         next;
+
+	progress_t         *prog;
+} job_t;
+
+/* ----------------------------------------------------------------
+ * Mappings
+ * ----------------------------------------------------------------
+ */
+int
+dev_map_wc(
+	device_t *dev)
+{
+	char wcname[110];
+
+	if (dev->wc_maddr != NULL) {
+		return 0;
+	}
+	/* Only prefetchable BARs have a resourceN_wc node */
+	snprintf(wcname, sizeof(wcname), "%s_wc", dev->filename);
+	dev->wc_fd = open(wcname, O_RDWR | O_SYNC);
+	if (dev->wc_fd < 0) {
+		return -1;
+	}
+	dev->wc_maddr = (unsigned char *)mmap(
+		NULL,
+		(size_t)(dev->size),
+		PROT_READ|PROT_WRITE,
+		MAP_SHARED,
+		dev->wc_fd,
+		0);
+	if (dev->wc_maddr == (unsigned char *)MAP_FAILED) {
+		dev->wc_maddr = NULL;
+		close(dev->wc_fd);
+		dev->wc_fd = -1;
+		return -1;
+	}
+	dev->wc_addr = dev->wc_maddr + dev->offset;
+	return 0;
+}
+
+void
+dev_unmap_wc(
+	device_t *dev)
+{
+	if (dev->wc_maddr != NULL) {
+		munmap(dev->wc_maddr, dev->size);
+		close(dev->wc_fd);
+		dev->wc_maddr = NULL;
+		dev->wc_addr = NULL;
+		dev->wc_fd = -1;
+	}
+}
+
+const char *
+strategy_str(
+	const strategy_t *s,
+	char             *buf,
+	int               len)
+{
+	static const char *fences[] = { "access", "chunk", "end" };
+
+	snprintf(buf, len, "w%d %s t%d c%u fence=%s",
+		s->width, (s->map == MAP_WC) ? "wc" : "uc",
+		s->threads, s->chunk, fences[s->fence]);
+	return buf;
+}
+
+/* ----------------------------------------------------------------
+ * MMIO copy kernels
+ * ----------------------------------------------------------------
+ */
+
+/* Order the preceding stores and push them out of the mapping */
+static void
+mmio_fence(
+	volatile unsigned char *addr,
+	unsigned int            len)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+	uintptr_t end = (uintptr_t)addr + len;
+
+	__sync_synchronize();
+	msync((void *)start, end - start, MS_SYNC | MS_INVALIDATE);
+}
+
+static void
+mmio_read(
+	unsigned char          *dst,
+	volatile unsigned char *src,
+	unsigned int            len,
+	int                     width)
+{
+	unsigned int bytes = width / 8;
+	vec128_t d128;
+	uint64_t d64;
+	uint32_t d32;
+	uint16_t d16;
+
+	/* Narrow accesses up to the first aligned address */
+	while ((len > 0) && ((uintptr_t)src & (bytes - 1))) {
+		*dst++ = *src++;
+		len--;
+	}
+	switch (width) {
+		case 128:
+			for (; len >= 16; len -= 16, src += 16, dst += 16) {
+				d128 = *(volatile vec128_t *)src;
+				memcpy(dst, &d128, 16);
+			}
+			break;
+		case 64:
+			for (; len >= 8; len -= 8, src += 8, dst += 8) {
+				d64 = *(volatile uint64_t *)src;
+				memcpy(dst, &d64, 8);
+			}
+			break;
+		case 32:
+			for (; len >= 4; len -= 4, src += 4, dst += 4) {
+				d32 = *(volatile uint32_t *)src;
+				memcpy(dst, &d32, 4);
+			}
+			break;
+		case 16:
+			for (; len >= 2; len -= 2, src += 2, dst += 2) {
+				d16 = *(volatile uint16_t *)src;
+				memcpy(dst, &d16, 2);
+			}
+			break;
+		default:
+			break;
+	}
+	/* Tail */
+	while (len > 0) {
+		*dst++ = *src++;
+		len--;
+	}
+}
+
+static void
+mmio_write(
+	volatile unsigned char *dst,
+	const unsigned char    *src,
+	unsigned int            len,
+	int                     width,
+	int                     fence)
+{
+	unsigned int bytes = width / 8;
+	vec128_t d128;
+	uint64_t d64;
+	uint32_t d32;
+	uint16_t d16;
+
+	while ((len > 0) && ((uintptr_t)dst & (bytes - 1))) {
+		*dst = *src++;
+		if (fence == FENCE_ACCESS) {
+			mmio_fence(dst, 1);
+		}
+		dst++;
+		len--;
+	}
+	switch (width) {
+		case 128:
+			for (; len >= 16; len -= 16, src += 16, dst += 16) {
+				memcpy(&d128, src, 16);
+				*(volatile vec128_t *)dst = d128;
+				if (fence == FENCE_ACCESS) {
+					mmio_fence(dst, 16);
+				}
+			}
+			break;
+		case 64:
+			for (; len >= 8; len -= 8, src += 8, dst += 8) {
+				memcpy(&d64, src, 8);
+				*(volatile uint64_t *)dst = d64;
+				if (fence == FENCE_ACCESS) {
+					mmio_fence(dst, 8);
+				}
+			}
+			break;
+		case 32:
+			for (; len >= 4; len -= 4, src += 4, dst += 4) {
+				memcpy(&d32, src, 4);
+				*(volatile uint32_t *)dst = d32;
+				if (fence == FENCE_ACCESS) {
+					mmio_fence(dst, 4);
+				}
+			}
+			break;
+		case 16:
+			for (; len >= 2; len -= 2, src += 2, dst += 2) {
+				memcpy(&d16, src, 2);
+				*(volatile uint16_t *)dst = d16;
+				if (fence == FENCE_ACCESS) {
+					mmio_fence(dst, 2);
+				}
+			}
+			break;
+		default:
+			break;
+	}
+	while (len > 0) {
+		*dst = *src++;
+		if (fence == FENCE_ACCESS) {
+			mmio_fence(dst, 1);
+		}
+		dst++;
+		len--;
+	}
+}
+
+/* Fill pattern for the bytes [off, off+len) of the window */
+static void
+fill_pattern(
+	const job_t   *job,
+	unsigned char *buf,
+	unsigned int   off,
+	unsigned int   len)
+{
+	unsigned int bytes = job->width / 8;
+	unsigned int k = off / bytes;
+	unsigned int i;
+	uint16_t d16;
+	uint32_t d32;
+	int swap;
+
+	/* Generated in host order, then swapped for the whole chunk */
+	swap = (job->big != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN);
+	switch (job->width) {
+		case 8:
+			for (i = 0; i < len; i++, k++) {
+				buf[i] = (unsigned char)(job->val + k*job->inc);
+			}
+			break;
+		case 16:
+			for (i = 0; i + 2 <= len; i += 2, k++) {
+				d16 = (uint16_t)(job->val + k*job->inc);
+				memcpy(buf + i, &d16, 2);
+			}
+			if (swap) {
+				swab16_buf(buf, len);
+			}
+			break;
+		case 32:
+			for (i = 0; i + 4 <= len; i += 4, k++) {
+				d32 = job->val + k*job->inc;
+				memcpy(buf + i, &d32, 4);
+			}
+			if (swap) {
+				swab32_buf(buf, len);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/* ----------------------------------------------------------------
+ * Workers
+ * ----------------------------------------------------------------
+ */
+static void *
+bulk_worker(
+	void *arg)
+{
+	job_t *job = (job_t *)arg;
+	const strategy_t *s = job->s;
+	unsigned char *tmp = NULL;
+	unsigned int c;
+	unsigned int off;
+	unsigned int n;
+
+	if (job->op == OP_FILL) {
+		tmp = (unsigned char *)malloc(s->chunk);
+		if (tmp == NULL) {
+			return NULL;
+		}
+	}
+
+	/* Claimed chunks are always completed, so on cancellation the
+	 * bytes done form a prefix of the window
+	 */
+	while (!cancel_pending()) {
+		c = atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+		if (c >= job->nchunks) {
+			break;
+		}
+		off = c * s->chunk;
+		n = job->len - off;
+		if (n > s->chunk) {
+			n = s->chunk;
+		}
+		switch (job->op) {
+			case OP_READ:
+				mmio_read(job->rbuf + off, job->bar + off, n, s->width);
+				break;
+			case OP_WRITE:
+				mmio_write(job->bar + off, job->wbuf + off, n, s->width, s->fence);
+				break;
+			case OP_FILL:
+				fill_pattern(job, tmp, off, n);
+				mmio_write(job->bar + off, tmp, n, s->width, s->fence);
+				break;
+		}
+		if ((job->op != OP_READ) && (s->fence == FENCE_CHUNK)) {
+			mmio_fence(job->bar + off, n);
+		}
+		if (job->prog != NULL) {
+			progress_add(job->prog, n);
+		}
+	}
+	free(tmp);
+	return NULL;
+}
+
+static unsigned int
+bulk_run(
+	device_t *dev,
+	job_t    *job,
+	unsigned int addr)
+{
+	const strategy_t *s = job->s;
+	pthread_t threads[BULK_MAX_THREADS];
+	unsigned long long t0 = (dev->accprof != NULL) ? accprof_now() : 0;
+	unsigned char *base;
+	unsigned int done;
+	int nthreads;
+	int i;
+
+	base = ((s->map == MAP_WC) && (dev->wc_addr != NULL)) ? dev->wc_addr : dev->addr;
+	job->bar = base + addr;
+	job->nchunks = (job->len + s->chunk - 1) / s->chunk;
+	atomic_init(&job->next, 0);
+
+	nthreads = s->threads;
+	if (nthreads > BULK_MAX_THREADS) {
+		nthreads = BULK_MAX_THREADS;
+	}
+	if (nthreads > (int)job->nchunks) {
+		nthreads = job->nchunks;
+	}
+
+	if (nthreads <= 1) {
+		bulk_worker(job);
+	} else {
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&threads[i], NULL, bulk_worker, job) != 0) {
+				break;
+			}
+		}
+		nthreads = i;
+		/* Nothing started: do the work here */
+		if (nthreads == 0) {
+			bulk_worker(job);
+		}
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+
+	if ((job->op != OP_READ) && (s->fence == FENCE_END)) {
+		mmio_fence(job->bar, job->len);
+	}
+
+	done = atomic_load_explicit(&job->next, memory_order_relaxed);
+	done = (done >= job->nchunks) ? job->len : done * s->chunk;
+	dev->mmio_ops += done / (s->width / 8);
+	if (dev->accprof != NULL) {
+		accprof_record(dev, t0, addr, s->width,
+			(job->op == OP_READ) ? ACCPROF_READ : ACCPROF_WRITE, 1, done);
+	}
+	return done;
+}
+
+unsigned int
+bulk_read(
+	device_t         *dev,
+	const strategy_t *s,
+	unsigned int      addr,
+	unsigned char    *buf,
+	unsigned int      len,
+	progress_t       *prog)
+{
+	job_t job;
+
+	memset(&job, 0, sizeof(job));
+	job.s = s;
+	job.op = OP_READ;
+	job.len = len;
+	job.rbuf = buf;
+	job.prog = prog;
+	return bulk_run(dev, &job, addr);
+}
+
+unsigned int
+bulk_write(
+	device_t            *dev,
+	const strategy_t    *s,
+	unsigned int         addr,
+	const unsigned char *buf,
+	unsigned int         len,
+	progress_t          *prog)
+{
+	job_t job;
+
+	memset(&job, 0, sizeof(job));
+	job.s = s;
+	job.op = OP_WRITE;
+	job.len = len;
+	job.wbuf = buf;
+	job.prog = prog;
+	return bulk_run(dev, &job, addr);
+}
+
+unsigned int
+bulk_fill(
+	device_t         *dev,
+	const strategy_t *s,
+	unsigned int      addr,
+	unsigned int      len,
+	int               width,
+	int               big,
+	unsigned int      val,
+	unsigned int      inc,
+	progress_t       *prog)
+{
+	job_t job;
+
+	memset(&job, 0, sizeof(job));
+	job.s = s;
+	job.op = OP_FILL;
+	/* Whole elements only, as the f command does */
+	job.len = len - (len % (width / 8));
+	job.width = width;
+	job.big = big;
+	job.val = val;
+	job.inc = inc;
+	job.prog = prog;
+	return bulk_run(dev, &job, addr);
+}
+
+/* ----------------------------------------------------------------
+ * Fast fill
+ * ----------------------------------------------------------------
+ */
+
+/* Store the w bytes at pat (w = 1, 2, 4 or 8, dst aligned to w) */
+static inline void
+set_store(
+	volatile unsigned char *dst,
+	const unsigned char    *pat,
+	int                     w)
+{
+	uint64_t d64;
+	uint32_t d32;
+	uint16_t d16;
+
+	switch (w) {
+		case 8:
+			memcpy(&d64, pat, 8);
+			*(volatile uint64_t *)dst = d64;
+			break;
+		case 4:
+			memcpy(&d32, pat, 4);
+			*(volatile uint32_t *)dst = d32;
+			break;
+		case 2:
+			memcpy(&d16, pat, 2);
+			*(volatile uint16_t *)dst = d16;
+			break;
+		default:
+			*dst = *pat;
+			break;
+	}
+}
+
+/* Head or tail: largest naturally aligned stores that fit */
+static unsigned int
+set_edge(
+	volatile unsigned char *bar,
+	unsigned int            off,
+	unsigned int            end,
+	const unsigned char    *rep,
+	int                     patlen)
+{
+	int w;
+
+	while (off < end) {
+		for (w = 8; w > 1; w >>= 1) {
+			if ((((uintptr_t)(bar + off) & (w - 1)) == 0) && (off + w <= end)) {
+				break;
+			}
+		}
+		set_store(bar + off, rep + (off % patlen), w);
+		off += w;
+	}
+	return off;
+}
+
+unsigned int
+bulk_set(
+	device_t            *dev,
+	unsigned int         addr,
+	unsigned int         len,
+	const unsigned char *pat,
+	int                  patlen,
+	progress_t          *prog)
+{
+	unsigned long long t0 = (dev->accprof != NULL) ? accprof_now() : 0;
+	volatile unsigned char *bar;
+	unsigned char rep[32];
+	unsigned int off;
+	unsigned int head;
+	unsigned int body;
+	unsigned int start;
+	unsigned int end;
+	vec128_t v;
+	int wc;
+	int i;
+
+	wc = (dev->wc_addr != NULL);
+	bar = (wc ? dev->wc_addr : dev->addr) + addr;
+
+	/* The pattern repeated: byte k of the window is rep[k % patlen],
+	 * and every 16-byte aligned block starts at the same phase
+	 */
+	for (i = 0; i < (int)sizeof(rep); i++) {
+		rep[i] = pat[i % patlen];
+	}
+
+	/* Head up to the first 16-byte boundary */
+	head = (16 - ((uintptr_t)bar & 15)) & 15;
+	if (head > len) {
+		head = len;
+	}
+	off = set_edge(bar, 0, head, rep, patlen);
+	if (prog != NULL) {
+		progress_add(prog, head);
+	}
+
+	/* Body: 16-byte stores, accounted and cancellable per chunk */
+	body = head + ((len - head) & ~15u);
+	memcpy(&v, rep + (off % patlen), 16);
+	while ((off < body) && !cancel_pending()) {
+		start = off;
+		end = (body - off > PROGRESS_CHUNK) ? off + PROGRESS_CHUNK : body;
+		for (; off < end; off += 16) {
+#ifdef __SSE2__
+			if (wc) {
+				/* Full-line write-combining, bypassing the cache */
+				_mm_stream_si128((__m128i *)(bar + off), (__m128i)v);
+				continue;
+			}
+#endif
+			*(volatile vec128_t *)(bar + off) = v;
+		}
+		if (prog != NULL) {
+			progress_add(prog, end - start);
+		}
+	}
+
+	/* Tail */
+	if (off == body) {
+		off = set_edge(bar, off, len, rep, patlen);
+		if (prog != NULL) {
+			progress_add(prog, len - body);
+		}
+	}
+
+	/* One fence for the whole fill */
+#ifdef __SSE2__
+	if (wc) {
+		_mm_sfence();
+	}
+#endif
+	mmio_fence(bar, len);
+	dev->mmio_ops += (off + 15) / 16;
+	if (dev->accprof != NULL) {
+		accprof_record(dev, t0, addr, 128, ACCPROF_WRITE, 1, off);
+	}
+	return off;
+}
@@ -0,0 +1,73 @@
+/* bulk.h
+ *
+ * Bulk transfers between host memory and a BAR window.
+ *
+ * A transfer is cut in chunks which are handed out to one or more
+ * worker threads. How each chunk is moved (access width, UC or WC
+ * mapping, chunk size, where the fences go) is described by a
+ * strategy_t, which the tuner picks per device.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef BULK_H
+#define BULK_H
+
+#include "pci_debug.h"
+#include "progress.h"
+
+/* Mapping used for the accesses */
+#define MAP_UC        0
+#define MAP_WC        1
+
+/* Fence placement for stores */
+#define FENCE_ACCESS  0   /* after every store (as c/f always did) */
+#define FENCE_CHUNK   1   /* once per chunk */
+#define FENCE_END     2   /* once for the whole transfer */
+
+#define BULK_MAX_THREADS  16
+
+/* Chunks must hold a whole number of the widest accesses */
+#define BULK_MIN_CHUNK    16
+
+typedef struct {
+	int          width;    /* MMIO access width in bits: 8 to 128 */
+	int          map;      /* MAP_UC or MAP_WC */
+	int          threads;  /* worker threads */
+	unsigned int chunk;    /* bytes per chunk */
+	int          fence;    /* FENCE_xxx, stores only */
+} strategy_t;
+
+/* What the tool did before any tuning */
+#define STRATEGY_DEFAULT  { 32, MAP_UC, 1, 65536, FENCE_ACCESS }
+
+int dev_map_wc(device_t *dev);
+void dev_unmap_wc(device_t *dev);
+
+const char *strategy_str(const strategy_t *s, char *buf, int len);
+
+/* Each returns the number of bytes transferred, which is less than
+ * len when the operation was cancelled. prog may be NULL.
+ */
+unsigned int bulk_read(device_t *dev, const strategy_t *s,
+	unsigned int addr, unsigned char *buf, unsigned int len,
+	progress_t *prog);
+unsigned int bulk_write(device_t *dev, const strategy_t *s,
+	unsigned int addr, const unsigned char *buf, unsigned int len,
+	progress_t *prog);
+
+/* Fill with the same pattern as f[width] addr val len inc: element k
+ * (of width bits, stored in big-endian order when big is set) holds
+ * val + k*inc
+ */
+unsigned int bulk_fill(device_t *dev, const strategy_t *s,
+	unsigned int addr, unsigned int len, int width, int big,
+	unsigned int val, unsigned int inc, progress_t *prog);
+
+/* Constant or repeating pattern (memset-style): pat of patlen bytes
+ * (1, 2 or 4) repeated over the window with the widest aligned stores,
+ * non-temporal on a WC mapping, and one fence at the end
+ */
+unsigned int bulk_set(device_t *dev, unsigned int addr, unsigned int len,
+	const unsigned char *pat, int patlen, progress_t *prog);
+
+#endif /* BULK_H */
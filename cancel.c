@@ -0,0 +1,55 @@
+/* cancel.c
+ *
+ * SIGINT handling for cancellation of long running operations.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cancel.h"
+
+volatile sig_atomic_t cancel_requested = 0;
+
+/* Set while a command is running, enables the second Ctrl-C escape */
+static volatile sig_atomic_t cancel_armed = 0;
+
+static void
+cancel_handler(
+	int sig)
+{
+	if (cancel_requested && cancel_armed) {
+		/* Second Ctrl-C: give up on a clean stop */
+		signal(sig, SIG_DFL);
+		raise(sig);
+		return;
+	}
+	cancel_requested = 1;
+}
+
+void
+cancel_init(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cancel_handler;
+	sigemptyset(&sa.sa_mask);
+	/* Let readline(), getline() and friends carry on */
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &sa, NULL);
+}
+
+void
+cancel_begin(void)
+{
+	cancel_requested = 0;
+	cancel_armed = 1;
+}
+
+void
+cancel_end(void)
+{
+	cancel_armed = 0;
+}
@@ -0,0 +1,32 @@
+/* cancel.h
+ *
+ * SIGINT-safe cancellation of long running operations.
+ *
+ * The signal handler only sets a flag. Bulk loops, samplers and
+ * capture writers poll cancel_pending() at chunk boundaries (never
+ * per element), stop cleanly, finalise whatever they were writing
+ * and report how far they got. Between cancel_begin() and
+ * cancel_end() a second Ctrl-C while a cancellation is already
+ * pending falls back to the default action, so a stuck loop can
+ * still be killed.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <signal.h>
+
+extern volatile sig_atomic_t cancel_requested;
+
+void cancel_init(void);
+void cancel_begin(void);
+void cancel_end(void);
+
+static inline int
+cancel_pending(void)
+{
+	return cancel_requested != 0;
+}
+
+#endif /* CANCEL_H */
@@ -0,0 +1,469 @@
+/* capture.c
+ *
+ * Columnar register capture files: writer and the capture command.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "sample.h"
+#include "aer.h"
+#include "irqrate.h"
+
+struct capture {
+	int            fd;
+	int            nregs;
+	int            bytes[SAMPLE_MAX_REGS];   /* per value */
+	uint64_t       first;                    /* sweep of the buffered block */
+	uint32_t       count;                    /* sweeps buffered */
+	int            error;
+
+	/* One buffer per column, CAPTURE_BLOCK values each */
+	uint64_t      *ts;
+	unsigned char *col[SAMPLE_MAX_REGS];
+};
+
+#define PAD8(n)  (((n) + 7) & ~7u)
+
+static int
+write_all(
+	int         fd,
+	const void *buf,
+	size_t      len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+capture_block(
+	capture_t  *c,
+	uint32_t    column,
+	const void *data,
+	uint32_t    len)
+{
+	static const unsigned char zero[8];
+	capture_blk_t blk;
+
+	memset(&blk, 0, sizeof(blk));
+	blk.magic = CAPTURE_BLK_MAGIC;
+	blk.column = column;
+	blk.count = c->count;
+	blk.first = c->first;
+	if ((write_all(c->fd, &blk, sizeof(blk)) < 0) ||
+	    (write_all(c->fd, data, len) < 0) ||
+	    (write_all(c->fd, zero, PAD8(len) - len) < 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+static void
+capture_flush(
+	capture_t *c)
+{
+	int i;
+
+	if ((c->count == 0) || c->error) {
+		return;
+	}
+	/* Time stamps first: a reader seeing a register block has its times */
+	if (capture_block(c, CAPTURE_TS_COLUMN, c->ts, c->count * 8) < 0) {
+		c->error = errno;
+	}
+	for (i = 0; (i < c->nregs) && !c->error; i++) {
+		if (capture_block(c, i, c->col[i], c->count * c->bytes[i]) < 0) {
+			c->error = errno;
+		}
+	}
+	c->first += c->count;
+	c->count = 0;
+}
+
+capture_t *
+capture_open(
+	const char     *path,
+	device_t       *dev,
+	struct sampler *s)
+{
+	capture_hdr_t hdr;
+	capture_col_t col;
+	struct timespec mono;
+	struct timespec real;
+	capture_t *c;
+	int i;
+
+	c = (capture_t *)calloc(1, sizeof(capture_t));
+	if (c == NULL) {
+		return NULL;
+	}
+	c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (c->fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+		free(c);
+		return NULL;
+	}
+	c->nregs = s->count;
+	c->ts = (uint64_t *)malloc(CAPTURE_BLOCK * sizeof(uint64_t));
+	for (i = 0; i < c->nregs; i++) {
+		c->bytes[i] = s->reg[i].width / 8;
+		c->col[i] = (unsigned char *)malloc(CAPTURE_BLOCK * c->bytes[i]);
+	}
+
+	/* Schema */
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CAPTURE_VERSION;
+	hdr.nregs = s->count;
+	hdr.block = CAPTURE_BLOCK;
+	hdr.period_us = s->period_us;
+	hdr.clock = CLOCK_MONOTONIC;
+	hdr.flags = (__BYTE_ORDER == __LITTLE_ENDIAN) ? CAPTURE_LE : 0;
+	hdr.start_ns = (uint64_t)mono.tv_sec * 1000000000ULL + mono.tv_nsec;
+	hdr.start_unix_ns = (uint64_t)real.tv_sec * 1000000000ULL + real.tv_nsec;
+	c->error = (write_all(c->fd, &hdr, sizeof(hdr)) < 0) ? errno : 0;
+	for (i = 0; (i < c->nregs) && !c->error; i++) {
+		memset(&col, 0, sizeof(col));
+		snprintf(col.name, sizeof(col.name), "%s", s->reg[i].name);
+		col.addr = s->reg[i].addr;
+		col.width = s->reg[i].width;
+		col.bar = sample_column_bar(&s->reg[i], dev->bar);
+		c->error = (write_all(c->fd, &col, sizeof(col)) < 0) ? errno : 0;
+	}
+	for (i = 0; i < c->nregs; i++) {
+		if ((c->ts == NULL) || (c->col[i] == NULL)) {
+			c->error = ENOMEM;
+		}
+	}
+	if (c->error) {
+		printf("Error: cannot write '%s': %s\n", path, strerror(c->error));
+		capture_close(c);
+		return NULL;
+	}
+	return c;
+}
+
+void
+capture_add(
+	capture_t      *c,
+	uint64_t        t_ns,
+	const uint64_t *values)
+{
+	unsigned char *p;
+	int i;
+
+	c->ts[c->count] = t_ns;
+	for (i = 0; i < c->nregs; i++) {
+		p = c->col[i] + c->count * c->bytes[i];
+		switch (c->bytes[i]) {
+			case 1:
+				*p = (uint8_t)values[i];
+				break;
+			case 2:
+				*(uint16_t *)p = (uint16_t)values[i];
+				break;
+			case 4:
+				*(uint32_t *)p = (uint32_t)values[i];
+				break;
+			default:
+				*(uint64_t *)p = values[i];
+				break;
+		}
+	}
+	if (++c->count == CAPTURE_BLOCK) {
+		capture_flush(c);
+	}
+}
+
+void
+capture_close(
+	capture_t *c)
+{
+	int i;
+
+	if (c == NULL) {
+		return;
+	}
+	capture_flush(c);
+	if (c->error) {
+		printf("Error: capture incomplete: %s\n", strerror(c->error));
+	}
+	close(c->fd);
+	free(c->ts);
+	for (i = 0; i < c->nregs; i++) {
+		free(c->col[i]);
+	}
+	free(c);
+}
+
+/* ----------------------------------------------------------------
+ * Reader
+ * ----------------------------------------------------------------
+ */
+typedef struct {
+	unsigned char *base;
+	size_t         size;
+	capture_hdr_t *hdr;
+	capture_col_t *col;
+	size_t         data;    /* offset of the first block */
+} capture_map_t;
+
+static int
+capture_map(
+	const char    *path,
+	capture_map_t *m)
+{
+	struct stat st;
+	unsigned int i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(capture_hdr_t))) {
+		printf("Error: '%s' is not a capture file\n", path);
+		close(fd);
+		return -1;
+	}
+	m->size = st.st_size;
+	m->base = (unsigned char *)mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m->base == (unsigned char *)MAP_FAILED) {
+		printf("Error: cannot map '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	m->hdr = (capture_hdr_t *)m->base;
+	m->col = (capture_col_t *)(m->base + sizeof(capture_hdr_t));
+	m->data = sizeof(capture_hdr_t) + m->hdr->nregs * sizeof(capture_col_t);
+	if ((memcmp(m->hdr->magic, CAPTURE_MAGIC, sizeof(m->hdr->magic)) != 0) ||
+	    (m->hdr->nregs > SAMPLE_MAX_REGS) || (m->data > m->size)) {
+		printf("Error: '%s' is not a capture file\n", path);
+		munmap(m->base, m->size);
+		return -1;
+	}
+	/* The block sizes follow from the column widths */
+	for (i = 0; i < m->hdr->nregs; i++) {
+		if ((m->col[i].width != 8) && (m->col[i].width != 16) &&
+		    (m->col[i].width != 32) && (m->col[i].width != 64)) {
+			printf("Error: '%s' is not a capture file\n", path);
+			munmap(m->base, m->size);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Next complete block at *off, NULL at the end (or a torn tail) */
+static capture_blk_t *
+capture_next(
+	capture_map_t *m,
+	size_t        *off,
+	size_t        *len)
+{
+	capture_blk_t *blk;
+	size_t bytes;
+
+	if (*off + sizeof(capture_blk_t) > m->size) {
+		return NULL;
+	}
+	blk = (capture_blk_t *)(m->base + *off);
+	if ((blk->magic != CAPTURE_BLK_MAGIC) ||
+	    ((blk->column != CAPTURE_TS_COLUMN) && (blk->column >= m->hdr->nregs))) {
+		return NULL;
+	}
+	bytes = (blk->column == CAPTURE_TS_COLUMN) ? 8 : m->col[blk->column].width / 8;
+	*len = blk->count * bytes;
+	if (*off + sizeof(capture_blk_t) + PAD8(*len) > m->size) {
+		return NULL;
+	}
+	*off += sizeof(capture_blk_t) + PAD8(*len);
+	return blk;
+}
+
+static uint64_t
+capture_value(
+	const unsigned char *p,
+	int                  width,
+	uint32_t             k)
+{
+	switch (width) {
+		case 8:
+			return p[k];
+		case 16:
+			return ((const uint16_t *)p)[k];
+		case 32:
+			return ((const uint32_t *)p)[k];
+		default:
+			return ((const uint64_t *)p)[k];
+	}
+}
+
+static void
+capture_info(
+	capture_map_t *m)
+{
+	capture_hdr_t *h = m->hdr;
+	unsigned long long sweeps = 0;
+	size_t off = m->data;
+	size_t len;
+	capture_blk_t *blk;
+	uint32_t i;
+
+	while ((blk = capture_next(m, &off, &len)) != NULL) {
+		if (blk->column == CAPTURE_TS_COLUMN) {
+			sweeps += blk->count;
+		}
+	}
+	printf("Capture v%u: %u registers, period %u us, %llu sweeps, %zu bytes\n",
+		h->version, h->nregs, h->period_us, sweeps, m->size);
+	printf("  started %.3f (unix s), clock %u, %u sweeps per block\n",
+		h->start_unix_ns / 1e9, h->clock, h->block);
+	for (i = 0; i < h->nregs; i++) {
+		if (m->col[i].bar == AER_COLUMN_BAR) {
+			printf("  %-16s AER error count per sweep\n", m->col[i].name);
+			continue;
+		}
+		if (m->col[i].bar == IRQ_COLUMN_BAR) {
+			printf("  %-16s interrupts per sweep\n", m->col[i].name);
+			continue;
+		}
+		printf("  %-16s BAR%u %.8X %2u-bit\n", m->col[i].name, m->col[i].bar,
+			m->col[i].addr, m->col[i].width);
+	}
+}
+
+/* Stats (and optionally t_ns,value CSV) for one register: only the block
+ * headers, that column and, for the CSV, the time stamps are touched
+ */
+static void
+capture_query(
+	capture_map_t *m,
+	const char    *name,
+	const char    *csv)
+{
+	unsigned long long n = 0;
+	unsigned long long bytes = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+	uint64_t v;
+	double sum = 0.0;
+	const uint64_t *ts = NULL;
+	capture_blk_t *blk;
+	capture_col_t *col;
+	size_t off = m->data;
+	size_t len;
+	FILE *fp = NULL;
+	uint32_t c;
+	uint32_t k;
+
+	for (c = 0; c < m->hdr->nregs; c++) {
+		if (strcmp(m->col[c].name, name) == 0) {
+			break;
+		}
+	}
+	if (c == m->hdr->nregs) {
+		printf("Error: no register '%s' in the capture\n", name);
+		return;
+	}
+	col = &m->col[c];
+	if (csv != NULL) {
+		fp = fopen(csv, "w");
+		if (fp == NULL) {
+			printf("Open failed for file '%s': errno %d, %s\n",
+				csv, errno, strerror(errno));
+			return;
+		}
+		fprintf(fp, "t_ns,%s\n", col->name);
+	}
+	while ((blk = capture_next(m, &off, &len)) != NULL) {
+		if ((blk->column == CAPTURE_TS_COLUMN) && (fp != NULL)) {
+			ts = (const uint64_t *)(blk + 1);
+			continue;
+		}
+		if (blk->column != c) {
+			continue;
+		}
+		bytes += len;
+		for (k = 0; k < blk->count; k++) {
+			v = capture_value((const unsigned char *)(blk + 1), col->width, k);
+			min = (v < min) ? v : min;
+			max = (v > max) ? v : max;
+			sum += v;
+			if (fp != NULL) {
+				fprintf(fp, "%llu,%.*llX\n", (unsigned long long)ts[k],
+					col->width / 4, (unsigned long long)v);
+			}
+		}
+		n += blk->count;
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	printf("%s (%.8X, %u-bit): %llu values, %llu column bytes read", col->name,
+		col->addr, col->width, n, bytes);
+	if (n > 0) {
+		printf(", min %.*llX max %.*llX mean %.2f",
+			col->width / 4, (unsigned long long)min,
+			col->width / 4, (unsigned long long)max, sum / n);
+	}
+	printf("\n");
+}
+
+int
+capture_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	capture_map_t m;
+	char word[16];
+	char path[100];
+	char name[32];
+	char csv[100];
+	int status;
+
+	/* capture info file, capture query file reg [csv] */
+	status = sscanf(cmd, "%*s %15s %99s %31s %99s", word, path, name, csv);
+	if ((status >= 2) && (strcmp(word, "info") == 0)) {
+		if (capture_map(path, &m) == 0) {
+			capture_info(&m);
+			munmap(m.base, m.size);
+		}
+	} else if ((status >= 3) && (strcmp(word, "query") == 0)) {
+		if (capture_map(path, &m) == 0) {
+			capture_query(&m, name, (status == 4) ? csv : NULL);
+			munmap(m.base, m.size);
+		}
+	} else {
+		printf("Syntax error: capture info file, capture query file reg [csv]\n");
+	}
+	return 0;
+}
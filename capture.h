@@ -0,0 +1,78 @@
+/* capture.h
+ *
+ * Columnar register capture files.
+ *
+ * "sample start period file" appends every sweep of the sampler to a
+ * self-describing capture:
+ *
+ *   capture_hdr_t                     magic, clock, block size
+ *   capture_col_t x nregs             schema: name, offset, width, BAR
+ *   { capture_blk_t + payload } ...   column blocks
+ *
+ * Samples are buffered per column and written as one block per column
+ * every CAPTURE_BLOCK sweeps (and at stop): first the time stamps
+ * (column CAPTURE_TS_COLUMN, 64-bit CLOCK_MONOTONIC ns), then each
+ * register (width/8 bytes per value, host byte order). Payloads are
+ * padded to 8 bytes. The file is only ever appended to, so a reader
+ * can use it while it grows, and reading one register touches only the
+ * block headers and that register's blocks.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#include "pci_debug.h"
+
+#define CAPTURE_MAGIC        "PCICAP01"
+#define CAPTURE_VERSION      1
+#define CAPTURE_BLK_MAGIC    0x4B4C4243  /* "CBLK" */
+#define CAPTURE_TS_COLUMN    0xFFFFFFFF
+
+/* Sweeps per block */
+#define CAPTURE_BLOCK        4096
+
+/* capture_hdr_t flags */
+#define CAPTURE_LE           0x1
+
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t nregs;
+	uint32_t block;          /* sweeps per full block */
+	uint32_t period_us;
+	uint32_t clock;          /* clockid_t of the time stamps */
+	uint32_t flags;
+	uint64_t start_ns;       /* that clock when the capture started */
+	uint64_t start_unix_ns;  /* CLOCK_REALTIME at the same moment */
+} capture_hdr_t;
+
+typedef struct {
+	char     name[32];
+	uint32_t addr;
+	uint32_t width;
+	uint32_t bar;
+	uint32_t reserved;
+} capture_col_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t column;         /* register index or CAPTURE_TS_COLUMN */
+	uint32_t count;          /* values in the block */
+	uint32_t reserved;
+	uint64_t first;          /* sweep number of the first value */
+} capture_blk_t;
+
+struct sampler;
+typedef struct capture capture_t;
+
+/* Writer, used from the sampler thread */
+capture_t *capture_open(const char *path, device_t *dev, struct sampler *s);
+void capture_add(capture_t *c, uint64_t t_ns, const uint64_t *values);
+void capture_close(capture_t *c);
+
+int capture_cmd(device_t *dev, char *cmd);
+
+#endif /* CAPTURE_H */
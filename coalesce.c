@@ -0,0 +1,114 @@
+/* coalesce.c
+ *
+ * Read coalescing ranges.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "coalesce.h"
+
+int
+coalesce_lookup(
+	device_t     *dev,
+	unsigned int  addr,
+	unsigned int  len,
+	strategy_t   *s)
+{
+	coalesce_range_t *r;
+	int i;
+
+	if ((dev->coalesce == NULL) || (len == 0)) {
+		return 0;
+	}
+	for (i = 0; i < dev->coalesce->count; i++) {
+		r = &dev->coalesce->range[i];
+		if ((addr >= r->addr) &&
+		    ((unsigned long long)addr + len <= (unsigned long long)r->addr + r->len)) {
+			/* One thread, no fences: just wider loads */
+			s->width = r->width;
+			s->map = MAP_UC;
+			s->threads = 1;
+			s->chunk = 65536;
+			s->fence = FENCE_END;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+coalesce_list(
+	device_t *dev)
+{
+	coalesce_range_t *r;
+	int i;
+
+	if ((dev->coalesce == NULL) || (dev->coalesce->count == 0)) {
+		printf("Read coalescing: off\n");
+		return;
+	}
+	for (i = 0; i < dev->coalesce->count; i++) {
+		r = &dev->coalesce->range[i];
+		printf("Read coalescing: %.8X-%.8X %d-bit reads\n",
+			r->addr, r->addr + r->len - 1, r->width);
+	}
+}
+
+int
+coalesce_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	unsigned int addr = 0;
+	unsigned int len = 0;
+	int width = 64;
+	char word[8];
+	int status;
+	coalesce_range_t *r;
+
+	/* coalesce, coalesce off, coalesce addr len [width] */
+	if (sscanf(cmd, "%*s %7s", word) != 1) {
+		coalesce_list(dev);
+		return 0;
+	}
+	if (strcmp(word, "off") == 0) {
+		if (dev->coalesce != NULL) {
+			dev->coalesce->count = 0;
+		}
+		coalesce_list(dev);
+		return 0;
+	}
+	status = sscanf(cmd, "%*s %x %x %d", &addr, &len, &width);
+	if (status < 2) {
+		printf("Syntax error (use ? for help)\n");
+		return 0;
+	}
+	if ((width != 32) && (width != 64) && (width != 128)) {
+		printf("Error: coalescing width must be 32, 64 or 128\n");
+		return 0;
+	}
+	if ((len == 0) || (addr >= dev->size) || (len > dev->size - addr)) {
+		printf("Error: invalid range (maximum allowed is %.8X)\n", dev->size);
+		return 0;
+	}
+	if (dev->coalesce == NULL) {
+		dev->coalesce = (struct coalesce *)calloc(1, sizeof(struct coalesce));
+		if (dev->coalesce == NULL) {
+			printf("Error: out of memory\n");
+			return 0;
+		}
+	}
+	if (dev->coalesce->count == COALESCE_MAX) {
+		printf("Error: at most %d coalescing ranges\n", COALESCE_MAX);
+		return 0;
+	}
+	r = &dev->coalesce->range[dev->coalesce->count++];
+	r->addr = addr;
+	r->len = len;
+	r->width = width;
+	coalesce_list(dev);
+	return 0;
+}
@@ -0,0 +1,39 @@
+/* coalesce.h
+ *
+ * Read coalescing for plain memory windows.
+ *
+ * d8/d16 normally issue one MMIO read per element, each a full
+ * non-posted round trip. Address ranges marked with "coalesce" are
+ * read with wide (64-bit by default, or 128-bit vector) loads and
+ * the bytes are split on the host, cutting the transaction count by
+ * 4-16x. Off by default: FIFOs and read-sensitive registers must
+ * never be read wider (or more often) than asked for.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include "pci_debug.h"
+#include "bulk.h"
+
+#define COALESCE_MAX  16
+
+typedef struct {
+	unsigned int addr;
+	unsigned int len;
+	int          width;
+} coalesce_range_t;
+
+struct coalesce {
+	int              count;
+	coalesce_range_t range[COALESCE_MAX];
+};
+
+/* Fills s and returns 1 when [addr, addr+len) lies in a marked range */
+int coalesce_lookup(device_t *dev, unsigned int addr, unsigned int len,
+	strategy_t *s);
+
+int coalesce_cmd(device_t *dev, char *cmd);
+
+#endif /* COALESCE_H */
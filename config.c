@@ -0,0 +1,117 @@
+/* config.c
+ *
+ * Configuration space access through sysfs.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+
+int
+config_dir(
+	device_t *dev,
+	char     *buf,
+	size_t    len)
+{
+	/* dev_open names sysfs resources, anything else is a stand-in */
+	if (strncmp(dev->filename, SYSFS_DEVICES, strlen(SYSFS_DEVICES)) != 0) {
+		return -1;
+	}
+	snprintf(buf, len, SYSFS_DEVICES "%04x:%02x:%02x.%1x",
+		dev->domain, dev->bus, dev->slot, dev->function);
+	return 0;
+}
+
+int
+config_open(
+	device_t *dev,
+	int       flags)
+{
+	char path[128];
+	int fd;
+
+	if (config_dir(dev, path, sizeof(path) - 8) < 0) {
+		printf("Error: %s has no configuration space (file stand-in)\n",
+			dev->filename);
+		return -1;
+	}
+	strcat(path, "/config");
+	fd = open(path, flags);
+	if (fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+	}
+	return fd;
+}
+
+int
+config_read(
+	device_t      *dev,
+	unsigned char *buf,
+	int            len)
+{
+	int fd;
+	int n;
+
+	fd = config_open(dev, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	n = pread(fd, buf, len, 0);
+	close(fd);
+	return n;
+}
+
+int
+config_find_cap(
+	const unsigned char *config,
+	int                  len,
+	int                  id)
+{
+	int ptr;
+	int hops;
+
+	if ((len < 0x40) || !(config[PCI_STATUS] & PCI_STATUS_CAP_LIST)) {
+		return 0;
+	}
+	ptr = config[PCI_CAPABILITY_LIST] & 0xFC;
+
+	/* At most 48 capabilities fit, a longer chain is a loop */
+	for (hops = 0; (ptr >= 0x40) && (ptr + 2 <= len) && (hops < 48); hops++) {
+		if (config[ptr] == id) {
+			return ptr;
+		}
+		ptr = config[ptr + 1] & 0xFC;
+	}
+	return 0;
+}
+
+int
+config_find_ext_cap(
+	const unsigned char *config,
+	int                  len,
+	int                  id)
+{
+	uint32_t header;
+	int ptr = PCI_EXT_CAP_START;
+	int hops;
+
+	/* 4 byte aligned headers in 0x100-0xFFF, at most 960 of them */
+	for (hops = 0; (ptr >= PCI_EXT_CAP_START) && (ptr + 4 <= len) && (hops < 960); hops++) {
+		memcpy(&header, config + ptr, 4);
+		if ((header == 0) || (header == 0xFFFFFFFF)) {
+			return 0;
+		}
+		if ((int)(header & 0xFFFF) == id) {
+			return ptr;
+		}
+		ptr = (header >> 20) & 0xFFC;
+	}
+	return 0;
+}
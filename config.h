@@ -0,0 +1,49 @@
+/* config.h
+ *
+ * Configuration space access through sysfs.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+#include "pci_debug.h"
+
+#define SYSFS_DEVICES         "/sys/bus/pci/devices/"
+
+/* Whole extended configuration space */
+#define CONFIG_SIZE           4096
+
+/* Capability list */
+#define PCI_STATUS            0x06
+#define PCI_STATUS_CAP_LIST   0x10
+#define PCI_CAPABILITY_LIST   0x34
+#define PCI_CAP_ID_MSI        0x05
+#define PCI_CAP_ID_EXP        0x10
+#define PCI_CAP_ID_MSIX       0x11
+
+/* Extended capability list, from 0x100 */
+#define PCI_EXT_CAP_START     0x100
+#define PCI_EXT_CAP_ID_ERR    0x0001
+#define PCI_EXT_CAP_ID_DSN    0x0003
+
+/* sysfs directory of the device, -1 for a file stand-in */
+int config_dir(device_t *dev, char *buf, size_t len);
+
+/* Opens the config node, -1 (and a message) when there is none */
+int config_open(device_t *dev, int flags);
+
+/* Reads up to len bytes from offset 0, returns the count read (256
+ * without privileges, 4096 with), -1 on error
+ */
+int config_read(device_t *dev, unsigned char *buf, int len);
+
+/* Offset of capability id in a config snapshot, 0 when absent */
+int config_find_cap(const unsigned char *config, int len, int id);
+
+/* Offset of extended capability id, 0 when absent (or len <= 256) */
+int config_find_ext_cap(const unsigned char *config, int len, int id);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,559 @@
+/* fleet.c
+ *
+ * Fleet-wide configuration space comparison and the fleet-cfg command.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "fleet.h"
+#include "config.h"
+#include "link.h"
+
+/* PCI Express capability registers compared beyond the link ones */
+#define PCI_EXP_DEVCTL   0x08
+#define PCI_EXP_DEVSTA   0x0A
+#define PCI_EXP_SLTSTA   0x1A
+#define PCI_EXP_RTSTA    0x20
+#define PCI_EXP_DEVCTL2  0x28
+#define PCI_EXP_LNKSTA2  0x32
+
+#define FLEET_BARS       7   /* BAR0-5 and the expansion ROM */
+
+typedef struct {
+	char           name[16];        /* dddd:bb:dd.f */
+	int            match;
+	int            len;             /* config bytes read */
+	unsigned char  config[CONFIG_SIZE];
+	unsigned char  masked[CONFIG_SIZE];
+	uint64_t       bar_size[FLEET_BARS];
+	uint64_t       hash;
+	int            group;
+} fleet_dev_t;
+
+typedef struct {
+	fleet_dev_t   *devs;
+	int            count;
+	unsigned int   vendor;
+	unsigned int   device;          /* 0xFFFF: any */
+	atomic_int     next;
+} fleet_t;
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Hex value of a small sysfs attribute, -1 on error */
+static long
+sysfs_hex(
+	const char *name,
+	const char *attr)
+{
+	char path[128];
+	char buf[32];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), SYSFS_DEVICES "%s/%s", name, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	n = pread(fd, buf, sizeof(buf) - 1, 0);
+	close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	buf[n] = '\0';
+	return strtol(buf, NULL, 16);
+}
+
+static void
+fleet_bar_sizes(
+	fleet_dev_t *f)
+{
+	unsigned long long start;
+	unsigned long long end;
+	unsigned long long flags;
+	char path[128];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), SYSFS_DEVICES "%s/resource", f->name);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return;
+	}
+	for (i = 0; i < FLEET_BARS; i++) {
+		if (fscanf(fp, "%llx %llx %llx", &start, &end, &flags) != 3) {
+			break;
+		}
+		f->bar_size[i] = (end > start) ? end - start + 1 : 0;
+	}
+	fclose(fp);
+}
+
+static void
+zero(
+	fleet_dev_t *f,
+	int          off,
+	int          len)
+{
+	if (off < f->len) {
+		memset(f->masked + off, 0, (off + len <= f->len) ? len : f->len - off);
+	}
+}
+
+/* Clears what differs between identical, identically set up cards */
+static void
+fleet_mask(
+	fleet_dev_t *f)
+{
+	unsigned char *m = f->masked;
+	uint32_t bar;
+	uint16_t ctrl;
+	int cap;
+	int i;
+
+	memcpy(m, f->config, f->len);
+	zero(f, PCI_STATUS, 2);
+	zero(f, 0x3C, 1);                        /* interrupt line */
+
+	if ((m[0x0E] & 0x7F) == 0) {
+		/* Keep the BAR type bits, not the addresses */
+		for (i = 0x10; i <= 0x24; i += 4) {
+			memcpy(&bar, m + i, 4);
+			if (bar & 0x1) {
+				bar &= 0x3;
+			} else {
+				if (((bar >> 1) & 0x3) == 0x2) {
+					zero(f, i + 4, 4);       /* upper half, skipped */
+					bar &= 0xF;
+					memcpy(m + i, &bar, 4);
+					i += 4;
+					continue;
+				}
+				bar &= 0xF;
+			}
+			memcpy(m + i, &bar, 4);
+		}
+		m[0x31] = m[0x32] = m[0x33] = 0;     /* ROM address */
+		m[0x30] &= 0x01;
+	} else {
+		/* Bridges: BARs, bus numbers and windows follow the topology */
+		zero(f, 0x10, 0x20);
+		zero(f, 0x38, 4);
+	}
+
+	/* Capabilities are looked up in the unmasked copy: the Status
+	 * register, capability list bit included, is already cleared in m
+	 */
+	cap = config_find_cap(f->config, f->len, PCI_CAP_ID_EXP);
+	if (cap != 0) {
+		zero(f, cap + PCI_EXP_DEVSTA, 2);
+		zero(f, cap + PCI_EXP_LNKSTA, 2);
+		zero(f, cap + PCI_EXP_SLTSTA, 2);
+		zero(f, cap + PCI_EXP_RTSTA, 4);
+		zero(f, cap + PCI_EXP_LNKSTA2, 2);
+	}
+	cap = config_find_cap(f->config, f->len, PCI_CAP_ID_MSI);
+	if (cap != 0) {
+		/* Message address and data, mask and pending bits */
+		memcpy(&ctrl, f->config + cap + 2, 2);
+		zero(f, cap + 4, ((ctrl & 0x80) ? 0x0A : 0x06) + ((ctrl & 0x100) ? 0x0A : 0));
+	}
+	cap = config_find_ext_cap(f->config, f->len, PCI_EXT_CAP_ID_ERR);
+	if (cap != 0) {
+		zero(f, cap + 0x04, 4);                  /* uncorrectable status */
+		zero(f, cap + 0x10, 4);                  /* correctable status */
+		zero(f, cap + 0x1C, 16);                 /* header log */
+	}
+	cap = config_find_ext_cap(f->config, f->len, PCI_EXT_CAP_ID_DSN);
+	if (cap != 0) {
+		zero(f, cap + 4, 8);
+	}
+}
+
+/* FNV-1a of the masked image, its length and the BAR sizes */
+static uint64_t
+fleet_hash(
+	const fleet_dev_t *f)
+{
+	const unsigned char *p;
+	uint64_t h = 0xCBF29CE484222325ULL;
+	size_t i;
+
+	for (i = 0; i < (size_t)f->len; i++) {
+		h = (h ^ f->masked[i]) * 0x100000001B3ULL;
+	}
+	p = (const unsigned char *)f->bar_size;
+	for (i = 0; i < sizeof(f->bar_size); i++) {
+		h = (h ^ p[i]) * 0x100000001B3ULL;
+	}
+	return (h ^ (uint64_t)f->len) * 0x100000001B3ULL;
+}
+
+static void
+fleet_snapshot(
+	fleet_t     *fl,
+	fleet_dev_t *f)
+{
+	char path[128];
+	long vendor;
+	long device;
+	int fd;
+
+	/* The ID attributes are cached, reading them never wakes a device */
+	vendor = sysfs_hex(f->name, "vendor");
+	device = sysfs_hex(f->name, "device");
+	if ((vendor != (long)fl->vendor) ||
+	    ((fl->device != 0xFFFF) && (device != (long)fl->device))) {
+		return;
+	}
+	snprintf(path, sizeof(path), SYSFS_DEVICES "%s/config", f->name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	f->len = pread(fd, f->config, CONFIG_SIZE, 0);
+	close(fd);
+	if (f->len < 0x40) {
+		return;
+	}
+	fleet_bar_sizes(f);
+	fleet_mask(f);
+	f->hash = fleet_hash(f);
+	f->match = 1;
+}
+
+static void *
+fleet_thread(
+	void *arg)
+{
+	fleet_t *fl = (fleet_t *)arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&fl->next, 1)) < fl->count) {
+		fleet_snapshot(fl, &fl->devs[i]);
+	}
+	return NULL;
+}
+
+static int
+name_cmp(
+	const void *a,
+	const void *b)
+{
+	return strcmp(((const fleet_dev_t *)a)->name, ((const fleet_dev_t *)b)->name);
+}
+
+/* Functions listed in sysfs in slot order, NULL when none */
+static fleet_dev_t *
+fleet_list(
+	int *count)
+{
+	struct dirent *e;
+	fleet_dev_t *devs = NULL;
+	fleet_dev_t *p;
+	int n = 0;
+	DIR *dir;
+
+	dir = opendir(SYSFS_DEVICES);
+	if (dir == NULL) {
+		printf("Open failed for directory '%s': errno %d, %s\n",
+			SYSFS_DEVICES, errno, strerror(errno));
+		return NULL;
+	}
+	while ((e = readdir(dir)) != NULL) {
+		if (e->d_name[0] == '.') {
+			continue;
+		}
+		p = (fleet_dev_t *)realloc(devs, (n + 1) * sizeof(fleet_dev_t));
+		if (p == NULL) {
+			break;
+		}
+		devs = p;
+		memset(&devs[n], 0, sizeof(fleet_dev_t));
+		snprintf(devs[n].name, sizeof(devs[n].name), "%.15s", e->d_name);
+		n++;
+	}
+	closedir(dir);
+	if (devs != NULL) {
+		qsort(devs, n, sizeof(fleet_dev_t), name_cmp);
+	}
+	*count = n;
+	return devs;
+}
+
+static const char *aspm_names[] = { "off", "L0s", "L1", "L0s+L1" };
+
+static void
+devctl_str(
+	uint16_t  v,
+	char     *buf,
+	size_t    len)
+{
+	snprintf(buf, len, "MPS %d MRRS %d RO %d ExtTag %d NoSnoop %d",
+		128 << ((v >> 5) & 0x7), 128 << ((v >> 12) & 0x7),
+		(v >> 4) & 1, (v >> 8) & 1, (v >> 11) & 1);
+}
+
+/* Name of the register holding config offset off */
+static void
+field_name(
+	const fleet_dev_t *f,
+	int                off,
+	char              *buf,
+	size_t             len)
+{
+	static const char *hdr[16] = {
+		"ID", "Command/Status", "Class/Revision", "Header type/Latency",
+		"BAR0", "BAR1", "BAR2", "BAR3", "BAR4", "BAR5", "Cardbus CIS",
+		"Subsystem ID", "Expansion ROM", "Capability pointer", "Reserved",
+		"Interrupt"
+	};
+	int best = 0;
+	int ptr;
+	int hops;
+	uint32_t h;
+
+	if (off < 0x40) {
+		snprintf(buf, len, "%s", hdr[off / 4]);
+		return;
+	}
+	if (off < PCI_EXT_CAP_START) {
+		/* Closest capability starting at or below off */
+		ptr = f->config[PCI_CAPABILITY_LIST] & 0xFC;
+		for (hops = 0; (ptr >= 0x40) && (hops < 48); hops++) {
+			if ((ptr <= off) && (ptr > best)) {
+				best = ptr;
+			}
+			ptr = f->config[ptr + 1] & 0xFC;
+		}
+		if (best != 0) {
+			snprintf(buf, len, "cap %02X @%02X+%02X", f->config[best], best, off - best);
+		} else {
+			snprintf(buf, len, "device specific");
+		}
+		return;
+	}
+	ptr = PCI_EXT_CAP_START;
+	for (hops = 0; (ptr >= PCI_EXT_CAP_START) && (ptr + 4 <= f->len) && (hops < 960); hops++) {
+		memcpy(&h, f->config + ptr, 4);
+		if ((h == 0) || (h == 0xFFFFFFFF)) {
+			break;
+		}
+		if ((ptr <= off) && (ptr > best)) {
+			best = ptr;
+		}
+		ptr = (h >> 20) & 0xFFC;
+	}
+	if (best != 0) {
+		memcpy(&h, f->config + best, 4);
+		snprintf(buf, len, "ext cap %04X @%03X+%03X", h & 0xFFFF, best, off - best);
+	} else {
+		snprintf(buf, len, "device specific");
+	}
+}
+
+/* Prints how f differs from the reference ref */
+static void
+fleet_diff(
+	const fleet_dev_t *ref,
+	const fleet_dev_t *f)
+{
+	char a[80];
+	char b[80];
+	uint32_t va;
+	uint32_t vb;
+	uint16_t ca;
+	uint16_t cb;
+	int exp;
+	int len = (f->len < ref->len) ? f->len : ref->len;
+	int off;
+	int i;
+
+	if (f->len != ref->len) {
+		printf("    config space read: %d vs %d bytes\n", f->len, ref->len);
+	}
+	for (i = 0; i < FLEET_BARS; i++) {
+		if (f->bar_size[i] != ref->bar_size[i]) {
+			if (i < 6) {
+				printf("    BAR%d", i);
+			} else {
+				printf("    ROM");
+			}
+			printf(" size: %llX vs %llX\n", (unsigned long long)f->bar_size[i],
+				(unsigned long long)ref->bar_size[i]);
+		}
+	}
+
+	exp = config_find_cap(f->config, f->len, PCI_CAP_ID_EXP);
+	for (off = 0; off + 4 <= len; off += 4) {
+		memcpy(&va, f->masked + off, 4);
+		memcpy(&vb, ref->masked + off, 4);
+		if (va == vb) {
+			continue;
+		}
+		field_name(f, off, a, sizeof(a));
+		printf("    %03X: %08X vs %08X  %s\n", off, va, vb, a);
+
+		/* The settings that usually explain a slow card */
+		if ((exp != 0) && (off == exp + PCI_EXP_DEVCTL)) {
+			memcpy(&ca, f->config + off, 2);
+			memcpy(&cb, ref->config + off, 2);
+			devctl_str(ca, a, sizeof(a));
+			devctl_str(cb, b, sizeof(b));
+			printf("         DevCtl: %s vs %s\n", a, b);
+		} else if ((exp != 0) && (off == exp + PCI_EXP_LNKCTL)) {
+			printf("         LnkCtl: ASPM %s vs %s\n",
+				aspm_names[f->config[off] & 0x3], aspm_names[ref->config[off] & 0x3]);
+		} else if ((exp != 0) && (off == exp + PCI_EXP_DEVCTL2)) {
+			memcpy(&ca, f->config + off, 2);
+			memcpy(&cb, ref->config + off, 2);
+			printf("         DevCtl2: completion timeout %X%s vs %X%s\n",
+				ca & 0xF, (ca & 0x10) ? " (disabled)" : "",
+				cb & 0xF, (cb & 0x10) ? " (disabled)" : "");
+		}
+	}
+}
+
+static void
+fleet_report(
+	fleet_dev_t *devs,
+	int          count,
+	double       ms)
+{
+	int sizes[256];
+	int rep[256];
+	int groups = 0;
+	int major = 0;
+	int matched = 0;
+	int shortest = CONFIG_SIZE;
+	int g;
+	int i;
+	int j;
+
+	/* Group identical images, first seen is the representative */
+	for (i = 0; i < count; i++) {
+		if (!devs[i].match) {
+			continue;
+		}
+		matched++;
+		shortest = (devs[i].len < shortest) ? devs[i].len : shortest;
+		for (g = 0; g < groups; g++) {
+			j = rep[g];
+			if ((devs[j].hash == devs[i].hash) && (devs[j].len == devs[i].len) &&
+			    (memcmp(devs[j].masked, devs[i].masked, devs[i].len) == 0) &&
+			    (memcmp(devs[j].bar_size, devs[i].bar_size, sizeof(devs[i].bar_size)) == 0)) {
+				break;
+			}
+		}
+		if (g == groups) {
+			if (groups == 256) {
+				continue;
+			}
+			rep[groups] = i;
+			sizes[groups++] = 0;
+		}
+		devs[i].group = g;
+		sizes[g]++;
+	}
+	if (matched == 0) {
+		printf("fleet-cfg: no matching device (%.2f ms)\n", ms);
+		return;
+	}
+	for (g = 1; g < groups; g++) {
+		if (sizes[g] > sizes[major]) {
+			major = g;
+		}
+	}
+
+	printf("fleet-cfg: %d device(s) in %.2f ms, %d configuration(s)\n",
+		matched, ms, groups);
+	if (shortest < CONFIG_SIZE) {
+		printf("  (only %d bytes of config space readable: not root, or no\n"
+			"   extended config access)\n", shortest);
+	}
+	for (g = 0; g < groups; g++) {
+		printf("  [%c] %d device(s)%s:", 'A' + g % 26, sizes[g],
+			(g == major) ? ", majority" : "");
+		for (i = 0; i < count; i++) {
+			if (devs[i].match && (devs[i].group == g)) {
+				printf(" %s", devs[i].name);
+			}
+		}
+		printf("\n");
+	}
+	for (g = 0; g < groups; g++) {
+		if (g == major) {
+			continue;
+		}
+		printf("  [%c] %s vs [%c] %s:\n", 'A' + g % 26, devs[rep[g]].name,
+			'A' + major % 26, devs[rep[major]].name);
+		fleet_diff(&devs[rep[major]], &devs[rep[g]]);
+	}
+}
+
+int
+fleet_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	pthread_t threads[FLEET_THREADS];
+	unsigned int vendor;
+	unsigned int device;
+	int started;
+	int status;
+	double t0;
+	fleet_t fl;
+	int i;
+
+	/* fleet-cfg [vendor[:device]], default: the IDs of this device */
+	memset(&fl, 0, sizeof(fl));
+	fl.vendor = dev->vendor;
+	fl.device = dev->device;
+	status = sscanf(cmd, "%*s %x:%x", &vendor, &device);
+	if (status >= 1) {
+		fl.vendor = vendor;
+		fl.device = (status == 2) ? device : 0xFFFF;
+	} else if (fl.vendor == 0) {
+		printf("Syntax error: fleet-cfg vendor[:device] (no IDs for a stand-in)\n");
+		return 0;
+	}
+
+	t0 = now_ms();
+	fl.devs = fleet_list(&fl.count);
+	if (fl.devs == NULL) {
+		return 0;
+	}
+	atomic_init(&fl.next, 0);
+	for (started = 0; (started < FLEET_THREADS) && (started < fl.count); started++) {
+		if (pthread_create(&threads[started], NULL, fleet_thread, &fl) != 0) {
+			break;
+		}
+	}
+	/* Whatever the threads did not get to, done here */
+	fleet_thread(&fl);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	fleet_report(fl.devs, fl.count, now_ms() - t0);
+	free(fl.devs);
+	return 0;
+}
@@ -0,0 +1,25 @@
+/* fleet.h
+ *
+ * Fleet-wide configuration space comparison.
+ *
+ * "fleet-cfg" snapshots the configuration space of every function with
+ * the same vendor:device as this one (or the IDs given) concurrently,
+ * masks the fields that legitimately differ between identical cards
+ * (BAR addresses, status and error bits, MSI addresses, serial
+ * numbers), groups the images by hash and diffs each minority group
+ * against the majority, decoding the fields that usually matter (MPS,
+ * MRRS, relaxed ordering, ASPM, BAR sizes).
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "pci_debug.h"
+
+/* Snapshot threads */
+#define FLEET_THREADS  16
+
+int fleet_cmd(device_t *dev, char *cmd);
+
+#endif /* FLEET_H */
@@ -0,0 +1,207 @@
+/* hist.c
+ *
+ * Online value histograms.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "hist.h"
+
+/* Percentiles printed by hist_dump */
+static const double hist_pct[] = { 50.0, 90.0, 99.0, 99.9 };
+
+static unsigned int
+hist_index(
+	hist_t  *h,
+	uint64_t v)
+{
+	int e;
+
+	if (h->exact || (v < 2 * HIST_SUB_BUCKETS)) {
+		return (unsigned int)v;
+	}
+	/* Keep the HIST_SUB_BITS leading bits: mantissa in [H, 2H) */
+	e = (63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+	return e * HIST_SUB_BUCKETS + (unsigned int)(v >> e);
+}
+
+/* Smallest and largest value falling in bucket i */
+static void
+hist_bounds(
+	hist_t       *h,
+	unsigned int  i,
+	uint64_t     *lo,
+	uint64_t     *hi)
+{
+	unsigned int e;
+	uint64_t m;
+
+	if (h->exact || (i < 2 * HIST_SUB_BUCKETS)) {
+		*lo = *hi = i;
+		return;
+	}
+	e = i / HIST_SUB_BUCKETS - 1;
+	m = i - e * HIST_SUB_BUCKETS;
+	*lo = m << e;
+	*hi = *lo + (((uint64_t)1 << e) - 1);
+}
+
+hist_t *
+hist_create(
+	int width)
+{
+	unsigned int n;
+	hist_t *h;
+
+	if ((width == 8) || (width == 16)) {
+		n = 1u << width;
+	} else {
+		n = (width - HIST_SUB_BITS + 2) * HIST_SUB_BUCKETS;
+	}
+	h = (hist_t *)calloc(1, sizeof(hist_t) + n * sizeof(atomic_ullong));
+	if (h == NULL) {
+		return NULL;
+	}
+	h->width = width;
+	h->exact = (width <= 16);
+	h->nbuckets = n;
+	atomic_store(&h->min, UINT64_MAX);
+	return h;
+}
+
+void
+hist_destroy(
+	hist_t *h)
+{
+	free(h);
+}
+
+void
+hist_reset(
+	hist_t *h)
+{
+	atomic_store(&h->reset, 1);
+}
+
+void
+hist_clear(
+	hist_t *h)
+{
+	unsigned int i;
+
+	for (i = 0; i < h->nbuckets; i++) {
+		atomic_store_explicit(&h->bucket[i], 0, memory_order_relaxed);
+	}
+	atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->sum, 0.0, memory_order_relaxed);
+	atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->min, UINT64_MAX, memory_order_relaxed);
+}
+
+void
+hist_add(
+	hist_t  *h,
+	uint64_t v)
+{
+	atomic_ullong *b;
+
+	if (atomic_load_explicit(&h->reset, memory_order_relaxed)) {
+		hist_clear(h);
+		atomic_store(&h->reset, 0);
+	}
+	/* Single writer: plain load/store, no locked read-modify-write */
+	b = &h->bucket[hist_index(h, v)];
+	atomic_store_explicit(b,
+		atomic_load_explicit(b, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+	if (v < atomic_load_explicit(&h->min, memory_order_relaxed)) {
+		atomic_store_explicit(&h->min, v, memory_order_relaxed);
+	}
+	if (v > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+		atomic_store_explicit(&h->max, v, memory_order_relaxed);
+	}
+	atomic_store_explicit(&h->sum,
+		atomic_load_explicit(&h->sum, memory_order_relaxed) + (double)v,
+		memory_order_relaxed);
+	atomic_store_explicit(&h->count,
+		atomic_load_explicit(&h->count, memory_order_relaxed) + 1,
+		memory_order_relaxed);
+}
+
+void
+hist_dump(
+	hist_t       *h,
+	const char   *name,
+	unsigned int  addr,
+	FILE         *fp)
+{
+	unsigned long long *counts;
+	unsigned long long total = 0;
+	unsigned long long seen;
+	unsigned long long target;
+	unsigned int i;
+	unsigned int p;
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t max;
+	int digits = h->width / 4;
+
+	/* Snapshot first, the sampler keeps adding meanwhile */
+	counts = (unsigned long long *)malloc(h->nbuckets * sizeof(*counts));
+	if (counts == NULL) {
+		return;
+	}
+	for (i = 0; i < h->nbuckets; i++) {
+		counts[i] = atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+		total += counts[i];
+	}
+	max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+	fprintf(fp, "%s (%.8X, %d-bit, %s): %llu samples", name, addr, h->width,
+		h->exact ? "exact" : "log", total);
+	if (total == 0) {
+		fprintf(fp, "\n");
+		free(counts);
+		return;
+	}
+	fprintf(fp, ", min %.*llX max %.*llX mean %.2f\n",
+		digits, (unsigned long long)atomic_load_explicit(&h->min, memory_order_relaxed),
+		digits, (unsigned long long)max,
+		atomic_load_explicit(&h->sum, memory_order_relaxed) /
+		atomic_load_explicit(&h->count, memory_order_relaxed));
+
+	/* Percentiles, as the upper bound of the bucket reaching them */
+	fprintf(fp, " ");
+	for (p = 0, i = 0, seen = 0; p < sizeof(hist_pct) / sizeof(hist_pct[0]); p++) {
+		target = (unsigned long long)(hist_pct[p] / 100.0 * total + 0.5);
+		if (target == 0) {
+			target = 1;
+		}
+		while ((i < h->nbuckets) && (seen + counts[i] < target)) {
+			seen += counts[i++];
+		}
+		hist_bounds(h, (i < h->nbuckets) ? i : h->nbuckets - 1, &lo, &hi);
+		fprintf(fp, " p%g %s%.*llX", hist_pct[p], h->exact ? "" : "<=",
+			digits, (unsigned long long)((hi > max) ? max : hi));
+	}
+	fprintf(fp, "\n");
+
+	for (i = 0; i < h->nbuckets; i++) {
+		if (counts[i] == 0) {
+			continue;
+		}
+		hist_bounds(h, i, &lo, &hi);
+		if (lo == hi) {
+			fprintf(fp, "  %.*llX%*s", digits, (unsigned long long)lo,
+				h->exact ? 0 : digits + 1, "");
+		} else {
+			fprintf(fp, "  %.*llX-%.*llX", digits, (unsigned long long)lo,
+				digits, (unsigned long long)hi);
+		}
+		fprintf(fp, " %12llu %6.2f%%\n", counts[i], 100.0 * counts[i] / total);
+	}
+	free(counts);
+}
@@ -0,0 +1,52 @@
+/* hist.h
+ *
+ * Online value histograms.
+ *
+ * Fixed size per register whatever the run length: 8 and 16-bit
+ * registers get one exact bucket per value, 32 and 64-bit registers
+ * HDR-style log buckets (each power of two split in HIST_SUB_BUCKETS
+ * linear steps, so a bucket is at most ~6% wide and a value is known
+ * to within ~3% of its bucket midpoint, values below 2*HIST_SUB_BUCKETS
+ * exactly). One thread adds samples while any other may dump the
+ * histogram.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HIST_SUB_BITS     5
+#define HIST_SUB_BUCKETS  (1 << (HIST_SUB_BITS - 1))
+
+typedef struct {
+	int           width;
+	int           exact;
+	unsigned int  nbuckets;
+
+	atomic_ullong count;
+	atomic_ullong min;
+	atomic_ullong max;
+	_Atomic double sum;
+
+	/* Set by hist_reset, honoured by the writer on its next add */
+	atomic_int    reset;
+
+	atomic_ullong bucket[];
+} hist_t;
+
+hist_t *hist_create(int width);
+void hist_destroy(hist_t *h);
+
+/* Writer side, a single thread (or any thread while nobody adds) */
+void hist_add(hist_t *h, uint64_t value);
+void hist_clear(hist_t *h);
+
+/* Any thread, takes effect on the writer's next add */
+void hist_reset(hist_t *h);
+void hist_dump(hist_t *h, const char *name, unsigned int addr, FILE *fp);
+
+#endif /* HIST_H */
@@ -0,0 +1,688 @@
+/* irq.c
+ *
+ * Interrupt sources (UIO, VFIO, mock eventfd) and the waitirq and
+ * "on irq" commands.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/vfio.h>
+
+#include "irq.h"
+#include "cancel.h"
+
+#define IRQ_UIO   0
+#define IRQ_VFIO  1
+#define IRQ_MOCK  2
+
+/* poll() slice, bounds the Ctrl-C reaction time */
+#define IRQ_POLL_MS  100
+
+/* Most commands in an "on irq" handler */
+#define IRQ_MAX_HANDLER  64
+
+static const char *irq_names[] = { "uio", "vfio", "mock" };
+
+struct irq {
+	int                type;
+
+	/* Descriptor to sleep on: /dev/uioN or an eventfd */
+	int                fd;
+
+	/* UIO: total count at the previous wait (at open for the first) */
+	uint32_t           uio_count;
+
+	/* VFIO */
+	int                container;
+	int                group;
+	int                device;
+	unsigned int       index;
+
+	/* Mock timer thread */
+	int                period_ms;
+	pthread_t          thread;
+	atomic_int         stop;
+	atomic_ullong      fired_ns;
+};
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+sysfs_dir(
+	device_t *dev,
+	char     *buf,
+	size_t    len)
+{
+	snprintf(buf, len, "/sys/bus/pci/devices/%04x:%02x:%02x.%1x",
+		dev->domain, dev->bus, dev->slot, dev->function);
+}
+
+/* Basename of a sysfs link under the device directory */
+static int
+sysfs_link(
+	device_t   *dev,
+	const char *name,
+	char       *buf,
+	size_t      len)
+{
+	char path[256];
+	char target[256];
+	char *base;
+	ssize_t n;
+
+	sysfs_dir(dev, path, sizeof(path));
+	strncat(path, "/", sizeof(path) - strlen(path) - 1);
+	strncat(path, name, sizeof(path) - strlen(path) - 1);
+	n = readlink(path, target, sizeof(target) - 1);
+	if (n < 0) {
+		return -1;
+	}
+	target[n] = '\0';
+	base = strrchr(target, '/');
+	base = (base != NULL) ? base + 1 : target;
+	n = strlen(base);
+	if ((size_t)n >= len) {
+		n = len - 1;
+	}
+	memcpy(buf, base, n);
+	buf[n] = '\0';
+	return 0;
+}
+
+/* ----------------------------------------------------------------
+ * UIO
+ * ----------------------------------------------------------------
+ */
+static int
+uio_enable(
+	struct irq *irq)
+{
+	int32_t on = 1;
+
+	/* uio_pci_generic masks INTx after each interrupt */
+	return (write(irq->fd, &on, sizeof(on)) == sizeof(on)) ? 0 : -1;
+}
+
+static int
+uio_open(
+	device_t   *dev,
+	struct irq *irq)
+{
+	char path[300];
+	struct dirent *de;
+	DIR *dir;
+	FILE *fp;
+	unsigned int total;
+	int n = -1;
+
+	sysfs_dir(dev, path, sizeof(path));
+	strncat(path, "/uio", sizeof(path) - strlen(path) - 1);
+	dir = opendir(path);
+	if (dir == NULL) {
+		printf("Error: no UIO node for the device (bind it to uio_pci_generic)\n");
+		return -1;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (sscanf(de->d_name, "uio%d", &n) == 1) {
+			break;
+		}
+	}
+	closedir(dir);
+	if (n < 0) {
+		printf("Error: no UIO node for the device\n");
+		return -1;
+	}
+	/* read() returns the running total since the driver was bound:
+	 * start counting from the current one
+	 */
+	snprintf(path, sizeof(path), "/sys/class/uio/uio%d/event", n);
+	fp = fopen(path, "r");
+	if ((fp != NULL) && (fscanf(fp, "%u", &total) == 1)) {
+		irq->uio_count = total;
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	snprintf(path, sizeof(path), "/dev/uio%d", n);
+	irq->fd = open(path, O_RDWR);
+	if (irq->fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+		return -1;
+	}
+	if (uio_enable(irq) < 0) {
+		printf("Error: cannot enable interrupts on '%s'\n", path);
+		close(irq->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/* ----------------------------------------------------------------
+ * VFIO
+ * ----------------------------------------------------------------
+ */
+static int
+vfio_set_irqs(
+	struct irq *irq,
+	uint32_t    flags,
+	uint32_t    count,
+	int         efd)
+{
+	char buf[sizeof(struct vfio_irq_set) + sizeof(int32_t)];
+	struct vfio_irq_set *set = (struct vfio_irq_set *)buf;
+
+	memset(buf, 0, sizeof(buf));
+	set->argsz = sizeof(struct vfio_irq_set);
+	set->flags = flags;
+	set->index = irq->index;
+	set->start = 0;
+	set->count = count;
+	if (flags & VFIO_IRQ_SET_DATA_EVENTFD) {
+		set->argsz += sizeof(int32_t);
+		memcpy(set->data, &efd, sizeof(int32_t));
+	}
+	return ioctl(irq->device, VFIO_DEVICE_SET_IRQS, set);
+}
+
+static int
+vfio_open(
+	device_t   *dev,
+	struct irq *irq)
+{
+	static const unsigned int indexes[] = {
+		VFIO_PCI_MSI_IRQ_INDEX, VFIO_PCI_INTX_IRQ_INDEX
+	};
+	struct vfio_group_status status;
+	struct vfio_irq_info info;
+	char group[32];
+	char name[32];
+	char path[64];
+	unsigned int i;
+
+	irq->container = -1;
+	irq->group = -1;
+	irq->device = -1;
+	irq->fd = -1;
+
+	if (sysfs_link(dev, "iommu_group", group, sizeof(group)) < 0) {
+		printf("Error: the device has no IOMMU group\n");
+		return -1;
+	}
+	irq->container = open("/dev/vfio/vfio", O_RDWR);
+	if ((irq->container < 0) ||
+	    (ioctl(irq->container, VFIO_GET_API_VERSION) != VFIO_API_VERSION) ||
+	    !ioctl(irq->container, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU)) {
+		printf("Error: VFIO type1 container not available\n");
+		goto fail;
+	}
+	snprintf(path, sizeof(path), "/dev/vfio/%s", group);
+	irq->group = open(path, O_RDWR);
+	if (irq->group < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+		goto fail;
+	}
+	memset(&status, 0, sizeof(status));
+	status.argsz = sizeof(status);
+	if ((ioctl(irq->group, VFIO_GROUP_GET_STATUS, &status) < 0) ||
+	    !(status.flags & VFIO_GROUP_FLAGS_VIABLE)) {
+		printf("Error: IOMMU group %s is not viable (bind all its devices to vfio-pci)\n", group);
+		goto fail;
+	}
+	if ((ioctl(irq->group, VFIO_GROUP_SET_CONTAINER, &irq->container) < 0) ||
+	    (ioctl(irq->container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU) < 0)) {
+		printf("Error: cannot attach IOMMU group %s: %s\n", group, strerror(errno));
+		goto fail;
+	}
+	snprintf(name, sizeof(name), "%04x:%02x:%02x.%1x",
+		dev->domain, dev->bus, dev->slot, dev->function);
+	irq->device = ioctl(irq->group, VFIO_GROUP_GET_DEVICE_FD, name);
+	if (irq->device < 0) {
+		printf("Error: cannot get VFIO device %s: %s\n", name, strerror(errno));
+		goto fail;
+	}
+
+	/* Prefer MSI, fall back to INTx */
+	for (i = 0; i < sizeof(indexes) / sizeof(indexes[0]); i++) {
+		memset(&info, 0, sizeof(info));
+		info.argsz = sizeof(info);
+		info.index = indexes[i];
+		if ((ioctl(irq->device, VFIO_DEVICE_GET_IRQ_INFO, &info) == 0) &&
+		    (info.count > 0) && (info.flags & VFIO_IRQ_INFO_EVENTFD)) {
+			break;
+		}
+	}
+	if (i == sizeof(indexes) / sizeof(indexes[0])) {
+		printf("Error: the device has no MSI or INTx interrupt\n");
+		goto fail;
+	}
+	irq->index = indexes[i];
+	irq->fd = eventfd(0, EFD_CLOEXEC);
+	if ((irq->fd < 0) ||
+	    (vfio_set_irqs(irq, VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER,
+	                   1, irq->fd) < 0)) {
+		printf("Error: cannot route the interrupt to an eventfd: %s\n", strerror(errno));
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if (irq->fd >= 0) {
+		close(irq->fd);
+	}
+	if (irq->device >= 0) {
+		close(irq->device);
+	}
+	if (irq->group >= 0) {
+		close(irq->group);
+	}
+	if (irq->container >= 0) {
+		close(irq->container);
+	}
+	return -1;
+}
+
+static void
+vfio_close(
+	struct irq *irq)
+{
+	vfio_set_irqs(irq, VFIO_IRQ_SET_DATA_NONE | VFIO_IRQ_SET_ACTION_TRIGGER, 0, -1);
+	close(irq->fd);
+	close(irq->device);
+	close(irq->group);
+	close(irq->container);
+}
+
+/* ----------------------------------------------------------------
+ * Mock
+ * ----------------------------------------------------------------
+ */
+static void *
+mock_thread(
+	void *arg)
+{
+	struct irq *irq = (struct irq *)arg;
+	struct timespec period;
+	uint64_t one = 1;
+
+	period.tv_sec = irq->period_ms / 1000;
+	period.tv_nsec = (irq->period_ms % 1000) * 1000000L;
+	while (!atomic_load(&irq->stop)) {
+		nanosleep(&period, NULL);
+		atomic_store(&irq->fired_ns, now_ns());
+		if (write(irq->fd, &one, sizeof(one)) != sizeof(one)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int
+mock_open(
+	struct irq *irq,
+	const char *spec)
+{
+	irq->period_ms = IRQ_MOCK_PERIOD_MS;
+	if ((spec[4] == ':') && (atoi(spec + 5) > 0)) {
+		irq->period_ms = atoi(spec + 5);
+	}
+	irq->fd = eventfd(0, EFD_CLOEXEC);
+	if (irq->fd < 0) {
+		printf("Error: eventfd() failed: %s\n", strerror(errno));
+		return -1;
+	}
+	atomic_init(&irq->stop, 0);
+	atomic_init(&irq->fired_ns, 0);
+	if (pthread_create(&irq->thread, NULL, mock_thread, irq) != 0) {
+		printf("Error: cannot start the mock interrupt thread\n");
+		close(irq->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/* ----------------------------------------------------------------
+ * Source independent part
+ * ----------------------------------------------------------------
+ */
+int
+irq_open(
+	device_t *dev)
+{
+	const char *spec = dev->irq_spec;
+	struct irq *irq;
+	char driver[64];
+	int status;
+
+	if (dev->irq != NULL) {
+		return 0;
+	}
+	irq = (struct irq *)calloc(1, sizeof(struct irq));
+	if (irq == NULL) {
+		return -1;
+	}
+
+	/* Default: UIO. Opening the VFIO device resets the function, so
+	 * vfio-pci is only used when asked for with -i vfio
+	 */
+	if ((spec == NULL) || (strcmp(spec, "auto") == 0)) {
+		spec = "uio";
+		if ((sysfs_link(dev, "driver", driver, sizeof(driver)) == 0) &&
+		    (strcmp(driver, "vfio-pci") == 0)) {
+			printf("Error: device bound to vfio-pci, use -i vfio "
+				"(resets the function when opened)\n");
+			free(irq);
+			return -1;
+		}
+	}
+
+	if (strcmp(spec, "uio") == 0) {
+		irq->type = IRQ_UIO;
+		status = uio_open(dev, irq);
+	} else if (strcmp(spec, "vfio") == 0) {
+		irq->type = IRQ_VFIO;
+		status = vfio_open(dev, irq);
+	} else if (strncmp(spec, "mock", 4) == 0) {
+		irq->type = IRQ_MOCK;
+		status = mock_open(irq, spec);
+	} else {
+		printf("Error: unknown interrupt source '%s'\n", spec);
+		status = -1;
+	}
+	if (status < 0) {
+		free(irq);
+		return -1;
+	}
+	if (verbosity >= 3) {
+		printf("Interrupt source: %s\n", irq_names[irq->type]);
+	}
+	dev->irq = irq;
+	return 0;
+}
+
+void
+irq_close(
+	device_t *dev)
+{
+	struct irq *irq = dev->irq;
+
+	if (irq == NULL) {
+		return;
+	}
+	switch (irq->type) {
+		case IRQ_UIO:
+			close(irq->fd);
+			break;
+		case IRQ_VFIO:
+			vfio_close(irq);
+			break;
+		case IRQ_MOCK:
+			atomic_store(&irq->stop, 1);
+			pthread_join(irq->thread, NULL);
+			close(irq->fd);
+			break;
+	}
+	free(irq);
+	dev->irq = NULL;
+}
+
+/* Consume the interrupt and re-arm the source */
+static int
+irq_ack(
+	struct irq  *irq,
+	irq_event_t *ev)
+{
+	uint64_t count;
+	uint32_t total;
+
+	ev->latency_ns = -1;
+	switch (irq->type) {
+		case IRQ_UIO:
+			if (read(irq->fd, &total, sizeof(total)) != sizeof(total)) {
+				return -1;
+			}
+			ev->count = total - irq->uio_count;
+			irq->uio_count = total;
+			return uio_enable(irq);
+		case IRQ_VFIO:
+			if (read(irq->fd, &count, sizeof(count)) != sizeof(count)) {
+				return -1;
+			}
+			ev->count = count;
+			if (irq->index == VFIO_PCI_INTX_IRQ_INDEX) {
+				return vfio_set_irqs(irq, VFIO_IRQ_SET_DATA_NONE |
+					VFIO_IRQ_SET_ACTION_UNMASK, 1, -1);
+			}
+			return 0;
+		default:
+			if (read(irq->fd, &count, sizeof(count)) != sizeof(count)) {
+				return -1;
+			}
+			ev->count = count;
+			return 0;
+	}
+}
+
+int
+irq_wait(
+	device_t    *dev,
+	int          timeout_ms,
+	irq_event_t *ev)
+{
+	struct irq *irq = dev->irq;
+	struct pollfd pfd;
+	unsigned long long start;
+	unsigned long long wake;
+	unsigned long long fired;
+	long long left;
+	int slice;
+	int status;
+
+	if ((irq == NULL) && (irq_open(dev) < 0)) {
+		return -1;
+	}
+	irq = dev->irq;
+	memset(ev, 0, sizeof(*ev));
+	start = now_ns();
+	while (!cancel_pending()) {
+		slice = IRQ_POLL_MS;
+		if (timeout_ms >= 0) {
+			left = (long long)timeout_ms - (long long)((now_ns() - start) / 1000000ULL);
+			if (left <= 0) {
+				ev->waited_ns = now_ns() - start;
+				return 0;
+			}
+			if (left < slice) {
+				slice = (int)left;
+			}
+		}
+		pfd.fd = irq->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		status = poll(&pfd, 1, slice);
+		if (status < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printf("Error: poll() failed: %s\n", strerror(errno));
+			return -1;
+		}
+		if (status == 0) {
+			continue;
+		}
+		wake = now_ns();
+		if (irq_ack(irq, ev) < 0) {
+			printf("Error: cannot acknowledge the interrupt: %s\n", strerror(errno));
+			return -1;
+		}
+		ev->waited_ns = wake - start;
+		if (irq->type == IRQ_MOCK) {
+			fired = atomic_load(&irq->fired_ns);
+			ev->latency_ns = (wake > fired) ? (long long)(wake - fired) : 0;
+		}
+		return 1;
+	}
+	return -1;
+}
+
+/* ----------------------------------------------------------------
+ * Commands
+ * ----------------------------------------------------------------
+ */
+int
+waitirq_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	irq_event_t ev;
+	int timeout_ms = -1;
+	int status;
+
+	/* waitirq [timeout_ms] */
+	sscanf(cmd, "%*s %d", &timeout_ms);
+	status = irq_wait(dev, timeout_ms, &ev);
+	if (status < 0) {
+		if (cancel_pending()) {
+			printf("Interrupted: waitirq\n");
+		}
+		return 0;
+	}
+	if (status == 0) {
+		printf("waitirq: timeout after %d ms\n", timeout_ms);
+		return 0;
+	}
+	if (verbosity >= 1) {
+		printf("IRQ: %llu interrupt(s) after %.3f ms", ev.count, ev.waited_ns / 1e6);
+		if (ev.latency_ns >= 0) {
+			printf(", wake-up latency %.1f us", ev.latency_ns / 1e3);
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+/* on irq [count] { cmd; cmd; ... } */
+int
+on_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	char *handler[IRQ_MAX_HANDLER];
+	char *body;
+	char *lbrace;
+	char *rbrace;
+	char *save;
+	char *tok;
+	char *p;
+	unsigned long count = 0;
+	unsigned long runs = 0;
+	unsigned long long irqs = 0;
+	unsigned long long t0;
+	unsigned long long run_ns;
+	unsigned long long run_max = 0;
+	unsigned long long run_sum = 0;
+	long long lat_min = -1;
+	long long lat_max = -1;
+	long long lat_sum = 0;
+	irq_event_t ev;
+	int nhandler = 0;
+	int stop = 0;
+	int i;
+
+	p = cmd + 2;
+	p += strspn(p, " \t");
+	if (strncmp(p, "irq", 3) != 0) {
+		printf("Syntax error (use ? for help)\n");
+		return 0;
+	}
+	p += 3;
+	count = strtoul(p, NULL, 10);
+	lbrace = strchr(p, '{');
+	rbrace = strrchr(p, '}');
+	if ((lbrace == NULL) || (rbrace == NULL) || (rbrace < lbrace)) {
+		printf("Syntax error: on irq [count] { commands }\n");
+		return 0;
+	}
+	body = strndup(lbrace + 1, rbrace - lbrace - 1);
+	if (body == NULL) {
+		return 0;
+	}
+	/* Handler commands are separated by ';' or new lines */
+	for (tok = strtok_r(body, ";\n", &save); tok != NULL;
+	     tok = strtok_r(NULL, ";\n", &save)) {
+		tok += strspn(tok, " \t");
+		if ((tok[0] == '\0') || (nhandler == IRQ_MAX_HANDLER)) {
+			continue;
+		}
+		handler[nhandler++] = tok;
+	}
+
+	while (!stop && ((count == 0) || (runs < count))) {
+		if (irq_wait(dev, -1, &ev) <= 0) {
+			break;
+		}
+		irqs += ev.count;
+		if (ev.latency_ns >= 0) {
+			if ((lat_min < 0) || (ev.latency_ns < lat_min)) {
+				lat_min = ev.latency_ns;
+			}
+			if (ev.latency_ns > lat_max) {
+				lat_max = ev.latency_ns;
+			}
+			lat_sum += ev.latency_ns;
+		}
+		t0 = now_ns();
+		for (i = 0; i < nhandler; i++) {
+			verbosity >= 2 ? printf("Send: %s\n", handler[i]) : 0;
+			if (process_command(dev, handler[i]) < 0) {
+				stop = 1;
+				break;
+			}
+		}
+		run_ns = now_ns() - t0;
+		run_sum += run_ns;
+		if (run_ns > run_max) {
+			run_max = run_ns;
+		}
+		runs++;
+	}
+	free(body);
+
+	if (cancel_pending()) {
+		printf("Interrupted: on irq\n");
+	}
+	printf("on irq: %lu handler run(s) for %llu interrupt(s)", runs, irqs);
+	if (runs > 0) {
+		printf(", handler avg %.1f us max %.1f us",
+			run_sum / 1e3 / runs, run_max / 1e3);
+		if (lat_min >= 0) {
+			printf(", wake-up latency min %.1f avg %.1f max %.1f us",
+				lat_min / 1e3, lat_sum / 1e3 / runs, lat_max / 1e3);
+		}
+	}
+	printf("\n");
+	/* A handler that quit (q) or failed stops the caller too */
+	return stop ? -1 : 0;
+}
@@ -0,0 +1,52 @@
+/* irq.h
+ *
+ * Interrupt-driven waits.
+ *
+ * Instead of spinning on a status register, "waitirq" and
+ * "on irq { ... }" sleep on the device's interrupt file descriptor:
+ *
+ *  - uio:  device bound to uio_pci_generic, /dev/uioN
+ *  - vfio: device bound to vfio-pci, MSI (or INTx) routed to an eventfd;
+ *          getting the VFIO device fd resets the function (BAR and
+ *          config registers back to their reset values)
+ *  - mock: a plain eventfd signalled by a timer thread every period
+ *          milliseconds, standing in for the device when testing
+ *
+ * The source is picked with -i (default: uio, mock with -r). vfio is
+ * never picked by default because of the reset.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "pci_debug.h"
+
+/* Default period of the mock source */
+#define IRQ_MOCK_PERIOD_MS  100
+
+typedef struct {
+	/* Interrupts signalled since the previous wait */
+	unsigned long long count;
+
+	/* Time asleep, in nanoseconds */
+	unsigned long long waited_ns;
+
+	/* From the interrupt being signalled to the wake-up, in
+	 * nanoseconds, or -1 when the source cannot tell (hardware)
+	 */
+	long long          latency_ns;
+} irq_event_t;
+
+int irq_open(device_t *dev);
+void irq_close(device_t *dev);
+
+/* Returns 1 on interrupt, 0 on timeout (timeout_ms < 0 waits
+ * forever), -1 on error or cancellation
+ */
+int irq_wait(device_t *dev, int timeout_ms, irq_event_t *ev);
+
+int waitirq_cmd(device_t *dev, char *cmd);
+int on_cmd(device_t *dev, char *cmd);
+
+#endif /* IRQ_H */
@@ -0,0 +1,254 @@
+/* irqrate.c
+ *
+ * Interrupt counts from /proc/interrupts.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "irqrate.h"
+#include "config.h"
+
+#define IRQRATE_PROC  "/proc/interrupts"
+
+irqrate_t *
+irqrate_create(void)
+{
+	irqrate_t *r;
+
+	r = (irqrate_t *)calloc(1, sizeof(irqrate_t));
+	if (r == NULL) {
+		printf("Error: out of memory\n");
+		return NULL;
+	}
+	r->fd = open(IRQRATE_PROC, O_RDONLY);
+	if (r->fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			IRQRATE_PROC, errno, strerror(errno));
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+void
+irqrate_destroy(
+	irqrate_t *r)
+{
+	if (r == NULL) {
+		return;
+	}
+	close(r->fd);
+	free(r->buf);
+	free(r);
+}
+
+static int
+irq_cmp(
+	const void *a,
+	const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+int
+irqrate_device_irqs(
+	device_t     *dev,
+	unsigned int *irqs,
+	int           max)
+{
+	struct dirent *e;
+	char path[160];
+	char *end;
+	unsigned long irq;
+	int n = 0;
+	DIR *d;
+	FILE *fp;
+
+	if (config_dir(dev, path, 128) < 0) {
+		printf("Error: %s has no interrupts (file stand-in)\n", dev->filename);
+		return 0;
+	}
+	strcat(path, "/msi_irqs");
+	d = opendir(path);
+	if (d != NULL) {
+		while (((e = readdir(d)) != NULL) && (n < max)) {
+			irq = strtoul(e->d_name, &end, 10);
+			if ((e->d_name[0] != '.') && (*end == '\0')) {
+				irqs[n++] = (unsigned int)irq;
+			}
+		}
+		closedir(d);
+	}
+
+	/* No MSI: the legacy line, if any */
+	if (n == 0) {
+		strcpy(strrchr(path, '/'), "/irq");
+		fp = fopen(path, "r");
+		if ((fp != NULL) && (fscanf(fp, "%lu", &irq) == 1) && (irq != 0)) {
+			irqs[n++] = (unsigned int)irq;
+		}
+		if (fp != NULL) {
+			fclose(fp);
+		}
+	}
+	if (n == 0) {
+		printf("Error: %s has no interrupt (is a driver bound?)\n", path);
+	}
+	qsort(irqs, n, sizeof(unsigned int), irq_cmp);
+	return n;
+}
+
+int
+irqrate_add(
+	irqrate_t    *r,
+	unsigned int  irq)
+{
+	int i;
+	int k;
+
+	for (i = 0; i < r->count; i++) {
+		if (r->irq[i] == irq) {
+			return i;
+		}
+	}
+	if (r->count == IRQRATE_MAX) {
+		return -1;
+	}
+	r->irq[r->count] = irq;
+	r->total[r->count] = 0;
+
+	/* Insertion into the sorted indexes */
+	for (k = r->count; (k > 0) && (r->irq[r->sorted[k - 1]] > irq); k--) {
+		r->sorted[k] = r->sorted[k - 1];
+	}
+	r->sorted[k] = r->count;
+	return r->count++;
+}
+
+/* Index of irq, -1 when not watched */
+static int
+irqrate_find(
+	irqrate_t    *r,
+	unsigned int  irq)
+{
+	int lo = 0;
+	int hi = r->count - 1;
+	int mid;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (r->irq[r->sorted[mid]] == irq) {
+			return r->sorted[mid];
+		}
+		if (r->irq[r->sorted[mid]] < irq) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return -1;
+}
+
+/* The whole file, NUL terminated; the buffer grows until it fits */
+static ssize_t
+irqrate_load(
+	irqrate_t *r)
+{
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		if (r->size == 0) {
+			r->size = 16384;
+			r->buf = (char *)malloc(r->size);
+			if (r->buf == NULL) {
+				r->size = 0;
+				return -1;
+			}
+		}
+		n = pread(r->fd, r->buf, r->size - 1, 0);
+		if (n < 0) {
+			return -1;
+		}
+		if ((size_t)n < r->size - 1) {
+			r->buf[n] = '\0';
+			return n;
+		}
+		p = (char *)realloc(r->buf, r->size * 2);
+		if (p == NULL) {
+			return -1;
+		}
+		r->buf = p;
+		r->size *= 2;
+	}
+}
+
+int
+irqrate_read(
+	irqrate_t *r)
+{
+	unsigned int last;
+	unsigned int irq;
+	uint64_t sum;
+	uint64_t v;
+	char *p;
+	int index;
+	int c;
+
+	if ((r->count == 0) || (irqrate_load(r) < 0)) {
+		return -1;
+	}
+	last = r->irq[r->sorted[r->count - 1]];
+
+	/* Header: one "CPUn" column per online CPU */
+	p = r->buf;
+	if (r->ncpus == 0) {
+		for (; (*p != '\n') && (*p != '\0'); p++) {
+			r->ncpus += (p[0] == 'C') && (p[1] == 'P') && (p[2] == 'U');
+		}
+	}
+	p = strchr(r->buf, '\n');
+
+	/* "  irq:  count count ... chip hwirq name", numbered lines first */
+	while ((p != NULL) && (*++p != '\0')) {
+		while (*p == ' ') {
+			p++;
+		}
+		if ((*p < '0') || (*p > '9')) {
+			break;
+		}
+		for (irq = 0; (*p >= '0') && (*p <= '9'); p++) {
+			irq = irq * 10 + (*p - '0');
+		}
+		if (irq > last) {
+			break;
+		}
+		index = irqrate_find(r, irq);
+		if ((index >= 0) && (*p == ':')) {
+			p++;
+			sum = 0;
+			for (c = 0; c < r->ncpus; c++) {
+				while (*p == ' ') {
+					p++;
+				}
+				for (v = 0; (*p >= '0') && (*p <= '9'); p++) {
+					v = v * 10 + (*p - '0');
+				}
+				sum += v;
+			}
+			r->total[index] = sum;
+		}
+		p = strchr(p, '\n');
+	}
+	return 0;
+}
@@ -0,0 +1,58 @@
+/* irqrate.h
+ *
+ * Interrupt counts from /proc/interrupts.
+ *
+ * "sample irq" adds the MSI/MSI-X vectors of the selected devices (the
+ * IRQ numbers listed in their sysfs msi_irqs directory, else their
+ * legacy irq) to the sample set as pseudo registers: the number of
+ * interrupts since the previous sweep, summed over the CPUs, so rate
+ * changes line up with the register values in histograms, captures and
+ * live rings. The file stays open and is read once per sweep with
+ * pread whatever the number of vectors; the parser only converts the
+ * lines of the IRQs being watched (looked up by binary search) and
+ * stops after the last of them.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef IRQRATE_H
+#define IRQRATE_H
+
+#include <stdint.h>
+
+#include "pci_debug.h"
+
+/* capture_col_t bar of an interrupt count column */
+#define IRQ_COLUMN_BAR  0xFFFFFFFE
+
+#define IRQRATE_MAX     64
+
+typedef struct {
+	int           fd;           /* /proc/interrupts */
+	char         *buf;
+	size_t        size;
+	int           ncpus;        /* count columns, from the header */
+
+	int           count;
+	unsigned int  irq[IRQRATE_MAX];
+	uint64_t      total[IRQRATE_MAX];   /* at the last read, by index */
+
+	/* Indexes sorted by IRQ number, for the lookups */
+	int           sorted[IRQRATE_MAX];
+} irqrate_t;
+
+/* NULL (and a message) when /proc/interrupts cannot be opened */
+irqrate_t *irqrate_create(void);
+void irqrate_destroy(irqrate_t *r);
+
+/* IRQ numbers of the device (at most max), 0 and a message when it has
+ * none or is a stand-in
+ */
+int irqrate_device_irqs(device_t *dev, unsigned int *irqs, int max);
+
+/* Index of irq in r->total, added when new; -1 when full */
+int irqrate_add(irqrate_t *r, unsigned int irq);
+
+/* Refreshes r->total, -1 when the read fails */
+int irqrate_read(irqrate_t *r);
+
+#endif /* IRQRATE_H */
@@ -0,0 +1,617 @@
+/* latmap.c
+ *
+ * Per-offset read latency map and the latmap command.
+ *
+ * Each offset is read samples times in a row, every read timed on its
+ * own; the median is kept (the first read after a gap can pay for a
+ * page walk or a wake-up) along with the min and max for the CSV. The
+ * cost of reading the clock is measured first and taken off.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "latmap.h"
+#include "cancel.h"
+#include "sample.h"
+
+/* Heat map: at most LATMAP_COLS x LATMAP_ROWS cells */
+#define LATMAP_COLS  64
+#define LATMAP_ROWS  32
+
+static const char  heat_chars[] = ".:+*#";
+static const double heat_ratio[] = { 1.5, 3.0, 6.0, 12.0 };
+
+static const char *
+latmap_path(void)
+{
+	static char path[512];
+	const char *env;
+	const char *home;
+
+	env = getenv("PCI_DEBUG_LATMAP");
+	if ((env != NULL) && (env[0] != '\0')) {
+		return env;
+	}
+	home = getenv("HOME");
+	snprintf(path, sizeof(path), "%s/.pci_debug_latmap",
+		(home != NULL) ? home : ".");
+	return path;
+}
+
+/* Parse one map line, -1 when it is not one */
+static int
+latmap_parse(
+	const char     *line,
+	unsigned int   *vendor,
+	unsigned int   *device,
+	unsigned int   *bar,
+	latmap_range_t *r,
+	double         *base_ns)
+{
+	if (line[0] == '#') {
+		return -1;
+	}
+	if (sscanf(line, "%x:%x:%u %x %x %lf %lf", vendor, device, bar,
+	           &r->addr, &r->len, &r->ns, base_ns) != 7) {
+		return -1;
+	}
+	return ((r->len > 0) && (r->ns > 0.0)) ? 0 : -1;
+}
+
+static struct latmap *
+latmap_get(
+	device_t *dev)
+{
+	if (dev->latmap == NULL) {
+		dev->latmap = (struct latmap *)calloc(1, sizeof(struct latmap));
+	}
+	return dev->latmap;
+}
+
+void
+latmap_load(
+	device_t *dev)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int vendor;
+	unsigned int device;
+	unsigned int bar;
+	latmap_range_t r;
+	double base_ns;
+	struct latmap *m;
+
+	fp = fopen(latmap_path(), "r");
+	if (fp == NULL) {
+		return;
+	}
+	while (getline(&line, &len, fp) != -1) {
+		if ((latmap_parse(line, &vendor, &device, &bar, &r, &base_ns) < 0) ||
+		    (vendor != dev->vendor) || (device != dev->device) ||
+		    (bar != dev->bar)) {
+			continue;
+		}
+		m = latmap_get(dev);
+		if ((m == NULL) || (m->count == LATMAP_MAX)) {
+			break;
+		}
+		m->base_ns = base_ns;
+		m->range[m->count++] = r;
+	}
+	free(line);
+	fclose(fp);
+}
+
+/* Replace this device's lines in the map file */
+static int
+latmap_save(
+	device_t *dev)
+{
+	const char *path = latmap_path();
+	struct latmap *m = dev->latmap;
+	char tmppath[520];
+	FILE *in;
+	FILE *out;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int vendor;
+	unsigned int device;
+	unsigned int bar;
+	latmap_range_t r;
+	double base_ns;
+	int i;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	out = fopen(tmppath, "w");
+	if (out == NULL) {
+		printf("Error: cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	in = fopen(path, "r");
+	if (in == NULL) {
+		fprintf(out, "# pci_debug slow read ranges\n");
+		fprintf(out, "# vendor:device:bar addr len median_ns fastest_ns\n");
+	} else {
+		while (getline(&line, &len, in) != -1) {
+			if ((latmap_parse(line, &vendor, &device, &bar, &r, &base_ns) == 0) &&
+			    (vendor == dev->vendor) && (device == dev->device) &&
+			    (bar == dev->bar)) {
+				continue;
+			}
+			fputs(line, out);
+		}
+		free(line);
+		fclose(in);
+	}
+	for (i = 0; (m != NULL) && (i < m->count); i++) {
+		fprintf(out, "%04x:%04x:%u %.8X %.8X %.1f %.1f\n",
+			dev->vendor, dev->device, dev->bar, m->range[i].addr,
+			m->range[i].len, m->range[i].ns, m->base_ns);
+	}
+	if (fclose(out) != 0) {
+		printf("Error: cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	if (rename(tmppath, path) != 0) {
+		printf("Error: cannot update '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Slow range holding addr, NULL when none */
+static const latmap_range_t *
+latmap_find(
+	const struct latmap *m,
+	unsigned int         addr)
+{
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		if ((addr >= m->range[i].addr) && (addr - m->range[i].addr < m->range[i].len)) {
+			return &m->range[i];
+		}
+	}
+	return NULL;
+}
+
+/* Start of the first slow range after addr, end when none */
+static unsigned int
+latmap_next(
+	const struct latmap *m,
+	unsigned int         addr,
+	unsigned int         end)
+{
+	int i;
+
+	for (i = 0; i < m->count; i++) {
+		if ((m->range[i].addr > addr) && (m->range[i].addr < end)) {
+			end = m->range[i].addr;
+		}
+	}
+	return end;
+}
+
+void
+latmap_warn(
+	device_t     *dev,
+	unsigned int  addr,
+	unsigned int  len,
+	int           width,
+	int           write)
+{
+	const struct latmap *m = dev->latmap;
+	unsigned long long end = (unsigned long long)addr + len;
+	unsigned long long lo;
+	unsigned long long hi;
+	double est_ns = 0.0;
+	double worst = 0.0;
+	int touched = 0;
+	int i;
+
+	if ((m == NULL) || (width < 8)) {
+		return;
+	}
+	for (i = 0; i < m->count; i++) {
+		lo = (m->range[i].addr > addr) ? m->range[i].addr : addr;
+		hi = (unsigned long long)m->range[i].addr + m->range[i].len;
+		hi = (hi < end) ? hi : end;
+		if (lo >= hi) {
+			continue;
+		}
+		touched++;
+		est_ns += (hi - lo) / (width / 8) * m->range[i].ns;
+		worst = (m->range[i].ns > worst) ? m->range[i].ns : worst;
+	}
+	if (touched == 0) {
+		return;
+	}
+	if (write) {
+		printf("Note: %d slow range(s) in this fill (latmap, up to %.0f ns per read)\n",
+			touched, worst);
+	} else if (est_ns >= LATMAP_WARN_MS * 1e6) {
+		printf("Note: %d slow range(s) in this dump (latmap), about %.1f s of reads\n",
+			touched, est_ns / 1e9);
+	}
+}
+
+unsigned int
+latmap_read(
+	device_t         *dev,
+	const strategy_t *s,
+	unsigned int      addr,
+	unsigned char    *buf,
+	unsigned int      len,
+	progress_t       *prog)
+{
+	const struct latmap *m = dev->latmap;
+	const latmap_range_t *r;
+	strategy_t slow;
+	unsigned int end = addr + len;
+	unsigned int pos = addr;
+	unsigned int next;
+	unsigned int total = 0;
+	unsigned int got;
+
+	if ((m == NULL) || (m->count == 0)) {
+		return bulk_read(dev, s, addr, buf, len, prog);
+	}
+	/* Latency bound: more reads in flight, in smaller pieces */
+	slow = *s;
+	slow.threads = (slow.threads < LATMAP_THREADS) ? LATMAP_THREADS : slow.threads;
+	slow.chunk = (slow.chunk > LATMAP_CHUNK) ? LATMAP_CHUNK : slow.chunk;
+
+	while (pos < end) {
+		r = latmap_find(m, pos);
+		if (r != NULL) {
+			next = (r->addr + r->len - pos < end - pos) ? r->addr + r->len : end;
+		} else {
+			next = latmap_next(m, pos, end);
+		}
+		got = bulk_read(dev, (r != NULL) ? &slow : s, pos, buf + (pos - addr),
+			next - pos, prog);
+		total += got;
+		if (got < next - pos) {
+			break;
+		}
+		pos = next;
+	}
+	return total;
+}
+
+/* ----------------------------------------------------------------
+ * Scan
+ * ----------------------------------------------------------------
+ */
+static int
+cmp_double(
+	const void *a,
+	const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Cheapest back to back clock read, taken off every sample */
+static double
+clock_cost(void)
+{
+	unsigned long long t0;
+	unsigned long long t1;
+	double best = 1e9;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		t0 = sample_now_ns();
+		t1 = sample_now_ns();
+		if (t1 - t0 < best) {
+			best = t1 - t0;
+		}
+	}
+	return best;
+}
+
+static char
+heat_char(
+	double ns,
+	double base)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (ns < base * heat_ratio[i]) {
+			break;
+		}
+	}
+	return heat_chars[i];
+}
+
+static void
+latmap_heat(
+	unsigned int  addr,
+	unsigned int  stride,
+	const double *med,
+	unsigned int  n,
+	double        base)
+{
+	unsigned int per = (n + LATMAP_COLS * LATMAP_ROWS - 1) / (LATMAP_COLS * LATMAP_ROWS);
+	unsigned int cell;
+	unsigned int i;
+	double worst;
+	int col = 0;
+
+	printf("Heat map, %u offset(s) per cell, worst median in the cell:\n", per);
+	printf("  '.' < %.0f ns, ':' < %.0f ns, '+' < %.0f ns, '*' < %.0f ns, '#' above\n",
+		base * heat_ratio[0], base * heat_ratio[1], base * heat_ratio[2],
+		base * heat_ratio[3]);
+	for (cell = 0; cell * per < n; cell++) {
+		if (col == 0) {
+			printf("%.8X: ", addr + cell * per * stride);
+		}
+		worst = 0.0;
+		for (i = cell * per; (i < (cell + 1) * per) && (i < n); i++) {
+			worst = (med[i] > worst) ? med[i] : worst;
+		}
+		putchar(heat_char(worst, base));
+		if (++col == LATMAP_COLS) {
+			putchar('\n');
+			col = 0;
+		}
+	}
+	if (col != 0) {
+		putchar('\n');
+	}
+}
+
+static int
+slow(
+	double ns,
+	double base)
+{
+	return (ns >= base * LATMAP_SLOW_RATIO) && (ns - base >= LATMAP_SLOW_NS);
+}
+
+static int
+cmp_range(
+	const void *a,
+	const void *b)
+{
+	unsigned int x = ((const latmap_range_t *)a)->addr;
+	unsigned int y = ((const latmap_range_t *)b)->addr;
+
+	return (x > y) - (x < y);
+}
+
+/* Merge runs of slow offsets into ranges, replacing the known ranges
+ * inside the scanned window
+ */
+static void
+latmap_update(
+	device_t     *dev,
+	unsigned int  addr,
+	unsigned int  stride,
+	const double *med,
+	unsigned int  n,
+	double        base)
+{
+	struct latmap *m = latmap_get(dev);
+	latmap_range_t *r;
+	unsigned long long end = (unsigned long long)addr + (unsigned long long)n * stride;
+	unsigned int i;
+	unsigned int j;
+	double sum;
+	int kept = 0;
+	int dropped = 0;
+	int k;
+
+	if (m == NULL) {
+		return;
+	}
+	for (k = 0; k < m->count; k++) {
+		if (((unsigned long long)m->range[k].addr + m->range[k].len <= addr) ||
+		    (m->range[k].addr >= end)) {
+			m->range[kept++] = m->range[k];
+		}
+	}
+	m->count = kept;
+	m->base_ns = base;
+
+	for (i = 0; i < n; i = j) {
+		if (!slow(med[i], base)) {
+			j = i + 1;
+			continue;
+		}
+		sum = 0.0;
+		for (j = i; (j < n) && slow(med[j], base); j++) {
+			sum += med[j];
+		}
+		if (m->count == LATMAP_MAX) {
+			dropped++;
+			continue;
+		}
+		r = &m->range[m->count++];
+		r->addr = addr + i * stride;
+		r->len = (j - i) * stride;
+		r->ns = sum / (j - i);
+		printf("  slow: %.8X-%.8X  %.0f ns per read (%.1fx)\n", r->addr,
+			r->addr + r->len - 1, r->ns, r->ns / base);
+	}
+	if (m->count == kept) {
+		printf("  no slow ranges\n");
+	}
+	if (dropped > 0) {
+		printf("  %d more slow range(s) not kept (at most %d)\n", dropped, LATMAP_MAX);
+	}
+	qsort(m->range, m->count, sizeof(latmap_range_t), cmp_range);
+}
+
+static int
+latmap_scan(
+	device_t     *dev,
+	unsigned int  addr,
+	unsigned int  len,
+	unsigned int  stride,
+	int           samples,
+	const char   *csv)
+{
+	unsigned long long t0;
+	unsigned long long t1;
+	unsigned long long start;
+	double *med;
+	double *lo;
+	double *hi;
+	double *t;
+	double *sorted;
+	double overhead;
+	double base = 1.0;
+	double worst = 0.0;
+	unsigned int n;
+	unsigned int i;
+	FILE *fp = NULL;
+	int width;
+	int k;
+
+	if ((addr >= dev->size) || (len > dev->size - addr)) {
+		printf("Error: window %.8X-%.8X is outside the BAR\n", addr, addr + len - 1);
+		return -1;
+	}
+	/* Widest access the stride keeps aligned, up to 32 bits */
+	width = (((addr | stride) & 3) == 0) ? 32 : (((addr | stride) & 1) == 0) ? 16 : 8;
+	if (len < (unsigned int)width / 8) {
+		printf("Error: window shorter than one %d-bit read\n", width);
+		return -1;
+	}
+	n = (len - width / 8) / stride + 1;
+	if (csv != NULL) {
+		fp = fopen(csv, "w");
+		if (fp == NULL) {
+			printf("Open failed for file '%s': errno %d, %s\n",
+				csv, errno, strerror(errno));
+			return -1;
+		}
+	}
+	med = (double *)malloc(n * sizeof(double));
+	lo = (double *)malloc(n * sizeof(double));
+	hi = (double *)malloc(n * sizeof(double));
+	t = (double *)malloc(samples * sizeof(double));
+	if ((med == NULL) || (lo == NULL) || (hi == NULL) || (t == NULL)) {
+		printf("Error: out of memory\n");
+		n = 0;
+	}
+
+	overhead = clock_cost();
+	start = sample_now_ns();
+	for (i = 0; i < n; i++) {
+		if (((i & 0xFFF) == 0) && cancel_pending()) {
+			printf("Interrupted: %u of %u offsets timed\n", i, n);
+			n = i;
+			break;
+		}
+		for (k = 0; k < samples; k++) {
+			t0 = sample_now_ns();
+			sample_read(dev, addr + i * stride, width, 0);
+			t1 = sample_now_ns();
+			t[k] = (t1 - t0 > overhead) ? t1 - t0 - overhead : 0.0;
+		}
+		qsort(t, samples, sizeof(double), cmp_double);
+		lo[i] = t[0];
+		med[i] = t[samples / 2];
+		hi[i] = t[samples - 1];
+		worst = (med[i] > worst) ? med[i] : worst;
+	}
+
+	if (n > 0) {
+		/* Fast reference: 10th percentile of the medians, the fastest
+		 * single offset is too easily a fluke
+		 */
+		sorted = (double *)malloc(n * sizeof(double));
+		if (sorted != NULL) {
+			memcpy(sorted, med, n * sizeof(double));
+			qsort(sorted, n, sizeof(double), cmp_double);
+			base = sorted[n / 10];
+			free(sorted);
+		}
+		/* The clock has a resolution too */
+		base = (base < 1.0) ? 1.0 : base;
+		printf("latmap: %u offsets x %d %d-bit reads in %.1f ms, median %.0f-%.0f ns\n",
+			n, samples, width, (sample_now_ns() - start) / 1e6, base, worst);
+		latmap_heat(addr, stride, med, n, base);
+		latmap_update(dev, addr, stride, med, n, base);
+		if (latmap_save(dev) == 0) {
+			printf("Latency map saved to %s\n", latmap_path());
+		}
+	}
+	if (fp != NULL) {
+		fprintf(fp, "addr,min_ns,median_ns,max_ns\n");
+		for (i = 0; i < n; i++) {
+			fprintf(fp, "%.8X,%.0f,%.0f,%.0f\n", addr + i * stride, lo[i], med[i], hi[i]);
+		}
+		fclose(fp);
+	}
+	free(med);
+	free(lo);
+	free(hi);
+	free(t);
+	return 0;
+}
+
+static void
+latmap_list(
+	device_t *dev)
+{
+	const struct latmap *m = dev->latmap;
+	int i;
+
+	if ((m == NULL) || (m->count == 0)) {
+		printf("Latency map: no slow ranges\n");
+		return;
+	}
+	printf("Latency map: fastest reads %.0f ns\n", m->base_ns);
+	for (i = 0; i < m->count; i++) {
+		printf("  slow: %.8X-%.8X  %.0f ns per read (%.1fx)\n", m->range[i].addr,
+			m->range[i].addr + m->range[i].len - 1, m->range[i].ns,
+			m->range[i].ns / m->base_ns);
+	}
+}
+
+int
+latmap_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	unsigned int addr;
+	unsigned int len;
+	unsigned int stride;
+	int samples = LATMAP_SAMPLES;
+	char word[16];
+	char csv[100];
+	int status;
+
+	/* latmap, latmap clear, latmap addr len stride [samples [csv]] */
+	if (sscanf(cmd, "%*s %15s", word) != 1) {
+		latmap_list(dev);
+		return 0;
+	}
+	if (strcmp(word, "clear") == 0) {
+		if (dev->latmap != NULL) {
+			dev->latmap->count = 0;
+		}
+		latmap_save(dev);
+		return 0;
+	}
+	status = sscanf(cmd, "%*s %x %x %x %d %99s", &addr, &len, &stride, &samples, csv);
+	if ((status < 3) || (len == 0) || (stride == 0) || (samples < 1)) {
+		printf("Syntax error: latmap addr len stride [samples [csv]]\n");
+		return 0;
+	}
+	latmap_scan(dev, addr, len, stride, samples, (status == 5) ? csv : NULL);
+	return 0;
+}
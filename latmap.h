@@ -0,0 +1,65 @@
+/* latmap.h
+ *
+ * Per-offset read latency map.
+ *
+ * Registers bridged to a slow internal bus can cost ten times more per
+ * read than the rest of a BAR. "latmap addr len stride [samples]" times
+ * the reads at every stride bytes of a window, prints a heat map of the
+ * median latency by address and the ranges slower than
+ * LATMAP_SLOW_RATIO times the fastest offsets, and stores those ranges
+ * in the latency map file keyed by vendor:device:bar. Later runs load
+ * them: d and f say up front when they touch a slow range (and what it
+ * will cost), and buffered dumps of coalesce ranges or tuned windows
+ * read the slow parts from LATMAP_THREADS threads so that their round
+ * trips overlap; other dumps keep their accesses in address order.
+ *
+ * The map file is $PCI_DEBUG_LATMAP, or ~/.pci_debug_latmap.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef LATMAP_H
+#define LATMAP_H
+
+#include "pci_debug.h"
+#include "bulk.h"
+
+#define LATMAP_MAX         32
+#define LATMAP_SAMPLES     8
+#define LATMAP_SLOW_RATIO  3
+#define LATMAP_SLOW_NS     200   /* and at least this much slower */
+
+/* Slow ranges of buffered dumps: threads and bytes per chunk */
+#define LATMAP_THREADS     4
+#define LATMAP_CHUNK       256
+
+/* d mentions slow ranges costing at least this much */
+#define LATMAP_WARN_MS     100
+
+typedef struct {
+	unsigned int addr;
+	unsigned int len;
+	double       ns;       /* median read latency */
+} latmap_range_t;
+
+struct latmap {
+	double         base_ns;  /* fastest offsets of the scan */
+	int            count;
+	latmap_range_t range[LATMAP_MAX];
+};
+
+void latmap_load(device_t *dev);
+
+/* Says which slow ranges [addr, addr+len) touches, with the expected
+ * time of its reads of width bits (write: no estimate)
+ */
+void latmap_warn(device_t *dev, unsigned int addr, unsigned int len,
+	int width, int write);
+
+/* bulk_read() with the slow ranges read from LATMAP_THREADS threads */
+unsigned int latmap_read(device_t *dev, const strategy_t *s,
+	unsigned int addr, unsigned char *buf, unsigned int len,
+	progress_t *prog);
+
+int latmap_cmd(device_t *dev, char *cmd);
+
+#endif /* LATMAP_H */
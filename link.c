@@ -0,0 +1,431 @@
+/* link.c
+ *
+ * PCIe link monitor and the link command.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "link.h"
+#include "bulk.h"
+#include "cancel.h"
+#include "coalesce.h"
+#include "msample.h"
+#include "tune.h"
+
+/* Per lane and direction, after line encoding (8b/10b up to Gen2,
+ * 128b/130b for Gen3 to Gen5, 242/256 FLITs for Gen6), in MB/s
+ */
+static const struct {
+	const char *gen;
+	double      gts;
+	double      lane_mbps;
+} link_speeds[] = {
+	{ "Gen?",  0.0,    0.0 },
+	{ "Gen1",  2.5,  250.0 },
+	{ "Gen2",  5.0,  500.0 },
+	{ "Gen3",  8.0,  984.6 },
+	{ "Gen4", 16.0, 1969.2 },
+	{ "Gen5", 32.0, 3938.5 },
+	{ "Gen6", 64.0, 7562.5 },
+};
+
+#define LINK_NSPEEDS  (int)(sizeof(link_speeds) / sizeof(link_speeds[0]))
+
+typedef struct {
+	device_t      *dev;
+	pthread_t      thread;
+
+	/* Decoded registers, cap == 0 when unavailable */
+	int            cap;
+	uint32_t       lnkcap;
+	uint16_t       lnksta;
+	uint16_t       lnkctl2;
+
+	/* link bw */
+	unsigned int   addr;
+	unsigned int   len;
+	int            write;
+	double         read_mbps;
+	double         write_mbps;
+	int            interrupted;
+} link_job_t;
+
+static int
+speed_index(
+	int code)
+{
+	return ((code > 0) && (code < LINK_NSPEEDS)) ? code : 0;
+}
+
+static double
+link_mbps(
+	int speed,
+	int width)
+{
+	return link_speeds[speed_index(speed)].lane_mbps * width;
+}
+
+static double
+now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reads the link registers of one device */
+static void
+link_read(
+	link_job_t *j)
+{
+	unsigned char config[CONFIG_SIZE];
+	int n;
+
+	j->cap = 0;
+	if (config_dir(j->dev, (char *)config, sizeof(config)) < 0) {
+		return;
+	}
+	n = config_read(j->dev, config, sizeof(config));
+	if (n <= 0) {
+		return;
+	}
+	j->cap = config_find_cap(config, n, PCI_CAP_ID_EXP);
+	if ((j->cap == 0) || (j->cap + PCI_EXP_LNKCTL2 + 2 > n)) {
+		j->cap = 0;
+		return;
+	}
+	memcpy(&j->lnkcap, config + j->cap + PCI_EXP_LNKCAP, 4);
+	memcpy(&j->lnksta, config + j->cap + PCI_EXP_LNKSTA, 2);
+	memcpy(&j->lnkctl2, config + j->cap + PCI_EXP_LNKCTL2, 2);
+}
+
+static void *
+link_read_thread(
+	void *arg)
+{
+	link_read((link_job_t *)arg);
+	return NULL;
+}
+
+/* Times a dump of the window, and with write a store of the same data
+ * back, with the tuned strategies when there are any
+ */
+static void *
+link_bw_thread(
+	void *arg)
+{
+	static const strategy_t dflt = STRATEGY_DEFAULT;
+	link_job_t *j = (link_job_t *)arg;
+	const strategy_t *s;
+	unsigned char *buf;
+	unsigned int done;
+	double t0;
+
+	link_read(j);
+	j->read_mbps = 0.0;
+	j->write_mbps = 0.0;
+	if ((j->addr >= j->dev->size) || (j->len > j->dev->size - j->addr)) {
+		return NULL;
+	}
+	buf = (unsigned char *)malloc(j->len);
+	if (buf == NULL) {
+		return NULL;
+	}
+	s = profile_lookup(j->dev, PROFILE_READ, j->addr, j->len);
+	t0 = now_s();
+	done = bulk_read(j->dev, (s != NULL) ? s : &dflt, j->addr, buf, j->len, NULL);
+	j->read_mbps = done / (now_s() - t0) / 1e6;
+	j->interrupted = (done < j->len);
+	if (j->write && !j->interrupted) {
+		s = profile_lookup(j->dev, PROFILE_WRITE, j->addr, j->len);
+		t0 = now_s();
+		done = bulk_write(j->dev, (s != NULL) ? s : &dflt, j->addr, buf, j->len, NULL);
+		j->write_mbps = done / (now_s() - t0) / 1e6;
+		j->interrupted = (done < j->len);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* One thread per device, run inline when a thread cannot be had */
+static void
+link_parallel(
+	link_job_t *jobs,
+	int         n,
+	void     *(*fn)(void *))
+{
+	int started[MSAMPLE_MAX_DEVS];
+	int d;
+
+	for (d = 0; d < n; d++) {
+		started[d] = (pthread_create(&jobs[d].thread, NULL, fn, &jobs[d]) == 0);
+		if (!started[d]) {
+			fn(&jobs[d]);
+		}
+	}
+	for (d = 0; d < n; d++) {
+		if (started[d]) {
+			pthread_join(jobs[d].thread, NULL);
+		}
+	}
+}
+
+static const char *
+link_name(
+	device_t *dev,
+	char     *buf,
+	size_t    len)
+{
+	if (config_dir(dev, buf, len) == 0) {
+		snprintf(buf, len, "%04x:%02x:%02x.%1x",
+			dev->domain, dev->bus, dev->slot, dev->function);
+	} else {
+		snprintf(buf, len, "%s", dev->filename);
+	}
+	return buf;
+}
+
+/* Returns 1 when the link trained below the device's capability */
+static int
+link_print(
+	int         index,
+	link_job_t *j)
+{
+	char name[128];
+	int cap_speed;
+	int cap_width;
+	int speed;
+	int width;
+	int target;
+	int degraded;
+
+	printf("dev%d %s", index, link_name(j->dev, name, sizeof(name)));
+	if (j->cap == 0) {
+		printf(": no PCI Express link information\n");
+		return 0;
+	}
+	cap_speed = j->lnkcap & 0xF;
+	cap_width = (j->lnkcap >> 4) & 0x3F;
+	speed = j->lnksta & 0xF;
+	width = (j->lnksta >> 4) & 0x3F;
+	target = j->lnkctl2 & 0xF;
+	degraded = (speed < cap_speed) || (width < cap_width);
+
+	printf(" [%04x:%04x]: LnkCap %s x%d, LnkSta %s x%d, target %s",
+		j->dev->vendor, j->dev->device,
+		link_speeds[speed_index(cap_speed)].gen, cap_width,
+		link_speeds[speed_index(speed)].gen, width,
+		link_speeds[speed_index(target)].gen);
+	if (j->lnksta & PCI_EXP_LNKSTA_LT) {
+		printf(", training");
+	}
+	if (degraded) {
+		printf(" - DEGRADED");
+		if (speed < cap_speed) {
+			printf(" speed %.1f of %.1f GT/s", link_speeds[speed_index(speed)].gts,
+				link_speeds[speed_index(cap_speed)].gts);
+		}
+		if (width < cap_width) {
+			printf(" width x%d of x%d", width, cap_width);
+		}
+		if ((target > 0) && (target < cap_speed)) {
+			printf(" (target speed limited in LnkCtl2)");
+		}
+	}
+	printf("\n    link %.0f MB/s of %.0f MB/s per direction\n",
+		link_mbps(speed, width), link_mbps(cap_speed, cap_width));
+	return degraded;
+}
+
+static int
+link_show(
+	link_job_t *jobs,
+	int         n)
+{
+	int degraded = 0;
+	int d;
+
+	link_parallel(jobs, n, link_read_thread);
+	for (d = 0; d < n; d++) {
+		degraded += link_print(d, &jobs[d]);
+	}
+	if (degraded > 0) {
+		printf("%d of %d link(s) degraded\n", degraded, n);
+	}
+	return 0;
+}
+
+static void
+link_bw(
+	link_job_t   *jobs,
+	int           n,
+	unsigned int  addr,
+	unsigned int  len,
+	int           write)
+{
+	char name[128];
+	double link;
+	int d;
+
+	for (d = 0; d < n; d++) {
+		jobs[d].addr = addr;
+		jobs[d].len = len;
+		jobs[d].write = write;
+	}
+	link_parallel(jobs, n, link_bw_thread);
+	for (d = 0; d < n; d++) {
+		printf("dev%d %s: ", d, link_name(jobs[d].dev, name, sizeof(name)));
+		if (jobs[d].read_mbps == 0.0) {
+			printf("window %.8X-%.8X not in the BAR\n", addr, addr + len - 1);
+			continue;
+		}
+		link = (jobs[d].cap != 0) ?
+			link_mbps(jobs[d].lnksta & 0xF, (jobs[d].lnksta >> 4) & 0x3F) : 0.0;
+		printf("dump %.1f MB/s", jobs[d].read_mbps);
+		if (link > 0.0) {
+			printf(" (%.1f%%)", 100.0 * jobs[d].read_mbps / link);
+		}
+		if (jobs[d].write_mbps > 0.0) {
+			printf(", fill %.1f MB/s", jobs[d].write_mbps);
+			if (link > 0.0) {
+				printf(" (%.1f%%)", 100.0 * jobs[d].write_mbps / link);
+			}
+		}
+		if (link > 0.0) {
+			printf(" of a %.0f MB/s link", link);
+		}
+		printf("%s\n", jobs[d].interrupted ? ", interrupted" : "");
+	}
+	for (d = 0; d < n; d++) {
+		if (jobs[d].cap != 0) {
+			link_print(d, &jobs[d]);
+		}
+	}
+}
+
+/* Polls Link Status, reporting every change */
+static void
+link_watch(
+	link_job_t   *jobs,
+	int           n,
+	unsigned int  period_ms,
+	unsigned long count)
+{
+	struct timespec ts;
+	int fd[MSAMPLE_MAX_DEVS];
+	unsigned long changes[MSAMPLE_MAX_DEVS];
+	unsigned long polls = 0;
+	uint16_t sta;
+	char name[128];
+	double start;
+	int d;
+
+	link_parallel(jobs, n, link_read_thread);
+	for (d = 0; d < n; d++) {
+		changes[d] = 0;
+		fd[d] = (jobs[d].cap != 0) ? config_open(jobs[d].dev, O_RDONLY) : -1;
+		if (fd[d] < 0) {
+			printf("dev%d %s: not watched, no PCI Express link information\n",
+				d, link_name(jobs[d].dev, name, sizeof(name)));
+		}
+	}
+	ts.tv_sec = period_ms / 1000;
+	ts.tv_nsec = (period_ms % 1000) * 1000000L;
+	start = now_s();
+	printf("Watching Link Status every %u ms (Ctrl-C to stop)\n", period_ms);
+
+	while (((count == 0) || (polls < count)) && !cancel_pending()) {
+		for (d = 0; d < n; d++) {
+			if ((fd[d] < 0) ||
+			    (pread(fd[d], &sta, 2, jobs[d].cap + PCI_EXP_LNKSTA) != 2) ||
+			    (sta == jobs[d].lnksta)) {
+				continue;
+			}
+			printf("%9.3f s dev%d: %s x%d -> %s x%d%s%s%s%s\n", now_s() - start, d,
+				link_speeds[speed_index(jobs[d].lnksta & 0xF)].gen,
+				(jobs[d].lnksta >> 4) & 0x3F,
+				link_speeds[speed_index(sta & 0xF)].gen, (sta >> 4) & 0x3F,
+				(sta & PCI_EXP_LNKSTA_LT) ? ", training" : "",
+				(sta & PCI_EXP_LNKSTA_DLLLA) ? "" : ", DL down",
+				(sta & PCI_EXP_LNKSTA_LBMS) ? ", bandwidth management" : "",
+				(sta & PCI_EXP_LNKSTA_LABS) ? ", autonomous bandwidth change" : "");
+			jobs[d].lnksta = sta;
+			changes[d]++;
+		}
+		polls++;
+		nanosleep(&ts, NULL);
+	}
+
+	printf("%lu polls in %.1f s\n", polls, now_s() - start);
+	for (d = 0; d < n; d++) {
+		if (fd[d] < 0) {
+			continue;
+		}
+		close(fd[d]);
+		printf("dev%d %s: %lu change(s)%s\n", d,
+			link_name(jobs[d].dev, name, sizeof(name)), changes[d],
+			(changes[d] > 1) ? " - FLAPPING" : "");
+	}
+}
+
+int
+link_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	device_t *devs[MSAMPLE_MAX_DEVS];
+	link_job_t jobs[MSAMPLE_MAX_DEVS];
+	unsigned int period_ms = LINK_WATCH_MS;
+	unsigned long count = 0;
+	unsigned int addr;
+	unsigned int len;
+	strategy_t plain;
+	char word[16];
+	char mode[8];
+	int status;
+	int n;
+	int d;
+
+	n = msample_devices(dev, devs, MSAMPLE_MAX_DEVS);
+	memset(jobs, 0, sizeof(jobs));
+	for (d = 0; d < n; d++) {
+		jobs[d].dev = devs[d];
+	}
+
+	/* link, link watch [period_ms [count]], link bw addr len [w] */
+	if (sscanf(cmd, "%*s %15s", word) != 1) {
+		return link_show(jobs, n);
+	}
+	if (strcmp(word, "watch") == 0) {
+		sscanf(cmd, "%*s %*s %u %lu", &period_ms, &count);
+		link_watch(jobs, n, (period_ms > 0) ? period_ms : 1, count);
+	} else if (strcmp(word, "bw") == 0) {
+		status = sscanf(cmd, "%*s %*s %x %x %7s", &addr, &len, mode);
+		if ((status < 2) || (len == 0)) {
+			printf("Syntax error: link bw addr len [w]\n");
+			return 0;
+		}
+		/* The rewrite stores the dumped bytes back: plain memory only,
+		 * never W1C registers or FIFOs
+		 */
+		if ((status == 3) && (mode[0] == 'w') &&
+		    !coalesce_lookup(dev, addr, len, &plain)) {
+			printf("Error: link bw w rewrites the window, mark it as plain memory first (coalesce addr len)\n");
+			return 0;
+		}
+		link_bw(jobs, n, addr, len, (status == 3) && (mode[0] == 'w'));
+	} else {
+		printf("Syntax error (use ? for help)\n");
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+/* link.h
+ *
+ * PCIe link monitor.
+ *
+ * "link" decodes the Link Capabilities, Status and Control 2 registers
+ * of the PCI Express capability of this device and of every device
+ * added with "msample add", and flags links that trained below what
+ * the device supports (e.g. Gen2 x4 on a Gen3 x8 card). "link watch"
+ * polls Link Status for flaps (retraining, speed or width changes),
+ * "link bw" times a dump (and a rewrite of the same data) of a BAR
+ * window against the theoretical bandwidth of the negotiated link; the
+ * rewrite is only allowed in a range marked with "coalesce" (plain
+ * memory), as it stores the dumped values back.
+ * Devices are handled in parallel, one thread each.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef LINK_H
+#define LINK_H
+
+#include "pci_debug.h"
+#include "config.h"
+
+/* Offsets in the PCI Express capability */
+#define PCI_EXP_LNKCAP        0x0C
+#define PCI_EXP_LNKCTL        0x10
+#define PCI_EXP_LNKSTA        0x12
+#define PCI_EXP_LNKCTL2       0x30
+
+#define PCI_EXP_LNKSTA_LT     0x0800   /* link training */
+#define PCI_EXP_LNKSTA_DLLLA  0x2000   /* data link layer link active */
+#define PCI_EXP_LNKSTA_LBMS   0x4000   /* link bandwidth management status */
+#define PCI_EXP_LNKSTA_LABS   0x8000   /* link autonomous bandwidth status */
+
+#define LINK_WATCH_MS         100
+
+int link_cmd(device_t *dev, char *cmd);
+
+#endif /* LINK_H */
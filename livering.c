@@ -0,0 +1,197 @@
+/* livering.c
+ *
+ * Live capture ring: writer and reader.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "livering.h"
+
+live_t *
+live_create(
+	const char          *path,
+	size_t               size,
+	int                  nregs,
+	const capture_col_t *cols,
+	uint32_t             period_us)
+{
+	char tmp[256];
+	struct timespec real;
+	live_hdr_t *h;
+	live_t *l;
+	size_t data = live_data_offset(nregs);
+	uint32_t rec = (1 + nregs) * sizeof(uint64_t);
+	int fd;
+
+	if (size < data + rec) {
+		printf("Error: a live ring needs at least %zu bytes\n", data + rec);
+		return NULL;
+	}
+	l = (live_t *)calloc(1, sizeof(live_t));
+	if (l == NULL) {
+		return NULL;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			tmp, errno, strerror(errno));
+		free(l);
+		return NULL;
+	}
+	l->capacity = (size - data) / rec;
+	l->size = data + l->capacity * rec;
+	if (ftruncate(fd, l->size) < 0) {
+		printf("Error: cannot size '%s': %s\n", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		free(l);
+		return NULL;
+	}
+	h = (live_hdr_t *)mmap(NULL, l->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == (live_hdr_t *)MAP_FAILED) {
+		printf("Error: cannot map '%s': %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		free(l);
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &real);
+	memcpy(h->magic, LIVE_MAGIC, sizeof(h->magic));
+	h->version = LIVE_VERSION;
+	h->nregs = nregs;
+	h->rec = rec;
+	h->period_us = period_us;
+	h->capacity = l->capacity;
+	h->start_unix_ns = (uint64_t)real.tv_sec * 1000000000ULL + real.tv_nsec;
+	h->clock = CLOCK_MONOTONIC;
+	atomic_store(&h->flags, 0);
+	atomic_store(&h->head, 0);
+	atomic_store(&h->tail, 0);
+	memcpy(LIVE_COLS(h), cols, nregs * sizeof(capture_col_t));
+
+	/* Readers only ever see a complete header */
+	if (rename(tmp, path) < 0) {
+		printf("Error: cannot rename '%s': %s\n", tmp, strerror(errno));
+		munmap(h, l->size);
+		unlink(tmp);
+		free(l);
+		return NULL;
+	}
+	l->hdr = h;
+	l->data = LIVE_DATA(h);
+	l->nregs = nregs;
+	return l;
+}
+
+void
+live_close(
+	live_t *l)
+{
+	if (l == NULL) {
+		return;
+	}
+	atomic_fetch_or(&l->hdr->flags, LIVE_CLOSED);
+	munmap(l->hdr, l->size);
+	free(l);
+}
+
+int
+live_open(
+	live_reader_t *r,
+	const char    *path,
+	int            from_end)
+{
+	struct stat st;
+	live_hdr_t *h;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Open failed for file '%s': errno %d, %s\n",
+			path, errno, strerror(errno));
+		return -1;
+	}
+	if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(live_hdr_t))) {
+		fprintf(stderr, "Error: '%s' is not a live capture ring\n", path);
+		close(fd);
+		return -1;
+	}
+	h = (live_hdr_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (h == (live_hdr_t *)MAP_FAILED) {
+		fprintf(stderr, "Error: cannot map '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	if ((memcmp(h->magic, LIVE_MAGIC, sizeof(h->magic)) != 0) ||
+	    (h->version != LIVE_VERSION) || (h->capacity == 0) ||
+	    (h->nregs > LIVE_MAX_REGS) ||
+	    (h->rec != (1 + h->nregs) * sizeof(uint64_t)) ||
+	    (live_data_offset(h->nregs) + h->capacity * h->rec > (size_t)st.st_size)) {
+		fprintf(stderr, "Error: '%s' is not a live capture ring\n", path);
+		munmap(h, st.st_size);
+		return -1;
+	}
+	r->hdr = h;
+	r->size = st.st_size;
+	r->pos = from_end ? atomic_load_explicit(&h->head, memory_order_acquire)
+	                  : atomic_load_explicit(&h->tail, memory_order_acquire);
+	return 0;
+}
+
+void
+live_reader_close(
+	live_reader_t *r)
+{
+	munmap(r->hdr, r->size);
+	r->hdr = NULL;
+}
+
+int
+live_next(
+	live_reader_t *r,
+	uint64_t      *rec,
+	uint64_t      *lost)
+{
+	live_hdr_t *h = r->hdr;
+	uint64_t head;
+	uint64_t tail;
+	unsigned int flags;
+
+	*lost = 0;
+	for (;;) {
+		flags = atomic_load_explicit(&h->flags, memory_order_acquire);
+		head = atomic_load_explicit(&h->head, memory_order_acquire);
+		if (r->pos >= head) {
+			return (flags & LIVE_CLOSED) ? -1 : 0;
+		}
+		tail = atomic_load_explicit(&h->tail, memory_order_acquire);
+		if (r->pos < tail) {
+			*lost += tail - r->pos;
+			r->pos = tail;
+			continue;
+		}
+		memcpy(rec, LIVE_DATA(h) + (r->pos % h->capacity) * h->rec, h->rec);
+
+		/* Still intact after the copy? */
+		atomic_thread_fence(memory_order_acquire);
+		tail = atomic_load_explicit(&h->tail, memory_order_relaxed);
+		if (r->pos < tail) {
+			*lost += tail - r->pos;
+			r->pos = tail;
+			continue;
+		}
+		r->pos++;
+		return 1;
+	}
+}
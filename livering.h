@@ -0,0 +1,126 @@
+/* livering.h
+ *
+ * Live capture ring: a memory mapped file other processes can follow
+ * while the sampler writes it.
+ *
+ *   live_hdr_t                     magic, geometry, head/tail
+ *   capture_col_t x nregs          schema (as in capture files)
+ *   record x capacity              at LIVE_DATA(hdr)
+ *
+ * A record is the sweep time stamp (CLOCK_MONOTONIC ns) followed by one
+ * 64-bit value per register. Sweep n lives in slot n % capacity.
+ *
+ * head is the number of records written. tail is the oldest sequence
+ * number still intact: before reusing a slot the writer moves tail past
+ * the record it is about to overwrite, then writes the record, then
+ * publishes head. A reader copies a record and re-checks tail afterwards;
+ * if tail moved past it the copy may be torn and the record counts as
+ * overrun. No locks, the writer never waits for readers.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef LIVERING_H
+#define LIVERING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "capture.h"
+
+#define LIVE_MAGIC    "PCILIVE1"
+#define LIVE_VERSION  1
+#define LIVE_MAX_REGS 64
+
+/* live_hdr_t flags */
+#define LIVE_CLOSED   0x1   /* writer is done, nothing more will come */
+
+typedef struct {
+	char          magic[8];
+	uint32_t      version;
+	uint32_t      nregs;
+	uint32_t      rec;            /* bytes per record */
+	uint32_t      period_us;
+	uint64_t      capacity;       /* records */
+	uint64_t      start_unix_ns;  /* CLOCK_REALTIME when created */
+	uint32_t      clock;          /* clockid_t of the time stamps */
+	atomic_uint   flags;
+
+	/* Written by the sampler only, on their own cache lines */
+	_Alignas(64) atomic_ullong head;
+	_Alignas(64) atomic_ullong tail;
+	_Alignas(64) char          end[];
+} live_hdr_t;
+
+#define LIVE_COLS(h)  ((capture_col_t *)((h)->end))
+#define LIVE_DATA(h)  ((unsigned char *)(h) + live_data_offset((h)->nregs))
+
+static inline size_t
+live_data_offset(
+	uint32_t nregs)
+{
+	return (sizeof(live_hdr_t) + nregs * sizeof(capture_col_t) + 63) & ~(size_t)63;
+}
+
+/* ----------------------------------------------------------------
+ * Writer (the sampler thread)
+ * ----------------------------------------------------------------
+ */
+typedef struct {
+	live_hdr_t    *hdr;
+	size_t         size;
+	unsigned char *data;
+	uint64_t       capacity;
+	uint32_t       nregs;
+} live_t;
+
+/* The ring is built under path.tmp and renamed over path, readers of a
+ * previous ring keep their (closed) copy
+ */
+live_t *live_create(const char *path, size_t size, int nregs,
+	const capture_col_t *cols, uint32_t period_us);
+void live_close(live_t *l);
+
+static inline void
+live_add(
+	live_t         *l,
+	uint64_t        t_ns,
+	const uint64_t *values)
+{
+	live_hdr_t *h = l->hdr;
+	uint64_t seq = atomic_load_explicit(&h->head, memory_order_relaxed);
+	uint64_t *p = (uint64_t *)(l->data + (seq % l->capacity) * h->rec);
+
+	/* Retire the record in this slot before touching it */
+	if (seq >= l->capacity) {
+		atomic_store_explicit(&h->tail, seq - l->capacity + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+	}
+	p[0] = t_ns;
+	memcpy(p + 1, values, l->nregs * sizeof(uint64_t));
+	atomic_store_explicit(&h->head, seq + 1, memory_order_release);
+}
+
+/* ----------------------------------------------------------------
+ * Reader (any process)
+ * ----------------------------------------------------------------
+ */
+typedef struct {
+	live_hdr_t    *hdr;
+	size_t         size;
+	uint64_t       pos;       /* next sequence number to read */
+} live_reader_t;
+
+/* from_end: start with the next record written rather than the oldest */
+int live_open(live_reader_t *r, const char *path, int from_end);
+void live_reader_close(live_reader_t *r);
+
+/* Copies the next record (1 + nregs values) into rec. Returns 1 with a
+ * record, 0 when none is available yet, -1 when the writer closed the
+ * ring and everything was read. *lost is set to the records overwritten
+ * before they could be read (overrun), usually 0.
+ */
+int live_next(live_reader_t *r, uint64_t *rec, uint64_t *lost);
+
+#endif /* LIVERING_H */
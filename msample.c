@@ -0,0 +1,370 @@
+/* msample.c
+ *
+ * Synchronized multi-device sampling and the msample command.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "msample.h"
+#include "cancel.h"
+#include "sample.h"
+
+typedef struct {
+	device_t     *dev;
+	char          label[100];
+} msample_dev_t;
+
+/* Device 0 is always the one given on the command line */
+static msample_dev_t peers[MSAMPLE_MAX_DEVS - 1];
+static int npeers = 0;
+
+typedef struct {
+	device_t           *dev;
+	struct sampler     *set;
+	int                 big;
+	pthread_barrier_t  *go;
+	pthread_barrier_t  *done;
+	pthread_mutex_t    *gate;
+	atomic_int         *stop;
+	pthread_t           thread;
+
+	/* Last sweep: read window on the host clock, and the values */
+	unsigned long long  t0;
+	unsigned long long  t1;
+	uint64_t            value[SAMPLE_MAX_REGS];
+} msample_worker_t;
+
+static void *
+msample_thread(
+	void *arg)
+{
+	msample_worker_t *w = (msample_worker_t *)arg;
+	sample_reg_t *r;
+	int i;
+
+	/* The barriers exist once the gate opens */
+	pthread_mutex_lock(w->gate);
+	pthread_mutex_unlock(w->gate);
+	for (;;) {
+		pthread_barrier_wait(w->go);
+		if (atomic_load_explicit(w->stop, memory_order_relaxed)) {
+			break;
+		}
+		w->t0 = sample_now_ns();
+		for (i = 0; i < w->set->count; i++) {
+			r = &w->set->reg[i];
+			w->value[i] = sample_read(w->dev, r->addr, r->width, w->big);
+		}
+		w->t1 = sample_now_ns();
+		pthread_barrier_wait(w->done);
+	}
+	return NULL;
+}
+
+static void
+msample_header(
+	FILE             *fp,
+	struct sampler   *set,
+	msample_worker_t *w,
+	int               n)
+{
+	int d;
+	int i;
+
+	fprintf(fp, "# msample: %d devices, %d registers, clock CLOCK_MONOTONIC ns\n",
+		n, set->count);
+	for (d = 0; d < n; d++) {
+		fprintf(fp, "# dev%d: %s\n", d, w[d].dev->filename);
+	}
+	fprintf(fp, "sweep,t_ns,skew_ns");
+	for (d = 0; d < n; d++) {
+		fprintf(fp, ",dev%d.start_ns,dev%d.read_ns", d, d);
+		for (i = 0; i < set->count; i++) {
+			fprintf(fp, ",dev%d.%s", d, set->reg[i].name);
+		}
+	}
+	fprintf(fp, "\n");
+}
+
+static int
+msample_run(
+	device_t           *dev,
+	unsigned long long  count,
+	unsigned int        period_us,
+	const char         *filename)
+{
+	struct sampler *set = dev->sampler;
+	msample_worker_t w[MSAMPLE_MAX_DEVS];
+	pthread_barrier_t go;
+	pthread_barrier_t done;
+	pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+	atomic_int stop;
+	unsigned long long period = (unsigned long long)period_us * 1000ULL;
+	unsigned long long sweep;
+	unsigned long long start;
+	unsigned long long next;
+	unsigned long long now;
+	unsigned long long t;
+	unsigned long long lo;
+	unsigned long long hi;
+	unsigned long long skew;
+	unsigned long long skew_min = ~0ULL;
+	unsigned long long skew_max = 0;
+	double skew_sum = 0.0;
+	double release_sum = 0.0;
+	struct timespec ts;
+	FILE *fp = NULL;
+	int n = npeers + 1;
+	int started;
+	int d;
+	int i;
+
+	if ((set == NULL) || (set->count == 0)) {
+		printf("Error: no registers to sample (sample add addr [width] [name])\n");
+		return -1;
+	}
+	for (i = 0; i < set->count; i++) {
+		if (sample_is_pseudo(&set->reg[i])) {
+			printf("Error: %s is an %s, msample reads registers only\n",
+				set->reg[i].name, (set->reg[i].aer_fd >= 0) ?
+				"AER counter" : "interrupt count");
+			return -1;
+		}
+	}
+	for (d = 0; d < npeers; d++) {
+		for (i = 0; i < set->count; i++) {
+			if ((unsigned long long)set->reg[i].addr + set->reg[i].width / 8 >
+			    peers[d].dev->size) {
+				printf("Error: %s is outside the BAR of %s\n",
+					set->reg[i].name, peers[d].label);
+				return -1;
+			}
+		}
+	}
+	if (filename != NULL) {
+		fp = fopen(filename, "w");
+		if (fp == NULL) {
+			printf("Open failed for file '%s': errno %d, %s\n",
+				filename, errno, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* One thread per device plus this one, which paces the sweeps */
+	atomic_init(&stop, 0);
+	for (d = 0; d < n; d++) {
+		memset(&w[d], 0, sizeof(w[d]));
+		w[d].dev = (d == 0) ? dev : peers[d - 1].dev;
+		w[d].set = set;
+		w[d].big = big_endian;
+		w[d].go = &go;
+		w[d].done = &done;
+		w[d].gate = &gate;
+		w[d].stop = &stop;
+	}
+	pthread_mutex_lock(&gate);
+	for (started = 0; started < n; started++) {
+		if (pthread_create(&w[started].thread, NULL, msample_thread, &w[started]) != 0) {
+			break;
+		}
+	}
+	pthread_barrier_init(&go, NULL, started + 1);
+	pthread_barrier_init(&done, NULL, started + 1);
+	if (started < n) {
+		printf("Error: cannot start the sampling threads\n");
+	}
+	pthread_mutex_unlock(&gate);
+	if ((fp != NULL) && (started == n)) {
+		msample_header(fp, set, w, n);
+	}
+
+	start = next = sample_now_ns();
+	for (sweep = 0; (started == n) && ((count == 0) || (sweep < count)); sweep++) {
+		if (cancel_pending()) {
+			printf("Interrupted: msample stopped after %llu sweeps\n", sweep);
+			break;
+		}
+		if (period > 0) {
+			ts.tv_sec = next / 1000000000ULL;
+			ts.tv_nsec = next % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+		}
+		t = sample_now_ns();
+		pthread_barrier_wait(&go);
+		pthread_barrier_wait(&done);
+
+		/* Skew: spread of the read start times across devices */
+		lo = hi = w[0].t0;
+		for (d = 1; d < n; d++) {
+			lo = (w[d].t0 < lo) ? w[d].t0 : lo;
+			hi = (w[d].t0 > hi) ? w[d].t0 : hi;
+		}
+		skew = hi - lo;
+		skew_min = (skew < skew_min) ? skew : skew_min;
+		skew_max = (skew > skew_max) ? skew : skew_max;
+		skew_sum += skew;
+		release_sum += lo - t;
+
+		if (fp != NULL) {
+			fprintf(fp, "%llu,%llu,%llu", sweep, t, skew);
+			for (d = 0; d < n; d++) {
+				fprintf(fp, ",%llu,%llu", w[d].t0 - t, w[d].t1 - w[d].t0);
+				for (i = 0; i < set->count; i++) {
+					fprintf(fp, ",%.*llX", set->reg[i].width / 4,
+						(unsigned long long)w[d].value[i]);
+				}
+			}
+			fprintf(fp, "\n");
+		}
+
+		if (period > 0) {
+			next += period;
+			now = sample_now_ns();
+			if (next <= now) {
+				next += ((now - next) / period + 1) * period;
+			}
+		}
+	}
+	now = sample_now_ns();
+
+	atomic_store(&stop, 1);
+	pthread_barrier_wait(&go);
+	for (d = 0; d < started; d++) {
+		pthread_join(w[d].thread, NULL);
+	}
+	pthread_barrier_destroy(&go);
+	pthread_barrier_destroy(&done);
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	if (sweep > 0) {
+		printf("msample: %llu sweeps of %d registers on %d devices in %.3f s (%.0f/s)\n",
+			sweep, set->count, n, (now - start) / 1e9, sweep / ((now - start) / 1e9));
+		printf("  skew min %.1f avg %.1f max %.1f us, barrier release %.1f us avg\n",
+			skew_min / 1e3, skew_sum / 1e3 / sweep, skew_max / 1e3,
+			release_sum / 1e3 / sweep);
+	}
+	return 0;
+}
+
+static int
+msample_add(
+	device_t   *dev,
+	const char *where,
+	int         bar)
+{
+	msample_dev_t *p;
+
+	if (npeers == MSAMPLE_MAX_DEVS - 1) {
+		printf("Error: at most %d devices\n", MSAMPLE_MAX_DEVS);
+		return -1;
+	}
+	p = &peers[npeers];
+	p->dev = (device_t *)calloc(1, sizeof(device_t));
+	if (p->dev == NULL) {
+		return -1;
+	}
+	p->dev->bar = (bar >= 0) ? bar : dev->bar;
+
+	/* A path is a stand-in file, anything else a slot */
+	if (dev_open(p->dev, where, (strchr(where, '/') != NULL) ? where : NULL) < 0) {
+		free(p->dev);
+		return -1;
+	}
+	snprintf(p->label, sizeof(p->label), "%s", where);
+	npeers++;
+	return 0;
+}
+
+void
+msample_close(void)
+{
+	int d;
+
+	for (d = 0; d < npeers; d++) {
+		dev_close(peers[d].dev);
+		free(peers[d].dev);
+	}
+	npeers = 0;
+}
+
+int
+msample_devices(
+	device_t  *dev,
+	device_t **devs,
+	int        max)
+{
+	int n = 0;
+	int d;
+
+	if (max > 0) {
+		devs[n++] = dev;
+	}
+	for (d = 0; (d < npeers) && (n < max); d++) {
+		devs[n++] = peers[d].dev;
+	}
+	return n;
+}
+
+static void
+msample_list(
+	device_t *dev)
+{
+	int d;
+
+	printf("  dev0  %s (BAR%d, %u bytes)\n", dev->filename, dev->bar, dev->size);
+	for (d = 0; d < npeers; d++) {
+		printf("  dev%-2d %s (BAR%d, %u bytes)\n", d + 1, peers[d].label,
+			peers[d].dev->bar, peers[d].dev->size);
+	}
+}
+
+int
+msample_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	unsigned long long count = 0;
+	unsigned int period_us = SAMPLE_PERIOD_US;
+	char where[100];
+	char word[16];
+	int bar = -1;
+	int status;
+
+	/* msample, msample add slot|file [bar], msample clear,
+	 * msample run count [period_us] [file]
+	 */
+	if (sscanf(cmd, "%*s %15s", word) != 1) {
+		msample_list(dev);
+		return 0;
+	}
+	if (strcmp(word, "add") == 0) {
+		if (sscanf(cmd, "%*s %*s %99s %d", where, &bar) < 1) {
+			printf("Syntax error: msample add slot|file [bar]\n");
+			return 0;
+		}
+		msample_add(dev, where, bar);
+	} else if (strcmp(word, "clear") == 0) {
+		msample_close();
+	} else if (strcmp(word, "run") == 0) {
+		status = sscanf(cmd, "%*s %*s %llu %u %99s", &count, &period_us, where);
+		if (status < 1) {
+			printf("Syntax error: msample run count [period_us] [file]\n");
+			return 0;
+		}
+		msample_run(dev, count, period_us, (status == 3) ? where : NULL);
+	} else {
+		printf("Syntax error (use ? for help)\n");
+	}
+	return 0;
+}
@@ -0,0 +1,31 @@
+/* msample.h
+ *
+ * Synchronized multi-device sampling.
+ *
+ * "msample add" opens the same BAR on other cards (or stand-in files).
+ * "msample run" then reads the registers of the sample set on every
+ * device at once: one thread per device, all released from a shared
+ * barrier each period. Every sweep is stamped with the host monotonic
+ * clock and each device's read start is recorded against it, so the
+ * merged capture shows how far apart in time the cards were read.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef MSAMPLE_H
+#define MSAMPLE_H
+
+#include "pci_debug.h"
+
+#define MSAMPLE_MAX_DEVS  16
+
+int msample_cmd(device_t *dev, char *cmd);
+
+/* Close the devices added with msample add */
+void msample_close(void);
+
+/* This device followed by the ones added with msample add, returns the
+ * count stored in devs (at most max)
+ */
+int msample_devices(device_t *dev, device_t **devs, int max);
+
+#endif /* MSAMPLE_H */
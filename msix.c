@@ -0,0 +1,339 @@
+/* msix.c
+ *
+ * MSI-X table and pending bit array inspector.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "msix.h"
+#include "bulk.h"
+#include "cancel.h"
+#include "config.h"
+
+typedef struct {
+	int           cap;
+	uint16_t      flags;
+	int           nvec;
+	int           table_bir;
+	unsigned int  table_off;
+	int           pba_bir;
+	unsigned int  pba_off;
+	unsigned int  pba_len;      /* bytes, whole qwords */
+
+	/* The BARs holding the table and the PBA, the one in use or
+	 * mapped for the command
+	 */
+	device_t     *table_dev;
+	device_t     *pba_dev;
+	device_t      other[2];
+	int           opened[2];
+} msix_t;
+
+typedef struct {
+	unsigned long long pending;     /* samples with the bit set */
+	unsigned long long rises;
+	unsigned long long run;         /* current run of set samples */
+	unsigned long long longest;
+} msix_vec_t;
+
+static double
+now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* BAR bir of the device: the one in use, else mapped into other[i] */
+static device_t *
+msix_bar(
+	device_t *dev,
+	msix_t   *m,
+	int       bir,
+	int       i)
+{
+	char slot[32];
+
+	if (bir == (int)dev->bar) {
+		return dev;
+	}
+	if ((i == 1) && m->opened[0] && (m->other[0].bar == (unsigned int)bir)) {
+		return &m->other[0];
+	}
+	snprintf(slot, sizeof(slot), "%04x:%02x:%02x.%1x",
+		dev->domain, dev->bus, dev->slot, dev->function);
+	memset(&m->other[i], 0, sizeof(device_t));
+	m->other[i].bar = bir;
+	if (dev_open(&m->other[i], slot, NULL) < 0) {
+		return NULL;
+	}
+	m->opened[i] = 1;
+	return &m->other[i];
+}
+
+static void
+msix_close(
+	msix_t *m)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (m->opened[i]) {
+			dev_close(&m->other[i]);
+		}
+	}
+}
+
+/* Locates the capability, table and PBA; 0 when all is mapped */
+static int
+msix_open(
+	device_t *dev,
+	msix_t   *m)
+{
+	unsigned char config[CONFIG_SIZE];
+	uint32_t table;
+	uint32_t pba;
+	int n;
+
+	memset(m, 0, sizeof(msix_t));
+	if (config_dir(dev, (char *)config, sizeof(config)) < 0) {
+		printf("Error: %s has no configuration space (file stand-in)\n",
+			dev->filename);
+		return -1;
+	}
+	n = config_read(dev, config, sizeof(config));
+	if (n <= 0) {
+		return -1;
+	}
+	m->cap = config_find_cap(config, n, PCI_CAP_ID_MSIX);
+	if ((m->cap == 0) || (m->cap + PCI_MSIX_PBA + 4 > n)) {
+		printf("No MSI-X capability\n");
+		return -1;
+	}
+	memcpy(&m->flags, config + m->cap + PCI_MSIX_FLAGS, 2);
+	memcpy(&table, config + m->cap + PCI_MSIX_TABLE, 4);
+	memcpy(&pba, config + m->cap + PCI_MSIX_PBA, 4);
+	m->nvec = (m->flags & PCI_MSIX_FLAGS_QSIZE) + 1;
+	m->table_bir = table & PCI_MSIX_BIR;
+	m->table_off = table & ~PCI_MSIX_BIR;
+	m->pba_bir = pba & PCI_MSIX_BIR;
+	m->pba_off = pba & ~PCI_MSIX_BIR;
+	m->pba_len = ((m->nvec + 63) / 64) * 8;
+
+	m->table_dev = msix_bar(dev, m, m->table_bir, 0);
+	m->pba_dev = msix_bar(dev, m, m->pba_bir, 1);
+	if ((m->table_dev == NULL) || (m->pba_dev == NULL)) {
+		msix_close(m);
+		return -1;
+	}
+	if (((unsigned long long)m->table_off + m->nvec * PCI_MSIX_ENTRY_SIZE >
+	     m->table_dev->size) ||
+	    ((unsigned long long)m->pba_off + m->pba_len > m->pba_dev->size)) {
+		printf("Error: table or PBA beyond its BAR\n");
+		msix_close(m);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+msix_show(
+	msix_t *m)
+{
+	strategy_t s = STRATEGY_DEFAULT;
+	unsigned char *table;
+	uint64_t *pba;
+	uint32_t e[4];
+	uint64_t addr;
+	int masked = 0;
+	int pending = 0;
+	int unused = 0;
+	int v;
+
+	table = (unsigned char *)malloc(m->nvec * PCI_MSIX_ENTRY_SIZE);
+	pba = (uint64_t *)malloc(m->pba_len);
+	if ((table == NULL) || (pba == NULL)) {
+		printf("Error: out of memory\n");
+		free(table);
+		free(pba);
+		return;
+	}
+	/* DWORD accesses, which every MSI-X implementation must take */
+	bulk_read(m->table_dev, &s, m->table_off, table, m->nvec * PCI_MSIX_ENTRY_SIZE, NULL);
+	bulk_read(m->pba_dev, &s, m->pba_off, (unsigned char *)pba, m->pba_len, NULL);
+
+	printf("MSI-X capability at %.2X: %d vectors, %s%s\n", m->cap, m->nvec,
+		(m->flags & PCI_MSIX_FLAGS_ENABLE) ? "enabled" : "disabled",
+		(m->flags & PCI_MSIX_FLAGS_MASKALL) ? ", function masked" : "");
+	printf("  table: BAR%d + %.8X, PBA: BAR%d + %.8X\n",
+		m->table_bir, m->table_off, m->pba_bir, m->pba_off);
+	printf("   vec  address           data      state\n");
+	for (v = 0; v < m->nvec; v++) {
+		memcpy(e, table + v * PCI_MSIX_ENTRY_SIZE, sizeof(e));
+		addr = ((uint64_t)e[1] << 32) | e[0];
+		masked += (e[3] & PCI_MSIX_ENTRY_MASKED) != 0;
+		pending += (pba[v / 64] >> (v % 64)) & 1;
+
+		/* Never programmed: fold them into one count */
+		if ((addr == 0) && (e[2] == 0) && !((pba[v / 64] >> (v % 64)) & 1)) {
+			unused++;
+			continue;
+		}
+		printf("  %4d  %.16llX  %.8X  %s%s", v, (unsigned long long)addr, e[2],
+			(e[3] & PCI_MSIX_ENTRY_MASKED) ? "masked " : "       ",
+			((pba[v / 64] >> (v % 64)) & 1) ? "PENDING" : "       ");
+
+		/* x86 interrupt message: destination APIC and vector */
+		if ((addr & 0xFFF00000ULL) == 0xFEE00000ULL) {
+			printf("  apic %u vector %.2X", (unsigned int)(addr >> 12) & 0xFF,
+				e[2] & 0xFF);
+		}
+		printf("\n");
+	}
+	if (unused > 0) {
+		printf("  %d vector(s) not programmed\n", unused);
+	}
+	printf("  %d masked, %d pending\n", masked, pending);
+	free(table);
+	free(pba);
+}
+
+static void
+msix_watch(
+	msix_t        *m,
+	unsigned int   ms,
+	unsigned int   period_us)
+{
+	strategy_t s = STRATEGY_DEFAULT;
+	struct timespec ts;
+	msix_vec_t *vec;
+	uint64_t *pba;
+	uint64_t *last;
+	uint64_t bits;
+	uint64_t tail;
+	unsigned long long samples = 0;
+	double start;
+	double end;
+	double secs;
+	int words = m->pba_len / 8;
+	int flagged = 0;
+	int w;
+	int v;
+
+	vec = (msix_vec_t *)calloc(m->nvec, sizeof(msix_vec_t));
+	pba = (uint64_t *)calloc(words, 8);
+	last = (uint64_t *)calloc(words, 8);
+	if ((vec == NULL) || (pba == NULL) || (last == NULL)) {
+		printf("Error: out of memory\n");
+		free(vec);
+		free(pba);
+		free(last);
+		return;
+	}
+	ts.tv_sec = period_us / 1000000;
+	ts.tv_nsec = (period_us % 1000000) * 1000L;
+	printf("Watching the PBA of %d vectors for %u ms (Ctrl-C to stop)\n", m->nvec, ms);
+
+	/* Bits of the last qword past the last vector are reserved, and all
+	 * set when the function drops off the bus
+	 */
+	tail = (m->nvec % 64) ? (1ULL << (m->nvec % 64)) - 1 : ~0ULL;
+
+	/* Bits already set count as pending, not as rising */
+	bulk_read(m->pba_dev, &s, m->pba_off, (unsigned char *)last, m->pba_len, NULL);
+	last[words - 1] &= tail;
+	start = now_s();
+	end = start + ms / 1e3;
+	do {
+		bulk_read(m->pba_dev, &s, m->pba_off, (unsigned char *)pba, m->pba_len, NULL);
+		pba[words - 1] &= tail;
+		samples++;
+		for (w = 0; w < words; w++) {
+			/* Pending now */
+			for (bits = pba[w]; bits != 0; bits &= bits - 1) {
+				v = w * 64 + __builtin_ctzll(bits);
+				vec[v].pending++;
+				vec[v].run++;
+			}
+			/* Just risen */
+			for (bits = pba[w] & ~last[w]; bits != 0; bits &= bits - 1) {
+				vec[w * 64 + __builtin_ctzll(bits)].rises++;
+			}
+			/* Just cleared */
+			for (bits = last[w] & ~pba[w]; bits != 0; bits &= bits - 1) {
+				v = w * 64 + __builtin_ctzll(bits);
+				if (vec[v].run > vec[v].longest) {
+					vec[v].longest = vec[v].run;
+				}
+				vec[v].run = 0;
+			}
+			last[w] = pba[w];
+		}
+		if (period_us > 0) {
+			nanosleep(&ts, NULL);
+		}
+	} while ((now_s() < end) && !cancel_pending());
+	secs = now_s() - start;
+
+	printf("%llu samples in %.3f s (%.2f us each)\n", samples, secs,
+		secs * 1e6 / samples);
+	printf("  vec  pending%%      rises   rises/s   longest ms\n");
+	for (v = 0; v < m->nvec; v++) {
+		if (vec[v].run > vec[v].longest) {
+			vec[v].longest = vec[v].run;
+		}
+		if (vec[v].pending == 0) {
+			continue;
+		}
+		printf("  %4d  %7.1f%%  %9llu  %8.0f  %11.3f", v,
+			100.0 * vec[v].pending / samples, vec[v].rises,
+			vec[v].rises / secs, vec[v].longest * secs * 1e3 / samples);
+		if ((vec[v].pending == samples) && (secs * 1e3 >= MSIX_STUCK_MS)) {
+			printf("  - STUCK");
+		} else if (vec[v].rises / secs >= MSIX_STORM_HZ) {
+			printf("  - STORM");
+		}
+		printf("\n");
+		flagged++;
+	}
+	if (flagged == 0) {
+		printf("  no pending bit seen\n");
+	}
+	free(vec);
+	free(pba);
+	free(last);
+}
+
+int
+msix_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	unsigned int ms = MSIX_WATCH_MS;
+	unsigned int period_us = 0;
+	char word[16];
+	msix_t m;
+
+	/* msix, msix watch [ms [period_us]] */
+	if ((sscanf(cmd, "%*s %15s", word) == 1) && (strcmp(word, "watch") != 0)) {
+		printf("Syntax error: msix [watch [ms [period_us]]]\n");
+		return 0;
+	}
+	if (msix_open(dev, &m) < 0) {
+		return 0;
+	}
+	if (sscanf(cmd, "%*s %15s", word) == 1) {
+		sscanf(cmd, "%*s %*s %u %u", &ms, &period_us);
+		msix_watch(&m, (ms > 0) ? ms : 1, period_us);
+	} else {
+		msix_show(&m);
+	}
+	msix_close(&m);
+	return 0;
+}
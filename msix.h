@@ -0,0 +1,48 @@
+/* msix.h
+ *
+ * MSI-X table and pending bit array inspector.
+ *
+ * "msix" finds the MSI-X capability in the configuration space, reads
+ * the table and the PBA from the BAR(s) it points at (whichever BAR is
+ * in use, others are mapped for the occasion) with one bulk read each,
+ * and decodes every vector: address, data, mask and pending bits.
+ * "msix watch" reads the PBA back to back (or every period_us) and
+ * counts, per vector, how often its pending bit is seen set, how often
+ * it rises and its longest run. A bit that never clears is a vector
+ * stuck masked with its event still asserted, one rising thousands of
+ * times a second a storm (bits only latch while a vector is masked, or
+ * for the moment before delivery).
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef MSIX_H
+#define MSIX_H
+
+#include "pci_debug.h"
+
+/* Offsets in the MSI-X capability */
+#define PCI_MSIX_FLAGS          0x02
+#define PCI_MSIX_TABLE          0x04
+#define PCI_MSIX_PBA            0x08
+
+#define PCI_MSIX_FLAGS_QSIZE    0x07FF
+#define PCI_MSIX_FLAGS_MASKALL  0x4000
+#define PCI_MSIX_FLAGS_ENABLE   0x8000
+#define PCI_MSIX_BIR            0x7
+
+/* Table entry */
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_ENTRY_CTRL     12
+#define PCI_MSIX_ENTRY_MASKED   0x1
+
+#define MSIX_WATCH_MS           1000
+
+/* Flags of msix watch: pending all along for at least this long, or
+ * rising at least this often
+ */
+#define MSIX_STUCK_MS           100
+#define MSIX_STORM_HZ           10000
+
+int msix_cmd(device_t *dev, char *cmd);
+
+#endif /* MSIX_H */
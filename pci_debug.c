@@ -34,47 +34,39 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <byteswap.h>
 
 /* Readline support */
 #include <readline/readline.h>
 #include <readline/history.h>
 
+#include "pci_debug.h"
+#include "accprof.h"
+#include "apply.h"
+#include "bulk.h"
+#include "cancel.h"
+#include "capture.h"
+#include "coalesce.h"
+#include "fleet.h"
+#include "irq.h"
+#include "latmap.h"
+#include "link.h"
+#include "msample.h"
+#include "msix.h"
+#include "progress.h"
+#include "scriptopt.h"
+#include "scriptprof.h"
+#include "sample.h"
+#include "sriov.h"
+#include "swab.h"
+#include "tune.h"
+
 int quit = 0;
 int verbosity = 3;
 
-/* PCI device */
-typedef struct {
-	/* Base address region */
-	unsigned int bar;
-
-	/* Slot info */
-	unsigned int domain;
-	unsigned int bus;
-	unsigned int slot;
-	unsigned int function;
-
-	/* Resource filename */
-	char         filename[100];
-
-	/* File descriptor of the resource */
-	int          fd;
-
-	/* Memory mapped resource */
-	unsigned char *maddr;
-	unsigned int   size;
-	unsigned int   offset;
-
-	/* PCI physical address */
-	unsigned int   phys;
-
-	/* Address to pass to read/write (includes offset) */
-	unsigned char *addr;
-} device_t;
-
 void display_help(device_t *dev);
 void parse_command(device_t *dev, char* cmdFilePath);
-int process_command(device_t *dev, char *cmd);
 int change_mem(device_t *dev, char *cmd);
 void useCmdFile(device_t *dev, char* cmdFilePath);
 int fill_mem(device_t *dev, char *cmd);
@@ -82,7 +74,62 @@ int display_mem(device_t *dev, char *cmd);
 int change_endian(device_t *dev, char *cmd);
 
 /* Endian read/write mode */
-static int big_endian = 0;
+int big_endian = 0;
+
+/* Commands longer than one letter, matched on the first word */
+typedef struct {
+	const char *name;
+	int (*handler)(device_t *dev, char *cmd);
+} command_t;
+
+static const command_t commands[] = {
+	{ "apply",    apply_cmd },
+	{ "capture",  capture_cmd },
+	{ "coalesce", coalesce_cmd },
+	{ "fleet-cfg", fleet_cmd },
+	{ "hist",     hist_cmd },
+	{ "latmap",   latmap_cmd },
+	{ "link",     link_cmd },
+	{ "msample",  msample_cmd },
+	{ "msix",     msix_cmd },
+	{ "on",       on_cmd },
+	{ "prof",     accprof_cmd },
+	{ "sample",   sample_cmd },
+	{ "tune",     tune_mem },
+	{ "vf",       sriov_cmd },
+	{ "waitirq",  waitirq_cmd },
+	{ NULL,       NULL }
+};
+
+/* Bulk dumps are read and formatted this many bytes at a time */
+#define BULK_WINDOW  (4*1024*1024)
+
+/* d/f of at least this size are buffered through the bulk engine */
+#define BUFFERED_MIN_BYTES  (64*1024)
+
+/* Constant fills of at least this size use the memset-style kernel */
+#define FASTFILL_MIN_BYTES  (64*1024)
+
+/* --profile: per-line profile of the command file, annotated copy
+ * written to script_profile_out (default: the file name + .prof)
+ */
+static int   script_profile = 0;
+static char *script_profile_out = NULL;
+
+/* --optimize: merge and elide the writes of the commands file that fall
+ * in coalesced ranges
+ */
+static int   script_optimize = 0;
+
+/* Long options, mapped to codes outside the short option range */
+#define OPT_PROFILE   256
+#define OPT_OPTIMIZE  257
+
+static const struct option long_options[] = {
+	{ "profile",  optional_argument, NULL, OPT_PROFILE },
+	{ "optimize", no_argument,       NULL, OPT_OPTIMIZE },
+	{ NULL,       0,                 NULL, 0 }
+};
 
 /* Low-level access functions */
 static void
@@ -149,7 +196,15 @@ static void show_usage()
 	 	 "  -b <BAR>      Base address region (BAR) to access, eg. 0 for BAR0\n" \
 		 "  -q            Quit after send a command file\n" \
 		 "  -v <level>    Verbosity (0 to 3 - Default is 3)\n" \
-	 	 "  -f <file> 	  Use commands file to play before display prompt\n\n");
+	 	 "  -f <file> 	  Use commands file to play before display prompt\n" \
+		 "  -r <file>     Use a plain file as the BAR (stand-in for resourceN)\n" \
+		 "  -i <source>   Interrupt source: uio, vfio or mock[:ms]\n" \
+		 "                (default: uio, mock with -r; vfio resets the function)\n" \
+		 "  -a            Profile MMIO accesses per register, report at exit\n" \
+		 "  --profile[=<file>]  Time each line of the commands file, annotated\n" \
+		 "                copy in <file> (default: the commands file + .prof)\n" \
+		 "  --optimize    Merge the writes of the commands file that fall in\n" \
+		 "                coalesced ranges, drop the overwritten ones\n\n");
 }
 
 int main(int argc, char *argv[])
@@ -157,16 +212,26 @@ int main(int argc, char *argv[])
 	int opt;		
 	char *slot = NULL;	
 	char *cmdFilePath = NULL;
-	int status;
-	struct stat statbuf;
+	char *resource = NULL;
 	device_t device;
 	device_t *dev = &device;
+	int profile = 0;
 
 	/* Clear the structure fields */
 	memset(dev, 0, sizeof(device_t));
 
-	while ((opt = getopt(argc, argv, "b:hs:f:qv:")) != -1) {
+	while ((opt = getopt_long(argc, argv, "ab:hi:s:f:qv:r:", long_options, NULL)) != -1) {
 		switch (opt) {
+			case OPT_PROFILE:
+				script_profile = 1;
+				script_profile_out = optarg;
+				break;
+			case OPT_OPTIMIZE:
+				script_optimize = 1;
+				break;
+			case 'a':
+				profile = 1;
+				break;
 			case 'b':
 				/* Defaults to BAR0 if not provided */
 				dev->bar = atoi(optarg);
@@ -186,33 +251,130 @@ int main(int argc, char *argv[])
 			case 'f':
 				cmdFilePath = optarg;
 				break;
+			case 'r':
+				resource = optarg;
+				break;
+			case 'i':
+				dev->irq_spec = optarg;
+				break;
 			default:
 				show_usage();
 				return -1;
 		}
 	}
-	if (slot == 0) {
+	if ((slot == 0) && (resource == NULL)) {
 		show_usage();
 		return -1;
 	}
+	if (script_profile && (cmdFilePath == NULL)) {
+		printf("Error: --profile needs a commands file (-f)\n");
+		return -1;
+	}
+	if (script_optimize && (cmdFilePath == NULL)) {
+		printf("Error: --optimize needs a commands file (-f)\n");
+		return -1;
+	}
 
 	/* ------------------------------------------------------------
 	 * Open and map the PCI region
 	 * ------------------------------------------------------------
 	 */
 
-	/* Extract the PCI parameters from the slot string */
-	status = sscanf(slot, "%2x:%2x.%1x",
-			&dev->bus, &dev->slot, &dev->function);
-	if (status != 3) {
-		printf("Error parsing slot information!\n");
-		show_usage();
+	if ((resource != NULL) && (dev->irq_spec == NULL)) {
+		/* No interrupt line other than the mock one */
+		dev->irq_spec = "mock";
+	}
+	if (dev_open(dev, slot, resource) < 0) {
 		return -1;
 	}
 
-	/* Convert to a sysfs resource filename and open the resource */
-	snprintf(dev->filename, 99, "/sys/bus/pci/devices/%04x:%02x:%02x.%1x/resource%d",
-			dev->domain, dev->bus, dev->slot, dev->function, dev->bar);
+
+	/* ------------------------------------------------------------
+	 * Tests
+	 * ------------------------------------------------------------
+	 */
+	if (verbosity >= 3)
+	{
+		printf("\n");
+		printf("PCI debug\n");
+		printf("---------\n\n");
+		printf(" - accessing BAR%d\n", dev->bar);
+		printf(" - region size is %d-bytes\n", dev->size);
+		printf(" - offset into region is %d-bytes\n", dev->offset);
+		if (dev->wc_addr != NULL) {
+			printf(" - write-combining mapping available\n");
+		}
+		if (dev->profile != NULL) {
+			printf(" - tuned access profile loaded\n");
+		}
+
+		/* Display help */
+		display_help(dev);
+	}
+
+	verbosity==1?printf("\nAccessing BAR%d\n", dev->bar):0;
+
+	/* Ctrl-C cancels the running command rather than the tool */
+	cancel_init();
+
+	if (profile) {
+		accprof_start(dev);
+	}
+
+	/* Process commands */
+	parse_command(dev, cmdFilePath);
+	if (profile) {
+		accprof_report(dev, ACCPROF_TOP, stdout);
+	}
+
+	/* Cleanly shutdown */
+	sample_stop(dev);
+	msample_close();
+	irq_close(dev);
+	dev_close(dev);
+	return 0;
+}
+
+/*--------------------------------------------------------------------
+ * Device open/close
+ *--------------------------------------------------------------------
+ */
+
+/* Open and map BAR dev->bar of the device in slot ([domain:]bus:dev.fn),
+ * or of the plain file resource standing in for it
+ */
+int
+dev_open(
+	device_t   *dev,
+	const char *slot,
+	const char *resource)
+{
+	char configname[100];
+	struct stat statbuf;
+	int status;
+	int fd;
+
+	if (resource != NULL) {
+		/* File-backed stand-in: no slot, no config space */
+		snprintf(dev->filename, 99, "%s", resource);
+	} else {
+		/* Extract the PCI parameters from the slot string */
+		status = sscanf(slot, "%4x:%2x:%2x.%1x",
+				&dev->domain, &dev->bus, &dev->slot, &dev->function);
+		if (status != 4) {
+			dev->domain = 0;
+			status = sscanf(slot, "%2x:%2x.%1x",
+					&dev->bus, &dev->slot, &dev->function);
+		}
+		if ((status != 3) && (status != 4)) {
+			printf("Error parsing slot information!\n");
+			return -1;
+		}
+
+		/* Convert to a sysfs resource filename and open the resource */
+		snprintf(dev->filename, 99, "/sys/bus/pci/devices/%04x:%02x:%02x.%1x/resource%d",
+				dev->domain, dev->bus, dev->slot, dev->function, dev->bar);
+	}
 	dev->fd = open(dev->filename, O_RDWR | O_SYNC);
 	if (dev->fd < 0) {
 		printf("Open failed for file '%s': errno %d, %s\n",
@@ -225,6 +387,7 @@ int main(int argc, char *argv[])
 	if (status < 0) {
 		printf("fstat() failed: errno %d, %s\n",
 			errno, strerror(errno));
+		close(dev->fd);
 		return -1;
 	}
 	dev->size = statbuf.st_size;
@@ -249,63 +412,113 @@ int main(int argc, char *argv[])
 	 * relative to the mapped base address. The offset is
 	 * the physical address modulo 4k
 	 */
-	{
-		char configname[100];
-		int fd;
+	if (resource == NULL) {
 
 		snprintf(configname, 99, "/sys/bus/pci/devices/%04x:%02x:%02x.%1x/config",
 				dev->domain, dev->bus, dev->slot, dev->function);
 		fd = open(configname, O_RDWR | O_SYNC);
-		if (dev->fd < 0) {
+		if (fd < 0) {
 			printf("Open failed for file '%s': errno %d, %s\n",
 				configname, errno, strerror(errno));
-			return -1;
+			goto fail;
 		}
 
 		status = lseek(fd, 0x10 + 4*dev->bar, SEEK_SET);
 		if (status < 0) {
 			printf("Error: configuration space lseek failed\n");
 			close(fd);
-			return -1;
+			goto fail;
 		}
 		status = read(fd, &dev->phys, 4);
 		if (status < 0) {
 			printf("Error: configuration space read failed\n");
 			close(fd);
-			return -1;
+			goto fail;
 		}
 		dev->offset = ((dev->phys & 0xFFFFFFF0) % 0x1000);
 		dev->addr = dev->maddr + dev->offset;
+
+		/* Vendor and device IDs key the tuned access profiles */
+		status = pread(fd, &dev->vendor, 2, 0x00);
+		if (status == 2) {
+			status = pread(fd, &dev->device, 2, 0x02);
+		}
+		if (status != 2) {
+			printf("Error: configuration space read failed\n");
+			close(fd);
+			goto fail;
+		}
 		close(fd);
+	} else {
+		dev->addr = dev->maddr;
 	}
 
+	/* Write-combining mapping and tuned strategies, when available */
+	dev->wc_fd = -1;
+	dev_map_wc(dev);
+	profile_load(dev);
+	latmap_load(dev);
+	return 0;
 
-	/* ------------------------------------------------------------
-	 * Tests
-	 * ------------------------------------------------------------
-	 */
-	if (verbosity >= 3)
-	{
-		printf("\n");
-		printf("PCI debug\n");
-		printf("---------\n\n");
-		printf(" - accessing BAR%d\n", dev->bar);
-		printf(" - region size is %d-bytes\n", dev->size);
-		printf(" - offset into region is %d-bytes\n", dev->offset);
+fail:
+	munmap(dev->maddr, dev->size);
+	dev->maddr = 0;
+	close(dev->fd);
+	dev->fd = -1;
+	return -1;
+}
 
-		/* Display help */
-		display_help(dev);
-	}
+void
+dev_close(
+	device_t *dev)
+{
+	dev_unmap_wc(dev);
+	munmap(dev->maddr, dev->size);
+	close(dev->fd);
+	free(dev->profile);
+	free(dev->latmap);
+	free(dev->coalesce);
+	dev->profile = NULL;
+	dev->latmap = NULL;
+	dev->coalesce = NULL;
+}
 
-	verbosity==1?printf("\nAccessing BAR%d\n", dev->bar):0;
+/* "on irq { ... }" blocks may span several lines, a line with an
+ * unclosed '{' continues on the next ones
+ */
+static int
+block_open(
+	const char *s)
+{
+	int depth = 0;
 
-	/* Process commands */
-	parse_command(dev, cmdFilePath);
+	for (; *s != '\0'; s++) {
+		if (*s == '{') {
+			depth++;
+		} else if (*s == '}') {
+			depth--;
+		}
+	}
+	return depth > 0;
+}
 
-	/* Cleanly shutdown */
-	munmap(dev->maddr, dev->size);
-	close(dev->fd);
-	return 0;
+static char *
+block_append(
+	char       *block,
+	const char *line)
+{
+	size_t n = strlen(block);
+	char *s;
+
+	s = (char *)realloc(block, n + strlen(line) + 2);
+	if (s == NULL) {
+		return block;
+	}
+	if ((n > 0) && (s[n-1] != '\n')) {
+		s[n++] = '\n';
+	}
+	strcpy(s + n, line);
+	return s;
 }
 
 void useCmdFile(device_t *dev, char* cmdFilePath)
@@ -318,6 +531,12 @@ void useCmdFile(device_t *dev, char* cmdFilePath)
     int firstLine = 1; 
     int bar = -1;
     ssize_t read;
+    int lineno;
+    int cmdline;
+    char * block;
+    char * out = NULL;
+    scriptprof_t prof;
+    scriptopt_t *opt = NULL;
 
 	verbosity>=3?printf("Exectue a commands file\n"):0;
     
@@ -328,7 +547,21 @@ void useCmdFile(device_t *dev, char* cmdFilePath)
 		exit(EXIT_FAILURE);
     }
 
+    lineno = 0;
+    if (script_profile) {
+	scriptprof_start(&prof, dev);
+    }
+    if (script_optimize) {
+	opt = (scriptopt_t *)malloc(sizeof(scriptopt_t));
+	if (opt == NULL) {
+		printf("Error: out of memory, commands file run unoptimized\n");
+	} else {
+		scriptopt_start(opt);
+	}
+    }
+    cancel_begin();
     while ((read = getline(&line, &len, fp)) != -1) {
+	lineno++;
 	len = strlen(line);
 	if(len > 1) 
 	{        
@@ -344,18 +577,65 @@ void useCmdFile(device_t *dev, char* cmdFilePath)
 			firstLine = 0;
 		}else{
 			verbosity>=2?printf("Send: %s", line, len):0;
-			status = process_command(dev, line);
+			cmdline = lineno;
+			if (opt != NULL) {
+				/* Held writes go out before anything else runs */
+				if (scriptopt_line(opt, dev, line)) {
+					if (script_profile) {
+						scriptprof_mark(&prof, dev, cmdline);
+					}
+					continue;
+				}
+				scriptopt_flush(opt, dev);
+			}
+			block = NULL;
+			if (block_open(line)) {
+				block = strdup(line);
+				while (block_open(block) &&
+				       ((read = getline(&line, &len, fp)) != -1)) {
+					lineno++;
+					block = block_append(block, line);
+				}
+			}
+			status = process_command(dev, (block != NULL) ? block : line);
+			if (script_profile) {
+				scriptprof_mark(&prof, dev, cmdline);
+			}
 			if (status < 0) {
-				printf("Warning: Command failure - %s", line);
+				printf("Warning: Command failure - %s", (block != NULL) ? block : line);
+			}
+			free(block);
+			if (cancel_pending()) {
+				printf("Interrupted: commands file stopped at line %d\n", lineno);
+				break;
 			}
 		}
 		
 	}
     }
 
+    if (opt != NULL) {
+	scriptopt_flush(opt, dev);
+	scriptopt_report(opt, dev);
+	free(opt);
+    }
+    cancel_end();
     fclose(fp);
     if (line)
         free(line);
+
+    if (script_profile) {
+	if (script_profile_out == NULL) {
+		out = (char *)malloc(strlen(cmdFilePath) + 6);
+		if (out != NULL) {
+			sprintf(out, "%s.prof", cmdFilePath);
+		}
+	}
+	scriptprof_report(&prof, cmdFilePath,
+		(script_profile_out != NULL) ? script_profile_out : out);
+	scriptprof_free(&prof);
+	free(out);
+    }
 }
 
 
@@ -365,6 +645,7 @@ parse_command(
 	device_t *dev, char* cmdFilePath)
 {
 	char *line;
+	char *more;
 	int len;
 	int status;
 	if (cmdFilePath != NULL)
@@ -374,19 +655,32 @@ parse_command(
 
 	while(1) {
 		line = readline("PCI> ");
-		/* Ctrl-D check */
+		/* Ctrl-D check: end of input, quit */
 		if (line == NULL) {
 			printf("\n");
-			continue;
+			break;
 		}
 		/* Empty line check */
 		len = strlen(line);
 		if (len == 0) {
+			free(line);
 			continue;
 		}
-		/* Process the line */
+		/* Collect the rest of an open block */
+		while (block_open(line)) {
+			more = readline("...> ");
+			if (more == NULL) {
+				break;
+			}
+			line = block_append(line, more);
+			free(more);
+		}
+		/* Process the line, Ctrl-C only cancels this command */
+		cancel_begin();
 		status = process_command(dev, line);
+		cancel_end();
 		if (status < 0) {
+			free(line);
 			break;
 		}
 
@@ -423,6 +717,76 @@ display_help(
 	printf("                              val  - start value\n");
 	printf("                              len  - length (in bytes)\n");
 	printf("                              inc  - increment (defaults to 1)\n");
+	printf("  coalesce [addr len [width]] Serve d8/d16/d32 in a plain memory range\n");
+	printf("                              with wide reads (width 32, 64 (default)\n");
+	printf("                              or 128), \"coalesce off\" to disable\n");
+	printf("  tune addr len              Benchmark access strategies on a window\n");
+	printf("                              and save the best for large d/f\n");
+	printf("  waitirq [ms]               Sleep until the device interrupts (or\n");
+	printf("                              timeout, decimal ms), print the latency\n");
+	printf("  on irq [count] { cmds }    Run cmds (';' or line separated) on each\n");
+	printf("                              interrupt, count times or until Ctrl-C\n");
+	printf("  sample add addr [width] [name]  Add a register (width 8, 16, 32\n");
+	printf("                              (default) or 64) to the sampled set\n");
+	printf("  sample start [period_us [file]]  Sample the set in the background\n");
+	printf("                              (default 1000 us, 0: back to back),\n");
+	printf("                              appending to a columnar capture file\n");
+	printf("  sample [stop|clear]        Show, stop or empty the sampler\n");
+	printf("  sample ram size[K|M|G] [4k]  Also keep sweeps in a hugepage-backed\n");
+	printf("                              RAM ring (4k: plain pages), \"off\" frees it\n");
+	printf("  sample save file           Write the RAM ring as a columnar capture\n");
+	printf("  sample live file size[K|M|G]  Also write sweeps to a mmap'ed ring file\n");
+	printf("                              that pci_debug_tail can follow live,\n");
+	printf("                              \"off\" to stop\n");
+	printf("  sample aer [all]           Add the sysfs AER error counters (totals,\n");
+	printf("                              all: each error type) of this and the\n");
+	printf("                              msample cards, sampled as new errors\n");
+	printf("                              per sweep\n");
+	printf("  sample irq [all]           Add the /proc/interrupts counts of the\n");
+	printf("                              MSI/MSI-X vectors of this (all: and the\n");
+	printf("                              msample) cards, sampled per sweep\n");
+	printf("  hist [reset|file]          Dump (or zero) the value histograms of\n");
+	printf("                              the sampled registers, at any time\n");
+	printf("  capture info file          Show the schema of a capture file\n");
+	printf("  capture query file reg [csv]  Stats (and t_ns,value CSV) of one\n");
+	printf("                              register, reading only its column\n");
+	printf("  msample add slot|file [bar]  Sample another card along with this one\n");
+	printf("  msample run count [period_us] [file]  Read the sample set on all cards\n");
+	printf("                              at once each period (count 0: until\n");
+	printf("                              Ctrl-C), merged capture with skew\n");
+	printf("  msample [clear]            List or drop the other cards\n");
+	printf("  link                       Decode the PCIe link of this and the\n");
+	printf("                              msample cards, flag degraded links\n");
+	printf("  link watch [period_ms [count]]  Poll Link Status for flaps\n");
+	printf("                              (default 100 ms, until Ctrl-C)\n");
+	printf("  link bw addr len [w]       Time a dump (w: and a rewrite) of the\n");
+	printf("                              window against the link bandwidth\n");
+	printf("                              (w: coalesce ranges only)\n");
+	printf("  latmap addr len stride [samples [csv]]  Time the reads at each\n");
+	printf("                              stride (default 8 samples), heat map\n");
+	printf("                              and slow ranges, saved for d/f (do not\n");
+	printf("                              scan FIFOs or read-to-clear registers)\n");
+	printf("  latmap [clear]             Show or forget the slow ranges\n");
+	printf("  fleet-cfg [vendor[:device]]  Snapshot the config space of all\n");
+	printf("                              functions with this card's (or these)\n");
+	printf("                              IDs at once, diff the odd ones out\n");
+	printf("  prof [on|off|reset]        Count MMIO accesses and their time per\n");
+	printf("                              register (-a: from the start, report\n");
+	printf("                              at exit)\n");
+	printf("  prof [N|file]              Top N (default 20) registers by time,\n");
+	printf("                              caching and coalescing hints\n");
+	printf("  apply [-n] file [all]      Write only the registers that differ\n");
+	printf("                              from the state file (c lines, optional\n");
+	printf("                              mask), report the changes (-n: report\n");
+	printf("                              only, all: also the msample cards)\n");
+	printf("  msix                       Decode the MSI-X table and pending bits\n");
+	printf("  msix watch [ms [period_us]]  Sample the PBA (default 1000 ms, back\n");
+	printf("                              to back), flag stuck or storming vectors\n");
+	printf("  vf                         List the SR-IOV VFs of this device\n");
+	printf("  vf [-b bar] cmd[; cmd...]  Run d/c commands on the BAR (default:\n");
+	printf("                              this one) of every VF, in parallel,\n");
+	printf("                              VFs reading the same values grouped\n");
+	printf("  vf script file             Same with the d/c lines of a file\n");
 	printf("  q                          Quit\n");
 	printf("\n  Notes:\n");
 	printf("    1. addr, len, and val are interpreted as hex values\n");
@@ -432,9 +796,19 @@ display_help(
 
 int process_command(device_t *dev, char *cmd)
 {
+	const command_t *c;
+	size_t n;
+
 	if (cmd[0] == '\0') {
 		return 0;
 	}
+	/* Named commands first, then the single letter ones */
+	n = strcspn(cmd, " \t\r\n");
+	for (c = commands; c->name != NULL; c++) {
+		if ((strlen(c->name) == n) && (strncmp(cmd, c->name, n) == 0)) {
+			return c->handler(dev, cmd);
+		}
+	}
 	switch (cmd[0]) {
 		case '?':
 			display_help(dev);
@@ -460,6 +834,151 @@ int process_command(device_t *dev, char *cmd)
 	return 0;
 }
 
+/* End of the chunk starting at base, bulk loops account progress
+ * and check for cancellation once per chunk rather than per element.
+ */
+static inline int
+chunk_end(
+	int base,
+	int len,
+	int chunk)
+{
+	return (len - base > chunk) ? base + chunk : len;
+}
+
+/* Large, element aligned d/f go through the bulk engine even when
+ * nothing was tuned
+ */
+static int
+buffered_ok(
+	int width,
+	int addr,
+	int len)
+{
+	if ((width != 8) && (width != 16) && (width != 32)) {
+		return 0;
+	}
+	return (len >= BUFFERED_MIN_BYTES) && ((addr % (width / 8)) == 0);
+}
+
+/* One access of the element width per element, in address order,
+ * exactly like the read_xx/write_xx loops
+ */
+static const strategy_t *
+exact_strategy(
+	strategy_t *s,
+	int         width)
+{
+	s->width = width;
+	s->map = MAP_UC;
+	s->threads = 1;
+	s->chunk = PROGRESS_CHUNK;
+	s->fence = FENCE_CHUNK;
+	return s;
+}
+
+/* Display len bytes of buf (read from addr, already converted to host
+ * order) as d[width] does
+ */
+static void
+print_mem(
+	int                  width,
+	int                  addr,
+	int                  base,
+	const unsigned char *buf,
+	int                  len)
+{
+	unsigned short d16;
+	unsigned int d32;
+	int i;
+
+	switch (width) {
+		case 8:
+			for (i = 0; i < len; i++) {
+				if (((base+i)%16) == 0) {
+					printf("\n%.8X: ", addr+base+i);
+				}
+				printf("%.2X ", buf[i]);
+			}
+			break;
+		case 16:
+			for (i = 0; i + 2 <= len; i+=2) {
+				if (((base+i)%16) == 0) {
+					printf("\n%.8X: ", addr+base+i);
+				}
+				memcpy(&d16, buf+i, 2);
+				printf("%.4X ", d16);
+			}
+			break;
+		case 32:
+			for (i = 0; i + 4 <= len; i+=4) {
+				if (((base+i)%16) == 0) {
+					printf("\n%.8X: ", addr+base+i);
+				}
+				memcpy(&d32, buf+i, 4);
+				printf("%.8X ", d32);
+			}
+			break;
+	}
+}
+
+/* Dump through the bulk engine: read a window at a time with the
+ * given strategy, then format it from host memory. With overlap (plain
+ * memory or a tuned window) the slow latmap ranges are read from
+ * several threads.
+ */
+static int
+display_bulk(
+	device_t         *dev,
+	const strategy_t *strategy,
+	int               overlap,
+	int               width,
+	int               addr,
+	int               len)
+{
+	unsigned char *buf;
+	progress_t prog;
+	unsigned int got;
+	int base;
+	int n;
+
+	buf = (unsigned char *)malloc(BULK_WINDOW);
+	if (buf == NULL) {
+		printf("Error: cannot allocate dump buffer\n");
+		return 0;
+	}
+	progress_start_quiet(&prog, "dump", len);
+	for (base = 0; base < len; base += n) {
+		n = chunk_end(base, len, BULK_WINDOW) - base;
+		if (overlap) {
+			got = latmap_read(dev, strategy, addr+base, buf, n, &prog);
+		} else {
+			got = bulk_read(dev, strategy, addr+base, buf, n, &prog);
+		}
+		/* Same conversions as read_le/read_be, a chunk at a time */
+		if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+			if (width == 16) {
+				swab16_buf(buf, got);
+			} else if (width == 32) {
+				swab32_buf(buf, got);
+			}
+		}
+		print_mem(width, addr, base, buf, got);
+		if ((int)got < n) {
+			break;
+		}
+	}
+	printf("\n");
+	if (cancel_pending()) {
+		progress_abort(&prog);
+	} else {
+		progress_finish(&prog);
+	}
+	free(buf);
+	printf("\n");
+	return 0;
+}
+
 int display_mem(device_t *dev, char *cmd)
 {
 	int width = 32;
@@ -470,6 +989,12 @@ int display_mem(device_t *dev, char *cmd)
 	unsigned char d8;
 	unsigned short d16;
 	unsigned int d32;
+	int base;
+	int end;
+	progress_t prog;
+	const strategy_t *strategy;
+	strategy_t coalesced;
+	strategy_t exact;
 
 	/* d, d8, d16, d32 */
 	if (cmd[1] == ' ') {
@@ -494,44 +1019,74 @@ int display_mem(device_t *dev, char *cmd)
 	/* Length is in bytes */
 	if ((addr + len) > dev->size) {
 		/* Truncate */
-		len = dev->size;
+		len = dev->size - addr;
+	}
+	latmap_warn(dev, addr, len, width, 0);
+	/* Plain memory ranges marked for coalescing: fewer, wider reads */
+	if (((width == 8) || (width == 16) || (width == 32)) &&
+	    coalesce_lookup(dev, addr, len, &coalesced)) {
+		return display_bulk(dev, &coalesced, 1, width, addr, len);
+	}
+	/* Large dumps inside a tuned window use the tuned strategy, other
+	 * large aligned dumps the same accesses as below but buffered, so
+	 * that big-endian conversion is done a chunk at a time
+	 */
+	strategy = profile_lookup(dev, PROFILE_READ, addr, len);
+	if ((strategy == NULL) && buffered_ok(width, addr, len)) {
+		strategy = exact_strategy(&exact, width);
 	}
+	if ((strategy != NULL) && ((width == 8) || (width == 16) || (width == 32))) {
+		return display_bulk(dev, strategy, strategy != &exact, width, addr, len);
+	}
+	progress_start_quiet(&prog, "dump", len);
 	switch (width) {
 		case 8:
-			for (i = 0; i < len; i++) {
-				if ((i%16) == 0) {
-					printf("\n%.8X: ", addr+i);
+			for (base = 0; (base < len) && !cancel_pending(); base += PROGRESS_CHUNK) {
+				end = chunk_end(base, len, PROGRESS_CHUNK);
+				for (i = base; i < end; i++) {
+					if ((i%16) == 0) {
+						printf("\n%.8X: ", addr+i);
+					}
+					d8 = read_8(dev, addr+i);
+					printf("%.2X ", d8);
 				}
-				d8 = read_8(dev, addr+i);
-				printf("%.2X ", d8);
+				progress_add(&prog, end - base);
 			}
 			printf("\n");
 			break;
 		case 16:
-			for (i = 0; i < len; i+=2) {
-				if ((i%16) == 0) {
-					printf("\n%.8X: ", addr+i);
+			for (base = 0; (base < len) && !cancel_pending(); base += PROGRESS_CHUNK) {
+				end = chunk_end(base, len, PROGRESS_CHUNK);
+				for (i = base; i < end; i+=2) {
+					if ((i%16) == 0) {
+						printf("\n%.8X: ", addr+i);
+					}
+					if (big_endian == 0) {
+						d16 = read_le16(dev, addr+i);
+					} else {
+						d16 = read_be16(dev, addr+i);
+					}
+					printf("%.4X ", d16);
 				}
-				if (big_endian == 0) {
-					d16 = read_le16(dev, addr+i);
-				} else {
-					d16 = read_be16(dev, addr+i);
-				}
-				printf("%.4X ", d16);
+				progress_add(&prog, end - base);
 			}
 			printf("\n");
 			break;
 		case 32:
-			for (i = 0; i < len; i+=4) {
-				if ((i%16) == 0) {
-					printf("\n%.8X: ", addr+i);
+			for (base = 0; (base < len) && !cancel_pending(); base += PROGRESS_CHUNK) {
+				end = chunk_end(base, len, PROGRESS_CHUNK);
+				for (i = base; i < end; i+=4) {
+					if ((i%16) == 0) {
+						printf("\n%.8X: ", addr+i);
+					}
+					if (big_endian == 0) {
+						d32 = read_le32(dev, addr+i);
+					} else {
+						d32 = read_be32(dev, addr+i);
+					}
+					printf("%.8X ", d32);
 				}
-				if (big_endian == 0) {
-					d32 = read_le32(dev, addr+i);
-				} else {
-					d32 = read_be32(dev, addr+i);
-				}
-				printf("%.8X ", d32);
+				progress_add(&prog, end - base);
 			}
 			printf("\n");
 			break;
@@ -540,6 +1095,11 @@ int display_mem(device_t *dev, char *cmd)
 			/* Don't break out of command processing loop */
 			break;
 	}
+	if (cancel_pending()) {
+		progress_abort(&prog);
+	} else {
+		progress_finish(&prog);
+	}
 	printf("\n");
 	return 0;
 }
@@ -601,6 +1161,50 @@ int change_mem(device_t *dev, char *cmd)
 	return 0;
 }
 
+/* Constant fill through bulk_set(), d32 in the current endian mode */
+static int
+fill_fast(
+	device_t     *dev,
+	int           width,
+	int           addr,
+	int           len,
+	unsigned int  d32)
+{
+	unsigned char pat[4];
+	unsigned short d16;
+	progress_t prog;
+	int patlen = width / 8;
+
+	switch (width) {
+		case 8:
+			pat[0] = (unsigned char)d32;
+			break;
+		case 16:
+			d16 = (unsigned short)d32;
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d16 = bswap_16(d16);
+			}
+			memcpy(pat, &d16, 2);
+			break;
+		default:
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d32 = bswap_32(d32);
+			}
+			memcpy(pat, &d32, 4);
+			break;
+	}
+	/* Whole elements only */
+	len -= len % patlen;
+
+	progress_start(&prog, "fill", len);
+	if (bulk_set(dev, addr, len, pat, patlen, &prog) < (unsigned int)len) {
+		progress_abort(&prog);
+	} else {
+		progress_finish(&prog);
+	}
+	return 0;
+}
+
 int fill_mem(device_t *dev, char *cmd)
 {
 	int width = 32;
@@ -612,6 +1216,12 @@ int fill_mem(device_t *dev, char *cmd)
 	unsigned char d8;
 	unsigned short d16;
 	unsigned int d32;
+	int base;
+	int end;
+	progress_t prog;
+	const strategy_t *strategy;
+	strategy_t exact;
+	strategy_t coalesced;
 
 	/* c, c8, c16, c32 */
 	if (cmd[1] == ' ') {
@@ -626,7 +1236,7 @@ int fill_mem(device_t *dev, char *cmd)
 		}
 	} else {
 		status = sscanf(cmd, "%*c%d %x %x %x %x", &width, &addr, &d32, &len, &inc);
-		if ((status != 3) && (status != 4)) {
+		if ((status != 4) && (status != 5)) {
 			printf("Syntax error (use ? for help)\n");
 			/* Don't break out of command processing loop */
 			return 0;
@@ -642,32 +1252,77 @@ int fill_mem(device_t *dev, char *cmd)
 	/* Length is in bytes */
 	if ((addr + len) > dev->size) {
 		/* Truncate */
-		len = dev->size;
+		len = dev->size - addr;
 	}
+	latmap_warn(dev, addr, len, width, 1);
+	/* Large constant fills (clearing a window) of plain memory ranges
+	 * marked for coalescing use the memset-style kernel: widest stores
+	 * and a single fence
+	 */
+	if ((inc == 0) && (len >= FASTFILL_MIN_BYTES) &&
+	    ((width == 8) || (width == 16) || (width == 32)) &&
+	    coalesce_lookup(dev, addr, len, &coalesced)) {
+		return fill_fast(dev, width, addr, len, d32);
+	}
+	/* Large fills inside a tuned window use the tuned strategy, other
+	 * large aligned fills the same stores as below with the pattern
+	 * generated (and byte swapped) a chunk at a time; constant fills
+	 * fence once at the end rather than after every chunk
+	 */
+	strategy = profile_lookup(dev, PROFILE_WRITE, addr, len);
+	if ((strategy == NULL) && buffered_ok(width, addr, len)) {
+		strategy = exact_strategy(&exact, width);
+		if (inc == 0) {
+			exact.fence = FENCE_END;
+		}
+	}
+	if ((strategy != NULL) && ((width == 8) || (width == 16) || (width == 32))) {
+		progress_start(&prog, "fill", len);
+		if (bulk_fill(dev, strategy, addr, len, width, big_endian,
+		              d32, inc, &prog) < len - (len % (width / 8))) {
+			progress_abort(&prog);
+		} else {
+			progress_finish(&prog);
+		}
+		return 0;
+	}
+	progress_start(&prog, "fill", len);
 	switch (width) {
 		case 8:
-			for (i = 0; i < len; i++) {
-				d8 = (unsigned char)(d32 + i*inc);
-				write_8(dev, addr+i, d8);
+			for (base = 0; (base < len) && !cancel_pending(); base += PROGRESS_CHUNK) {
+				end = chunk_end(base, len, PROGRESS_CHUNK);
+				for (i = base; i < end; i++) {
+					d8 = (unsigned char)(d32 + i*inc);
+					write_8(dev, addr+i, d8);
+				}
+				progress_add(&prog, end - base);
 			}
 			break;
 		case 16:
-			for (i = 0; i < len/2; i++) {
-				d16 = (unsigned short)(d32 + i*inc);
-				if (big_endian == 0) {
-					write_le16(dev, addr+2*i, d16);
-				} else {
-					write_be16(dev, addr+2*i, d16);
+			for (base = 0; (base < len/2) && !cancel_pending(); base += PROGRESS_CHUNK/2) {
+				end = chunk_end(base, len/2, PROGRESS_CHUNK/2);
+				for (i = base; i < end; i++) {
+					d16 = (unsigned short)(d32 + i*inc);
+					if (big_endian == 0) {
+						write_le16(dev, addr+2*i, d16);
+					} else {
+						write_be16(dev, addr+2*i, d16);
+					}
 				}
+				progress_add(&prog, 2*(end - base));
 			}
 			break;
 		case 32:
-			for (i = 0; i < len/4; i++) {
-				if (big_endian == 0) {
-					write_le32(dev, addr+4*i, d32 + i*inc);
-				} else {
-					write_be32(dev, addr+4*i, d32 + i*inc);
+			for (base = 0; (base < len/4) && !cancel_pending(); base += PROGRESS_CHUNK/4) {
+				end = chunk_end(base, len/4, PROGRESS_CHUNK/4);
+				for (i = base; i < end; i++) {
+					if (big_endian == 0) {
+						write_le32(dev, addr+4*i, d32 + i*inc);
+					} else {
+						write_be32(dev, addr+4*i, d32 + i*inc);
+					}
 				}
+				progress_add(&prog, 4*(end - base));
 			}
 			break;
 		default:
@@ -675,6 +1330,11 @@ int fill_mem(device_t *dev, char *cmd)
 			/* Don't break out of command processing loop */
 			break;
 	}
+	if (cancel_pending()) {
+		progress_abort(&prog);
+	} else {
+		progress_finish(&prog);
+	}
 	return 0;
 }
 
@@ -723,8 +1383,11 @@ write_8(
 	unsigned int   addr,
 	unsigned char  data)
 {
+	unsigned long long t0 = accprof_begin(dev);
+
 	*(volatile unsigned char *)(dev->addr + addr) = data;
 	msync((void *)(dev->addr + addr), 1, MS_SYNC | MS_INVALIDATE);
+	accprof_end(dev, t0, addr, 8, ACCPROF_WRITE);
 }
 
 static unsigned char
@@ -732,7 +1395,11 @@ read_8(
 	device_t      *dev,
 	unsigned int   addr)
 {
-	return *(volatile unsigned char *)(dev->addr + addr);
+	unsigned long long t0 = accprof_begin(dev);
+	unsigned char data = *(volatile unsigned char *)(dev->addr + addr);
+
+	accprof_end(dev, t0, addr, 8, ACCPROF_READ);
+	return data;
 }
 
 static void
@@ -741,11 +1408,14 @@ write_le16(
 	unsigned int   addr,
 	unsigned short int data)
 {
+	unsigned long long t0 = accprof_begin(dev);
+
 	if (__BYTE_ORDER != __LITTLE_ENDIAN) {
 		data = bswap_16(data);
 	}
 	*(volatile unsigned short int *)(dev->addr + addr) = data;
 	msync((void *)(dev->addr + addr), 2, MS_SYNC | MS_INVALIDATE);
+	accprof_end(dev, t0, addr, 16, ACCPROF_WRITE);
 }
 
 static unsigned short int
@@ -753,7 +1423,10 @@ read_le16(
 	device_t      *dev,
 	unsigned int   addr)
 {
+	unsigned long long t0 = accprof_begin(dev);
 	unsigned int data = *(volatile unsigned short int *)(dev->addr + addr);
+
+	accprof_end(dev, t0, addr, 16, ACCPROF_READ);
 	if (__BYTE_ORDER != __LITTLE_ENDIAN) {
 		data = bswap_16(data);
 	}
@@ -766,11 +1439,14 @@ write_be16(
 	unsigned int   addr,
 	unsigned short int data)
 {
+	unsigned long long t0 = accprof_begin(dev);
+
 	if (__BYTE_ORDER == __LITTLE_ENDIAN) {
 		data = bswap_16(data);
 	}
 	*(volatile unsigned short int *)(dev->addr + addr) = data;
 	msync((void *)(dev->addr + addr), 2, MS_SYNC | MS_INVALIDATE);
+	accprof_end(dev, t0, addr, 16, ACCPROF_WRITE);
 }
 
 static unsigned short int
@@ -778,7 +1454,10 @@ read_be16(
 	device_t      *dev,
 	unsigned int   addr)
 {
+	unsigned long long t0 = accprof_begin(dev);
 	unsigned int data = *(volatile unsigned short int *)(dev->addr + addr);
+
+	accprof_end(dev, t0, addr, 16, ACCPROF_READ);
 	if (__BYTE_ORDER == __LITTLE_ENDIAN) {
 		data = bswap_16(data);
 	}
@@ -791,11 +1470,14 @@ write_le32(
 	unsigned int   addr,
 	unsigned int data)
 {
+	unsigned long long t0 = accprof_begin(dev);
+
 	if (__BYTE_ORDER != __LITTLE_ENDIAN) {
 		data = bswap_32(data);
 	}
 	*(volatile unsigned int *)(dev->addr + addr) = data;
 	msync((void *)(dev->addr + addr), 4, MS_SYNC | MS_INVALIDATE);
+	accprof_end(dev, t0, addr, 32, ACCPROF_WRITE);
 }
 
 static unsigned int
@@ -803,7 +1485,10 @@ read_le32(
 	device_t      *dev,
 	unsigned int   addr)
 {
+	unsigned long long t0 = accprof_begin(dev);
 	unsigned int data = *(volatile unsigned int *)(dev->addr + addr);
+
+	accprof_end(dev, t0, addr, 32, ACCPROF_READ);
 	if (__BYTE_ORDER != __LITTLE_ENDIAN) {
 		data = bswap_32(data);
 	}
@@ -816,11 +1501,14 @@ write_be32(
 	unsigned int   addr,
 	unsigned int data)
 {
+	unsigned long long t0 = accprof_begin(dev);
+
 	if (__BYTE_ORDER == __LITTLE_ENDIAN) {
 		data = bswap_32(data);
 	}
 	*(volatile unsigned int *)(dev->addr + addr) = data;
 	msync((void *)(dev->addr + addr), 4, MS_SYNC | MS_INVALIDATE);
+	accprof_end(dev, t0, addr, 32, ACCPROF_WRITE);
 }
 
 static unsigned int
@@ -828,7 +1516,10 @@ read_be32(
 	device_t      *dev,
 	unsigned int   addr)
 {
+	unsigned long long t0 = accprof_begin(dev);
 	unsigned int data = *(volatile unsigned int *)(dev->addr + addr);
+
+	accprof_end(dev, t0, addr, 32, ACCPROF_READ);
 	if (__BYTE_ORDER == __LITTLE_ENDIAN) {
 		data = bswap_32(data);
 	}
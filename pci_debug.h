@@ -0,0 +1,92 @@
+/* pci_debug.h
+ *
+ * PCI debug registers interface, shared definitions.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef PCI_DEBUG_H
+#define PCI_DEBUG_H
+
+struct profile;
+struct coalesce;
+struct irq;
+struct sampler;
+
+/* PCI device */
+typedef struct {
+	/* Base address region */
+	unsigned int bar;
+
+	/* Slot info */
+	unsigned int domain;
+	unsigned int bus;
+	unsigned int slot;
+	unsigned int function;
+
+	/* Vendor and device IDs */
+	unsigned short vendor;
+	unsigned short device;
+
+	/* Resource filename */
+	char         filename[100];
+
+	/* File descriptor of the resource */
+	int          fd;
+
+	/* Memory mapped resource */
+	unsigned char *maddr;
+	unsigned int   size;
+	unsigned int   offset;
+
+	/* PCI physical address */
+	unsigned int   phys;
+
+	/* Address to pass to read/write (includes offset) */
+	unsigned char *addr;
+
+	/* Write-combining mapping of the same region (resourceN_wc),
+	 * NULL when the BAR is not prefetchable
+	 */
+	int            wc_fd;
+	unsigned char *wc_maddr;
+	unsigned char *wc_addr;
+
+	/* Tuned access strategies for this vendor:device:bar */
+	struct profile *profile;
+
+	/* Address ranges where narrow reads may be served by wide ones */
+	struct coalesce *coalesce;
+
+	/* Slow read ranges found by latmap for this vendor:device:bar */
+	struct latmap *latmap;
+
+	/* Interrupt source (-i) and its state once opened */
+	const char  *irq_spec;
+	struct irq  *irq;
+
+	/* Background register sampler */
+	struct sampler *sampler;
+
+	/* Per-register access counts and times, NULL when not profiling */
+	struct accprof *accprof;
+
+	/* MMIO accesses made so far (bulk transfers: one per element) */
+	unsigned long long mmio_ops;
+} device_t;
+
+extern int quit;
+extern int verbosity;
+
+/* Endian read/write mode, 1 for big-endian */
+extern int big_endian;
+
+/* Open and map BAR dev->bar of the device in slot ([domain:]bus:dev.fn),
+ * or of the plain file resource standing in for it
+ */
+int dev_open(device_t *dev, const char *slot, const char *resource);
+void dev_close(device_t *dev);
+
+/* Run one command line, returns -1 on quit */
+int process_command(device_t *dev, char *cmd);
+
+#endif /* PCI_DEBUG_H */
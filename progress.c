@@ -0,0 +1,197 @@
+/* progress.c
+ *
+ * Rate-limited progress reporter: bytes done, MB/s and ETA.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "progress.h"
+
+static double
+timespec_diff(
+	const struct timespec *a,
+	const struct timespec *b)
+{
+	return (double)(b->tv_sec - a->tv_sec) +
+		(double)(b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+double
+progress_elapsed(
+	const progress_t *p)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_diff(&p->start, &now);
+}
+
+static void
+print_size(
+	char              *buf,
+	size_t             len,
+	unsigned long long bytes)
+{
+	if (bytes >= 1024ULL*1024*1024) {
+		snprintf(buf, len, "%.2f GiB", bytes / (1024.0*1024*1024));
+	} else if (bytes >= 1024*1024) {
+		snprintf(buf, len, "%.1f MiB", bytes / (1024.0*1024));
+	} else {
+		snprintf(buf, len, "%.1f KiB", bytes / 1024.0);
+	}
+}
+
+static void
+progress_draw(
+	progress_t *p)
+{
+	unsigned long long done;
+	double elapsed;
+	double rate;
+	double eta;
+	char sdone[32];
+	char stotal[32];
+
+	done = atomic_load_explicit(&p->done, memory_order_relaxed);
+	elapsed = progress_elapsed(p);
+	rate = (elapsed > 0) ? done / elapsed : 0;
+	print_size(sdone, sizeof(sdone), done);
+	print_size(stotal, sizeof(stotal), p->total);
+
+	fprintf(stderr, "\r%s: %s / %s (%5.1f%%) %8.1f MB/s",
+		p->label, sdone, stotal,
+		p->total ? 100.0 * done / p->total : 100.0,
+		rate / 1e6);
+	if ((rate > 0) && (done < p->total)) {
+		eta = (p->total - done) / rate;
+		fprintf(stderr, "  ETA %02d:%02d:%02d",
+			(int)eta / 3600, ((int)eta / 60) % 60, (int)eta % 60);
+	}
+	/* Clear to end of line */
+	fprintf(stderr, "\033[K");
+	fflush(stderr);
+}
+
+static void *
+progress_thread(
+	void *arg)
+{
+	progress_t *p = (progress_t *)arg;
+	struct timespec period;
+
+	period.tv_sec = 0;
+	period.tv_nsec = PROGRESS_PERIOD_MS * 1000000L;
+
+	while (!atomic_load_explicit(&p->stop, memory_order_acquire)) {
+		nanosleep(&period, NULL);
+		if (atomic_load_explicit(&p->stop, memory_order_acquire)) {
+			break;
+		}
+		progress_draw(p);
+	}
+	return NULL;
+}
+
+/* 1 when the operation is worth reporting: large, on a terminal */
+static int
+progress_init(
+	progress_t         *p,
+	const char         *label,
+	unsigned long long  total)
+{
+	memset(p, 0, sizeof(*p));
+	atomic_init(&p->done, 0);
+	atomic_init(&p->stop, 0);
+	p->total = total;
+	p->label = label;
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+
+	/* Only worth it for large operations on an interactive terminal */
+	return (total >= PROGRESS_MIN_BYTES) && isatty(STDOUT_FILENO);
+}
+
+void
+progress_start(
+	progress_t         *p,
+	const char         *label,
+	unsigned long long  total)
+{
+	if (!progress_init(p, label, total)) {
+		return;
+	}
+	if (pthread_create(&p->thread, NULL, progress_thread, p) == 0) {
+		p->active = 1;
+	}
+}
+
+/* For output written to the terminal as it goes: a status line redrawn
+ * on stderr would be spliced into the lines stdout is still buffering
+ */
+void
+progress_start_quiet(
+	progress_t         *p,
+	const char         *label,
+	unsigned long long  total)
+{
+	p->quiet = progress_init(p, label, total);
+}
+
+static void
+progress_stop(
+	progress_t *p)
+{
+	if (p->active) {
+		atomic_store_explicit(&p->stop, 1, memory_order_release);
+		pthread_join(p->thread, NULL);
+		p->active = 0;
+	}
+}
+
+void
+progress_finish(
+	progress_t *p)
+{
+	unsigned long long done;
+	double elapsed;
+	char sdone[32];
+
+	if (!p->active && !p->quiet) {
+		return;
+	}
+	progress_stop(p);
+	fflush(stdout);
+
+	done = atomic_load_explicit(&p->done, memory_order_relaxed);
+	elapsed = progress_elapsed(p);
+	print_size(sdone, sizeof(sdone), done);
+	fprintf(stderr, "\r%s: %s in %.3f s (%.1f MB/s)\033[K\n",
+		p->label, sdone, elapsed,
+		(elapsed > 0) ? done / elapsed / 1e6 : 0.0);
+	fflush(stderr);
+}
+
+/* Cancelled operation: always report how far it got, tty or not */
+void
+progress_abort(
+	progress_t *p)
+{
+	unsigned long long done;
+	double elapsed;
+	char sdone[32];
+	char stotal[32];
+
+	progress_stop(p);
+	fflush(stdout);
+
+	done = atomic_load_explicit(&p->done, memory_order_relaxed);
+	elapsed = progress_elapsed(p);
+	print_size(sdone, sizeof(sdone), done);
+	print_size(stotal, sizeof(stotal), p->total);
+	fprintf(stderr, "\r%s: interrupted after %s of %s in %.3f s (%.1f MB/s)\033[K\n",
+		p->label, sdone, stotal, elapsed,
+		(elapsed > 0) ? done / elapsed / 1e6 : 0.0);
+	fflush(stderr);
+}
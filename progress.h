@@ -0,0 +1,65 @@
+/* progress.h
+ *
+ * Progress and throughput reporting for long bulk operations.
+ *
+ * The hot loops only bump a byte counter (relaxed atomic add, once
+ * per chunk). A reporter thread samples that counter a few times a
+ * second and redraws a single status line on stderr. The reporter
+ * is only started when stdout is a terminal and the operation is
+ * large enough to be worth it. Dumps, whose lines go to that same
+ * terminal, only get the final throughput line.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Operations smaller than this never show a progress line */
+#define PROGRESS_MIN_BYTES   (1024*1024)
+
+/* Hot loops account progress once per chunk of this many bytes */
+#define PROGRESS_CHUNK       (64*1024)
+
+/* Redraw period of the status line */
+#define PROGRESS_PERIOD_MS   250
+
+typedef struct {
+	/* Bytes done so far, bumped by the workers */
+	atomic_ullong      done;
+
+	/* Bytes expected in total */
+	unsigned long long total;
+
+	/* Operation name shown in front of the status line */
+	const char        *label;
+
+	/* Start time (CLOCK_MONOTONIC) */
+	struct timespec    start;
+
+	/* Reporter thread state; quiet: no thread, final line only */
+	int                active;
+	int                quiet;
+	atomic_int         stop;
+	pthread_t          thread;
+} progress_t;
+
+void progress_start(progress_t *p, const char *label, unsigned long long total);
+void progress_start_quiet(progress_t *p, const char *label, unsigned long long total);
+void progress_finish(progress_t *p);
+void progress_abort(progress_t *p);
+double progress_elapsed(const progress_t *p);
+
+/* Called by the workers, once per chunk */
+static inline void
+progress_add(
+	progress_t         *p,
+	unsigned long long  bytes)
+{
+	atomic_fetch_add_explicit(&p->done, bytes, memory_order_relaxed);
+}
+
+#endif /* PROGRESS_H */
@@ -0,0 +1,152 @@
+/* ramcap.c
+ *
+ * In-RAM capture ring.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "ramcap.h"
+
+#define RAMCAP_PAGE  4096
+
+static const char *ramcap_names[] = {
+	"4 KiB pages", "2 MiB transparent hugepages", "2 MiB hugetlb pages"
+};
+
+/* Bytes of [addr, addr+len) backed by transparent hugepages */
+static size_t
+thp_bytes(
+	void *addr)
+{
+	unsigned long lo;
+	unsigned long hi;
+	unsigned long kb;
+	char line[256];
+	int found = 0;
+	size_t bytes = 0;
+	FILE *fp;
+
+	fp = fopen("/proc/self/smaps", "r");
+	if (fp == NULL) {
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+			if (found) {
+				break;
+			}
+			found = ((unsigned long)addr >= lo) && ((unsigned long)addr < hi);
+		} else if (found && (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)) {
+			bytes = kb * 1024;
+		}
+	}
+	fclose(fp);
+	return bytes;
+}
+
+ramcap_t *
+ramcap_create(
+	size_t size,
+	int    huge)
+{
+	unsigned char *p = MAP_FAILED;
+	unsigned char *aligned;
+	size_t len;
+	size_t off;
+	ramcap_t *r;
+
+	r = (ramcap_t *)calloc(1, sizeof(ramcap_t));
+	if (r == NULL) {
+		return NULL;
+	}
+	len = (size + RAMCAP_HUGE_SIZE - 1) & ~((size_t)RAMCAP_HUGE_SIZE - 1);
+
+	/* Reserved hugepage pool, populated by the kernel */
+	if (huge) {
+		p = (unsigned char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		if (p != MAP_FAILED) {
+			r->pages = RAMCAP_HUGETLB;
+			r->huge_bytes = len;
+		}
+	}
+
+	/* Otherwise plain memory, 2 MiB aligned so THP can back all of it */
+	if (p == MAP_FAILED) {
+		p = (unsigned char *)mmap(NULL, len + RAMCAP_HUGE_SIZE,
+			PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) {
+			free(r);
+			return NULL;
+		}
+		aligned = (unsigned char *)(((uintptr_t)p + RAMCAP_HUGE_SIZE - 1) &
+			~((uintptr_t)RAMCAP_HUGE_SIZE - 1));
+		if (aligned > p) {
+			munmap(p, aligned - p);
+		}
+		munmap(aligned + len, (p + len + RAMCAP_HUGE_SIZE) - (aligned + len));
+		p = aligned;
+		madvise(p, len, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+		r->pages = RAMCAP_4K;
+	}
+
+	/* Prefault: the sampling loop must never take a page fault */
+	for (off = 0; off < len; off += RAMCAP_PAGE) {
+		((volatile unsigned char *)p)[off] = 0;
+	}
+	if (huge && (r->pages == RAMCAP_4K)) {
+		r->huge_bytes = thp_bytes(p);
+		if (r->huge_bytes > 0) {
+			r->pages = RAMCAP_THP;
+		}
+	}
+	r->base = p;
+	r->size = len;
+	ramcap_reset(r, 1);
+	return r;
+}
+
+void
+ramcap_destroy(
+	ramcap_t *r)
+{
+	if (r == NULL) {
+		return;
+	}
+	munmap(r->base, r->size);
+	free(r);
+}
+
+void
+ramcap_reset(
+	ramcap_t *r,
+	int       nregs)
+{
+	r->nregs = nregs;
+	r->rec = (1 + nregs) * sizeof(uint64_t);
+	r->capacity = r->size / r->rec;
+	atomic_store(&r->head, 0);
+}
+
+const char *
+ramcap_pages_str(
+	const ramcap_t *r)
+{
+	return ramcap_names[r->pages];
+}
+
+const uint64_t *
+ramcap_record(
+	const ramcap_t *r,
+	uint64_t        n)
+{
+	uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	uint64_t oldest = (head > r->capacity) ? head - r->capacity : 0;
+
+	return (const uint64_t *)(r->base + ((oldest + n) % r->capacity) * r->rec);
+}
@@ -0,0 +1,70 @@
+/* ramcap.h
+ *
+ * In-RAM capture ring for high-rate bursts.
+ *
+ * "sample ram size" allocates a ring the sampler thread stores each
+ * sweep into (time stamp and values, oldest records overwritten once
+ * full), "sample save file" writes it out afterwards as a columnar
+ * capture. A multi-GB ring of 4 KiB pages would take a TLB miss every
+ * few records, so the ring is backed by hugepages: MAP_HUGETLB from the
+ * reserved pool first, else transparent hugepages (madvise), else plain
+ * pages. Every page is touched up front so the sampling loop never
+ * faults.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef RAMCAP_H
+#define RAMCAP_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* How the ring ended up being backed */
+#define RAMCAP_4K       0
+#define RAMCAP_THP      1
+#define RAMCAP_HUGETLB  2
+
+#define RAMCAP_HUGE_SIZE  (2*1024*1024)
+
+typedef struct {
+	unsigned char *base;
+	size_t         size;        /* mapped bytes */
+	int            pages;       /* RAMCAP_xxx */
+	size_t         huge_bytes;  /* backed by hugepages (THP: as reported) */
+
+	uint32_t       nregs;
+	uint32_t       rec;         /* bytes per record: (1 + nregs) * 8 */
+	uint64_t       capacity;    /* records */
+	atomic_ullong  head;        /* records stored since the reset */
+} ramcap_t;
+
+/* huge: 0 forces 4 KiB pages (for comparison) */
+ramcap_t *ramcap_create(size_t size, int huge);
+void ramcap_destroy(ramcap_t *r);
+
+/* Empty the ring and size its records for nregs values */
+void ramcap_reset(ramcap_t *r, int nregs);
+
+const char *ramcap_pages_str(const ramcap_t *r);
+
+/* Record of sweep n (0 = oldest still in the ring) */
+const uint64_t *ramcap_record(const ramcap_t *r, uint64_t n);
+
+/* Sampler thread only */
+static inline void
+ramcap_add(
+	ramcap_t       *r,
+	uint64_t        t_ns,
+	const uint64_t *values)
+{
+	uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint64_t *p = (uint64_t *)(r->base + (head % r->capacity) * r->rec);
+
+	p[0] = t_ns;
+	memcpy(p + 1, values, r->nregs * sizeof(uint64_t));
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+#endif /* RAMCAP_H */
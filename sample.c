@@ -0,0 +1,813 @@
+/* sample.c
+ *
+ * Background register sampling and the sample/hist commands.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <byteswap.h>
+
+#include "sample.h"
+#include "cancel.h"
+#include "msample.h"
+
+unsigned long long
+sample_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t
+sample_read(
+	device_t     *dev,
+	unsigned int  addr,
+	int           width,
+	int           big)
+{
+	volatile unsigned char *p = dev->addr + addr;
+	int swap = ((big != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN));
+	uint64_t v;
+
+	switch (width) {
+		case 8:
+			return *p;
+		case 16:
+			v = *(volatile uint16_t *)p;
+			return swap ? bswap_16(v) : v;
+		case 32:
+			v = *(volatile uint32_t *)p;
+			return swap ? bswap_32(v) : v;
+		default:
+			v = *(volatile uint64_t *)p;
+			return swap ? bswap_64(v) : v;
+	}
+}
+
+/* New errors since the previous sweep, 0 when the read failed (buf
+ * NULL) or the counters were reset
+ */
+static uint64_t
+aer_delta(
+	sample_reg_t *r,
+	const char   *buf)
+{
+	uint64_t last = atomic_load_explicit(&r->aer_last, memory_order_relaxed);
+	uint64_t count;
+
+	if ((buf == NULL) || (aer_find(buf, r->aer_key, &count) < 0)) {
+		return 0;
+	}
+	atomic_store_explicit(&r->aer_last, count, memory_order_relaxed);
+	return (count >= last) ? count - last : 0;
+}
+
+/* Interrupts since the previous sweep (totals read at its start) */
+static uint64_t
+irq_delta(
+	struct sampler *s,
+	sample_reg_t   *r)
+{
+	uint64_t last = atomic_load_explicit(&r->irq_last, memory_order_relaxed);
+	uint64_t count = s->irqs->total[r->irq_index];
+
+	atomic_store_explicit(&r->irq_last, count, memory_order_relaxed);
+	return (count >= last) ? count - last : 0;
+}
+
+static void *
+sample_thread(
+	void *arg)
+{
+	device_t *dev = (device_t *)arg;
+	struct sampler *s = dev->sampler;
+	unsigned long long period = (unsigned long long)s->period_us * 1000ULL;
+	unsigned long long next;
+	unsigned long long now;
+	unsigned long long t;
+	uint64_t values[SAMPLE_MAX_REGS];
+	char aer_buf[AER_BUF];
+	struct timespec ts;
+	sample_reg_t *r;
+	int aer_loaded;
+	int aer_ok = 0;
+	int i;
+
+	next = sample_now_ns();
+	while (!atomic_load_explicit(&s->stop, memory_order_relaxed)) {
+		t = sample_now_ns();
+		if (s->irqs != NULL) {
+			irqrate_read(s->irqs);
+		}
+		/* The counters of a file share its descriptor and follow each
+		 * other in the set: one read per file and sweep
+		 */
+		aer_loaded = -1;
+		for (i = 0; i < s->count; i++) {
+			r = &s->reg[i];
+			if (r->aer_fd >= 0) {
+				if (r->aer_fd != aer_loaded) {
+					aer_ok = (aer_load(r->aer_fd, aer_buf) == 0);
+					aer_loaded = r->aer_fd;
+				}
+				values[i] = aer_delta(r, aer_ok ? aer_buf : NULL);
+			} else if (r->irq_index >= 0) {
+				values[i] = irq_delta(s, r);
+			} else {
+				values[i] = sample_read(dev, r->addr, r->width, s->big);
+			}
+			hist_add(r->hist, values[i]);
+		}
+		if (s->ram != NULL) {
+			ramcap_add(s->ram, t, values);
+		}
+		if (s->live != NULL) {
+			live_add(s->live, t, values);
+		}
+		if (s->capture != NULL) {
+			capture_add(s->capture, t, values);
+		}
+		atomic_fetch_add_explicit(&s->sweeps, 1, memory_order_relaxed);
+		if (period == 0) {
+			continue;
+		}
+
+		/* Absolute deadlines keep the cadence, overruns skip ahead */
+		next += period;
+		now = sample_now_ns();
+		if (next <= now) {
+			atomic_fetch_add_explicit(&s->late,
+				(now - next) / period + 1, memory_order_relaxed);
+			next += ((now - next) / period + 1) * period;
+		}
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	return NULL;
+}
+
+/* New live ring for the current register set */
+static int
+live_start(
+	device_t       *dev,
+	struct sampler *s)
+{
+	capture_col_t cols[SAMPLE_MAX_REGS];
+	int i;
+
+	memset(cols, 0, sizeof(cols));
+	for (i = 0; i < s->count; i++) {
+		snprintf(cols[i].name, sizeof(cols[i].name), "%s", s->reg[i].name);
+		cols[i].addr = s->reg[i].addr;
+		cols[i].width = s->reg[i].width;
+		cols[i].bar = sample_column_bar(&s->reg[i], dev->bar);
+	}
+	s->live = live_create(s->live_path, s->live_size, s->count, cols, s->period_us);
+	return (s->live != NULL) ? 0 : -1;
+}
+
+static int
+sample_start(
+	device_t     *dev,
+	unsigned int  period_us,
+	const char   *path)
+{
+	struct sampler *s = dev->sampler;
+	sample_reg_t *r;
+	int i;
+
+	if ((s == NULL) || (s->count == 0)) {
+		printf("Error: no registers to sample (sample add addr [width] [name])\n");
+		return -1;
+	}
+	if (s->running) {
+		printf("Error: sampling already running\n");
+		return -1;
+	}
+	s->period_us = period_us;
+	s->big = big_endian;
+	atomic_store(&s->stop, 0);
+	atomic_store(&s->sweeps, 0);
+	atomic_store(&s->late, 0);
+	if (s->ram != NULL) {
+		ramcap_reset(s->ram, s->count);
+		s->ram_generation = s->generation;
+	}
+	for (i = 0; i < s->count; i++) {
+		r = &s->reg[i];
+		if ((r->aer_fd >= 0) && (aer_read(r->aer_fd, r->aer_key, &r->aer_base) == 0)) {
+			atomic_store(&r->aer_last, r->aer_base);
+		}
+	}
+	if ((s->irqs != NULL) && (irqrate_read(s->irqs) == 0)) {
+		for (i = 0; i < s->count; i++) {
+			r = &s->reg[i];
+			if (r->irq_index >= 0) {
+				r->irq_base = s->irqs->total[r->irq_index];
+				atomic_store(&r->irq_last, r->irq_base);
+			}
+		}
+	}
+	s->capture = NULL;
+	if ((path != NULL) && ((s->capture = capture_open(path, dev, s)) == NULL)) {
+		return -1;
+	}
+	s->live = NULL;
+	if ((s->live_path[0] != '\0') && (live_start(dev, s) < 0)) {
+		capture_close(s->capture);
+		s->capture = NULL;
+		return -1;
+	}
+	s->start_ns = sample_now_ns();
+	if (pthread_create(&s->thread, NULL, sample_thread, dev) != 0) {
+		printf("Error: cannot start the sampling thread\n");
+		capture_close(s->capture);
+		s->capture = NULL;
+		live_close(s->live);
+		s->live = NULL;
+		return -1;
+	}
+	s->running = 1;
+	return 0;
+}
+
+void
+sample_stop(
+	device_t *dev)
+{
+	struct sampler *s = dev->sampler;
+
+	if ((s == NULL) || !s->running) {
+		return;
+	}
+	atomic_store(&s->stop, 1);
+	pthread_join(s->thread, NULL);
+	s->running = 0;
+	capture_close(s->capture);
+	s->capture = NULL;
+	live_close(s->live);
+	s->live = NULL;
+}
+
+static struct sampler *
+sampler_get(
+	device_t *dev)
+{
+	if (dev->sampler == NULL) {
+		dev->sampler = (struct sampler *)calloc(1, sizeof(struct sampler));
+	}
+	return dev->sampler;
+}
+
+/* Next free entry of the set with its histogram, NULL (and a message)
+ * when there is none
+ */
+static sample_reg_t *
+sample_new(
+	device_t *dev,
+	int       width)
+{
+	struct sampler *s;
+	sample_reg_t *r;
+
+	s = sampler_get(dev);
+	if (s == NULL) {
+		return NULL;
+	}
+	if (s->running) {
+		printf("Error: stop sampling first\n");
+		return NULL;
+	}
+	if (s->count == SAMPLE_MAX_REGS) {
+		printf("Error: at most %d registers\n", SAMPLE_MAX_REGS);
+		return NULL;
+	}
+	r = &s->reg[s->count];
+	memset(r, 0, sizeof(*r));
+	r->hist = hist_create(width);
+	if (r->hist == NULL) {
+		printf("Error: out of memory\n");
+		return NULL;
+	}
+	r->width = width;
+	r->aer_fd = -1;
+	r->irq_index = -1;
+	s->count++;
+	s->generation++;
+	return r;
+}
+
+static int
+sample_add(
+	device_t     *dev,
+	unsigned int  addr,
+	int           width,
+	const char   *name)
+{
+	sample_reg_t *r;
+
+	if ((width != 8) && (width != 16) && (width != 32) && (width != 64)) {
+		printf("Error: width must be 8, 16, 32 or 64\n");
+		return -1;
+	}
+	if ((addr % (width / 8)) || ((unsigned long long)addr + width / 8 > dev->size)) {
+		printf("Error: %d-bit register at %.8X is unaligned or outside the BAR\n",
+			width, addr);
+		return -1;
+	}
+	r = sample_new(dev, width);
+	if (r == NULL) {
+		return -1;
+	}
+	r->addr = addr;
+	if (name != NULL) {
+		snprintf(r->name, sizeof(r->name), "%s", name);
+	} else {
+		snprintf(r->name, sizeof(r->name), "reg%X", addr);
+	}
+	return 0;
+}
+
+/* AER counters of this device and the msample cards: the three totals,
+ * or with all every counter of the three files
+ */
+static void
+sample_aer(
+	device_t *dev,
+	char     *cmd)
+{
+	static const char *prefix[AER_NFILES] = { "cor", "nonfatal", "fatal" };
+	device_t *devs[MSAMPLE_MAX_DEVS];
+	char keys[32][24];
+	char dev_prefix[16];
+	char name[64];
+	sample_reg_t *r;
+	int nkeys;
+	int added = 0;
+	int n;
+	int d;
+	int f;
+	int k;
+	int fd;
+	int all;
+
+	/* sample aer [all] */
+	all = (sscanf(cmd, "%*s %*s %23s", name) == 1) && (strcmp(name, "all") == 0);
+	n = msample_devices(dev, devs, MSAMPLE_MAX_DEVS);
+	for (d = 0; d < n; d++) {
+		dev_prefix[0] = '\0';
+		if (d > 0) {
+			snprintf(dev_prefix, sizeof(dev_prefix), "dev%d.", d);
+		}
+		for (f = 0; f < AER_NFILES; f++) {
+			fd = aer_open(devs[d], aer_files[f]);
+			if (fd < 0) {
+				break;
+			}
+			if (all) {
+				nkeys = aer_keys(fd, keys, 32);
+			} else {
+				snprintf(keys[0], sizeof(keys[0]), "%s", aer_totals[f]);
+				nkeys = 1;
+			}
+			/* The counters of the file share its descriptor */
+			for (k = 0; k < nkeys; k++) {
+				if (all) {
+					snprintf(name, sizeof(name), "%s%s.%.23s", dev_prefix, prefix[f], keys[k]);
+				} else {
+					snprintf(name, sizeof(name), "%saer_%s", dev_prefix, prefix[f]);
+				}
+				r = sample_new(dev, 64);
+				if (r == NULL) {
+					break;
+				}
+				snprintf(r->name, sizeof(r->name), "%.31s", name);
+				snprintf(r->aer_key, sizeof(r->aer_key), "%.23s", keys[k]);
+				r->aer_fd = fd;
+				added++;
+			}
+			if (k == 0) {
+				close(fd);
+			}
+			if (k < nkeys) {
+				return;
+			}
+		}
+	}
+	printf("Added %d AER counter(s)\n", added);
+}
+
+/* Interrupt counts of the MSI/MSI-X vectors of this device (all: and
+ * of the msample cards), one column per vector
+ */
+static void
+sample_irq(
+	device_t *dev,
+	char     *cmd)
+{
+	device_t *devs[MSAMPLE_MAX_DEVS];
+	unsigned int irqs[IRQRATE_MAX];
+	struct sampler *s;
+	sample_reg_t *r;
+	char word[16];
+	int added = 0;
+	int index;
+	int nirqs;
+	int n;
+	int d;
+	int k;
+
+	/* sample irq [all] */
+	n = 1;
+	devs[0] = dev;
+	if ((sscanf(cmd, "%*s %*s %15s", word) == 1) && (strcmp(word, "all") == 0)) {
+		n = msample_devices(dev, devs, MSAMPLE_MAX_DEVS);
+	}
+	for (d = 0; d < n; d++) {
+		nirqs = irqrate_device_irqs(devs[d], irqs, IRQRATE_MAX);
+		for (k = 0; k < nirqs; k++) {
+			r = sample_new(dev, 64);
+			if (r == NULL) {
+				break;
+			}
+			s = dev->sampler;
+			if ((s->irqs == NULL) && ((s->irqs = irqrate_create()) == NULL)) {
+				s->count--;
+				hist_destroy(r->hist);
+				break;
+			}
+			index = irqrate_add(s->irqs, irqs[k]);
+			if (index < 0) {
+				printf("Error: at most %d interrupts\n", IRQRATE_MAX);
+				s->count--;
+				hist_destroy(r->hist);
+				break;
+			}
+			r->irq_index = index;
+			if (d > 0) {
+				snprintf(r->name, sizeof(r->name), "dev%d.irq%u", d, irqs[k]);
+			} else {
+				snprintf(r->name, sizeof(r->name), "irq%u", irqs[k]);
+			}
+			added++;
+		}
+	}
+	printf("Added %d interrupt count(s)\n", added);
+}
+
+static void
+sample_clear(
+	device_t *dev)
+{
+	struct sampler *s = dev->sampler;
+	int i;
+
+	if (s == NULL) {
+		return;
+	}
+	sample_stop(dev);
+	for (i = 0; i < s->count; i++) {
+		hist_destroy(s->reg[i].hist);
+		/* Shared by the counters of a file, which follow each other */
+		if ((s->reg[i].aer_fd >= 0) &&
+		    ((i == 0) || (s->reg[i - 1].aer_fd != s->reg[i].aer_fd))) {
+			close(s->reg[i].aer_fd);
+		}
+	}
+	irqrate_destroy(s->irqs);
+	s->irqs = NULL;
+	s->count = 0;
+	s->generation++;
+}
+
+static void
+ram_list(
+	ramcap_t *r)
+{
+	unsigned long long head = atomic_load(&r->head);
+
+	printf("RAM ring: %zu MiB on %s", r->size >> 20, ramcap_pages_str(r));
+	if (r->pages == RAMCAP_THP) {
+		printf(" (%zu MiB of it)", r->huge_bytes >> 20);
+	}
+	printf(", %llu of %llu records", (head < r->capacity) ? head :
+		(unsigned long long)r->capacity, (unsigned long long)r->capacity);
+	if (head > r->capacity) {
+		printf(", %llu overwritten", head - (unsigned long long)r->capacity);
+	}
+	printf("\n");
+}
+
+static void
+sample_list(
+	device_t *dev)
+{
+	struct sampler *s = dev->sampler;
+	unsigned long long sweeps;
+	sample_reg_t *r;
+	double elapsed;
+	int i;
+
+	if ((s == NULL) || (s->count == 0)) {
+		printf("Sampling: no registers\n");
+		return;
+	}
+	for (i = 0; i < s->count; i++) {
+		r = &s->reg[i];
+		if (r->aer_fd >= 0) {
+			printf("  %-16s AER %s, %llu since start\n", r->name, r->aer_key,
+				(unsigned long long)(atomic_load(&r->aer_last) - r->aer_base));
+		} else if (r->irq_index >= 0) {
+			printf("  %-16s IRQ %u, %llu since start\n", r->name,
+				s->irqs->irq[r->irq_index],
+				(unsigned long long)(atomic_load(&r->irq_last) - r->irq_base));
+		} else {
+			printf("  %-16s %.8X %2d-bit\n", r->name, r->addr, r->width);
+		}
+	}
+	sweeps = atomic_load(&s->sweeps);
+	elapsed = (sample_now_ns() - s->start_ns) / 1e9;
+	if (s->running) {
+		printf("Sampling: running, period %u us, %llu sweeps in %.1f s (%.0f/s), %llu late%s\n",
+			s->period_us, sweeps, elapsed, sweeps / elapsed,
+			(unsigned long long)atomic_load(&s->late),
+			(s->capture != NULL) ? ", capturing" : "");
+		if (s->live != NULL) {
+			printf("Live ring: %s, %llu records\n", s->live_path,
+				(unsigned long long)atomic_load(&s->live->hdr->head));
+		}
+	} else {
+		printf("Sampling: stopped, %llu sweeps\n", sweeps);
+	}
+	if (s->ram != NULL) {
+		ram_list(s->ram);
+	}
+}
+
+/* Decimal size with an optional K, M or G suffix */
+static int
+parse_size(
+	const char *str,
+	size_t     *size)
+{
+	unsigned long long v;
+	char *end;
+
+	v = strtoull(str, &end, 10);
+	switch (*end) {
+		case 'g':
+		case 'G':
+			v <<= 10;
+			/* fall through */
+		case 'm':
+		case 'M':
+			v <<= 10;
+			/* fall through */
+		case 'k':
+		case 'K':
+			v <<= 10;
+			end++;
+			break;
+	}
+	if ((*end != '\0') || (v == 0)) {
+		return -1;
+	}
+	*size = v;
+	return 0;
+}
+
+static void
+sample_ram(
+	device_t *dev,
+	char     *cmd)
+{
+	struct sampler *s = sampler_get(dev);
+	char arg[32];
+	char opt[8];
+	size_t size;
+	int status;
+
+	if (s == NULL) {
+		return;
+	}
+	/* sample ram, sample ram off, sample ram size [4k] */
+	status = sscanf(cmd, "%*s %*s %31s %7s", arg, opt);
+	if (status < 1) {
+		if (s->ram != NULL) {
+			ram_list(s->ram);
+		} else {
+			printf("RAM ring: off\n");
+		}
+		return;
+	}
+	if (s->running) {
+		printf("Error: stop sampling first\n");
+		return;
+	}
+	ramcap_destroy(s->ram);
+	s->ram = NULL;
+	if (strcmp(arg, "off") == 0) {
+		return;
+	}
+	if (parse_size(arg, &size) < 0) {
+		printf("Syntax error: sample ram size[K|M|G] [4k]\n");
+		return;
+	}
+	s->ram = ramcap_create(size, !((status == 2) && (strcmp(opt, "4k") == 0)));
+	if (s->ram == NULL) {
+		printf("Error: cannot allocate a %zu byte ring\n", size);
+		return;
+	}
+	ram_list(s->ram);
+}
+
+static void
+sample_live(
+	device_t *dev,
+	char     *cmd)
+{
+	struct sampler *s = sampler_get(dev);
+	char path[100];
+	char arg[32];
+	size_t size;
+	int status;
+
+	if (s == NULL) {
+		return;
+	}
+	/* sample live, sample live off, sample live file size[K|M|G] */
+	status = sscanf(cmd, "%*s %*s %99s %31s", path, arg);
+	if (status < 1) {
+		if (s->live_path[0] != '\0') {
+			printf("Live ring: %s, %zu bytes%s\n", s->live_path, s->live_size,
+				(s->live != NULL) ? ", active" : "");
+		} else {
+			printf("Live ring: off\n");
+		}
+		return;
+	}
+	if (s->running) {
+		printf("Error: stop sampling first\n");
+		return;
+	}
+	if ((status == 1) && (strcmp(path, "off") == 0)) {
+		s->live_path[0] = '\0';
+		return;
+	}
+	if ((status != 2) || (parse_size(arg, &size) < 0)) {
+		printf("Syntax error: sample live file size[K|M|G]\n");
+		return;
+	}
+	snprintf(s->live_path, sizeof(s->live_path), "%s", path);
+	s->live_size = size;
+}
+
+/* Write the RAM ring out as a columnar capture */
+static void
+sample_save(
+	device_t   *dev,
+	const char *path)
+{
+	struct sampler *s = dev->sampler;
+	unsigned long long head;
+	unsigned long long n;
+	unsigned long long i;
+	const uint64_t *rec;
+	capture_t *c;
+
+	if ((s == NULL) || (s->ram == NULL)) {
+		printf("Error: no RAM ring (sample ram size)\n");
+		return;
+	}
+	if (s->running) {
+		printf("Error: stop sampling first\n");
+		return;
+	}
+	if (((int)s->ram->nregs != s->count) ||
+	    (s->ram_generation != s->generation)) {
+		printf("Error: the register set changed since the capture\n");
+		return;
+	}
+	c = capture_open(path, dev, s);
+	if (c == NULL) {
+		return;
+	}
+	head = atomic_load(&s->ram->head);
+	n = (head < s->ram->capacity) ? head : s->ram->capacity;
+	for (i = 0; i < n; i++) {
+		if (((i & 0xFFFF) == 0) && cancel_pending()) {
+			printf("Interrupted: saved %llu of %llu records\n", i, n);
+			break;
+		}
+		rec = ramcap_record(s->ram, i);
+		capture_add(c, rec[0], rec + 1);
+	}
+	capture_close(c);
+	if (i == n) {
+		printf("Saved %llu records to %s\n", n, path);
+	}
+}
+
+int
+sample_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	unsigned int addr;
+	unsigned int period_us = SAMPLE_PERIOD_US;
+	int width = 32;
+	char word[16];
+	char name[32];
+	char path[100];
+	int status;
+
+	/* sample, sample add addr [width] [name], sample start [period_us [file]],
+	 * sample stop, sample clear, sample ram [size [4k] | off], sample save file,
+	 * sample live [file size | off], sample aer [all], sample irq [all]
+	 */
+	if (sscanf(cmd, "%*s %15s", word) != 1) {
+		sample_list(dev);
+		return 0;
+	}
+	if (strcmp(word, "add") == 0) {
+		status = sscanf(cmd, "%*s %*s %x %d %31s", &addr, &width, name);
+		if (status < 1) {
+			printf("Syntax error: sample add addr [width] [name]\n");
+			return 0;
+		}
+		sample_add(dev, addr, width, (status == 3) ? name : NULL);
+	} else if (strcmp(word, "start") == 0) {
+		status = sscanf(cmd, "%*s %*s %u %99s", &period_us, path);
+		sample_start(dev, period_us, (status == 2) ? path : NULL);
+	} else if (strcmp(word, "stop") == 0) {
+		sample_stop(dev);
+		sample_list(dev);
+	} else if (strcmp(word, "clear") == 0) {
+		sample_clear(dev);
+	} else if (strcmp(word, "ram") == 0) {
+		sample_ram(dev, cmd);
+	} else if (strcmp(word, "live") == 0) {
+		sample_live(dev, cmd);
+	} else if (strcmp(word, "aer") == 0) {
+		sample_aer(dev, cmd);
+	} else if (strcmp(word, "irq") == 0) {
+		sample_irq(dev, cmd);
+	} else if ((strcmp(word, "save") == 0) &&
+	           (sscanf(cmd, "%*s %*s %99s", path) == 1)) {
+		sample_save(dev, path);
+	} else {
+		printf("Syntax error (use ? for help)\n");
+	}
+	return 0;
+}
+
+int
+hist_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	struct sampler *s = dev->sampler;
+	char word[100];
+	FILE *fp = stdout;
+	int i;
+
+	if ((s == NULL) || (s->count == 0)) {
+		printf("Sampling: no registers\n");
+		return 0;
+	}
+	/* hist, hist reset, hist file */
+	if (sscanf(cmd, "%*s %99s", word) == 1) {
+		if (strcmp(word, "reset") == 0) {
+			for (i = 0; i < s->count; i++) {
+				if (s->running) {
+					hist_reset(s->reg[i].hist);
+				} else {
+					hist_clear(s->reg[i].hist);
+				}
+			}
+			return 0;
+		}
+		fp = fopen(word, "w");
+		if (fp == NULL) {
+			printf("Open failed for file '%s': errno %d, %s\n",
+				word, errno, strerror(errno));
+			return 0;
+		}
+	}
+	for (i = 0; i < s->count; i++) {
+		hist_dump(s->reg[i].hist, s->reg[i].name, s->reg[i].addr, fp);
+	}
+	if (fp != stdout) {
+		fclose(fp);
+	}
+	return 0;
+}
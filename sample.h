@@ -0,0 +1,125 @@
+/* sample.h
+ *
+ * Background register sampling.
+ *
+ * "sample add" builds a list of registers, "sample start" reads all of
+ * them once per period from a background thread (a sweep) while the
+ * prompt stays usable. Each register keeps an online histogram of the
+ * values seen ("hist"), so long runs need no capture file; when a file
+ * is given the sweeps are also appended to a columnar capture, and with
+ * "sample ram" they are kept in an in-RAM ring saved afterwards. With
+ * "sample live" they also go to a memory mapped ring file that other
+ * processes (pci_debug_tail) can follow while sampling runs. "sample
+ * aer" adds the sysfs AER error counters of the selected devices to the
+ * set (see aer.h), "sample irq" their interrupt counts (see irqrate.h).
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pci_debug.h"
+#include "hist.h"
+#include "capture.h"
+#include "ramcap.h"
+#include "livering.h"
+#include "aer.h"
+#include "irqrate.h"
+
+#define SAMPLE_MAX_REGS    64
+#define SAMPLE_PERIOD_US   1000
+
+typedef struct {
+	char          name[32];
+	unsigned int  addr;
+	int           width;    /* 8, 16, 32 or 64 */
+	hist_t       *hist;
+
+	/* AER counter rather than a register: its open sysfs file (-1 for
+	 * BAR registers; shared with the other counters of the file, which
+	 * follow it in the set), the counter name and its count at the
+	 * last sweep and at start; the value sampled is the increase since
+	 * last sweep
+	 */
+	int           aer_fd;
+	char          aer_key[24];
+	atomic_ullong aer_last;
+	uint64_t      aer_base;
+
+	/* Interrupt count rather than a register: its index in the
+	 * sampler's irqrate table (-1 for BAR registers), its total at the
+	 * last sweep and at start; sampled as the increase since last sweep
+	 */
+	int           irq_index;
+	atomic_ullong irq_last;
+	uint64_t      irq_base;
+} sample_reg_t;
+
+/* 1 for an AER counter or interrupt count, 0 for a BAR register */
+static inline int
+sample_is_pseudo(
+	const sample_reg_t *r)
+{
+	return (r->aer_fd >= 0) || (r->irq_index >= 0);
+}
+
+/* capture_col_t bar of a column */
+static inline unsigned int
+sample_column_bar(
+	const sample_reg_t *r,
+	unsigned int        bar)
+{
+	if (r->aer_fd >= 0) {
+		return AER_COLUMN_BAR;
+	}
+	return (r->irq_index >= 0) ? IRQ_COLUMN_BAR : bar;
+}
+
+struct sampler {
+	int           count;
+	sample_reg_t  reg[SAMPLE_MAX_REGS];
+	unsigned int  generation;   /* bumped whenever the set changes */
+
+	/* Background thread */
+	int           running;
+	unsigned int  period_us;
+	int           big;      /* endian mode when started */
+	pthread_t     thread;
+	atomic_int    stop;
+	atomic_ullong sweeps;
+	atomic_ullong late;     /* periods missed because a sweep overran */
+	unsigned long long start_ns;
+
+	/* Columnar capture, NULL when not logging */
+	capture_t    *capture;
+
+	/* In-RAM ring, NULL when not allocated, and the set generation its
+	 * records were taken with
+	 */
+	ramcap_t     *ram;
+	unsigned int  ram_generation;
+
+	/* /proc/interrupts, read once per sweep, NULL without irq columns */
+	irqrate_t    *irqs;
+
+	/* Live ring file, created at each start when live_path is set */
+	char          live_path[100];
+	size_t        live_size;
+	live_t       *live;
+};
+
+/* One register read in the current endian mode */
+uint64_t sample_read(device_t *dev, unsigned int addr, int width, int big);
+
+unsigned long long sample_now_ns(void);
+
+void sample_stop(device_t *dev);
+
+int sample_cmd(device_t *dev, char *cmd);
+int hist_cmd(device_t *dev, char *cmd);
+
+#endif /* SAMPLE_H */
@@ -0,0 +1,275 @@
+/* scriptopt.c
+ *
+ * Write optimizer for command files.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+
+#include "scriptopt.h"
+#include "coalesce.h"
+#include "accprof.h"
+
+typedef uint64_t vec128_t __attribute__((vector_size(16)));
+
+void
+scriptopt_start(
+	scriptopt_t *o)
+{
+	memset(o, 0, sizeof(scriptopt_t));
+}
+
+/* c, c8, c16, c32 as parsed by change_mem() */
+static int
+parse_write(
+	const char   *line,
+	int          *width,
+	unsigned int *addr,
+	unsigned int *val)
+{
+	if (line[0] != 'c') {
+		return 0;
+	}
+	*width = 32;
+	if (line[1] == ' ') {
+		return sscanf(line, "%*c %x %x", addr, val) == 2;
+	}
+	return sscanf(line, "%*c%d %x %x", width, addr, val) == 3;
+}
+
+int
+scriptopt_line(
+	scriptopt_t *o,
+	device_t    *dev,
+	const char  *line)
+{
+	scriptopt_write_t *w;
+	strategy_t s;
+	unsigned int addr;
+	unsigned int val;
+	unsigned int lo;
+	unsigned int hi;
+	int width;
+
+	if (!parse_write(line, &width, &addr, &val)) {
+		return 0;
+	}
+	/* Unaligned writes are left alone, they could only get split */
+	if (((width != 8) && (width != 16) && (width != 32)) ||
+	    (addr % (width / 8))) {
+		return 0;
+	}
+	if (((unsigned long long)addr + width / 8 > dev->size) ||
+	    !coalesce_lookup(dev, addr, width / 8, &s)) {
+		return 0;
+	}
+
+	/* Keep the span within the scratch image */
+	lo = (o->count > 0) ? o->lo : addr;
+	hi = (o->count > 0) ? o->hi : addr + width / 8;
+	if (addr < lo) {
+		lo = addr;
+	}
+	if (addr + width / 8 > hi) {
+		hi = addr + width / 8;
+	}
+	if ((o->count == SCRIPTOPT_MAX) || (hi - lo > SCRIPTOPT_SPAN)) {
+		scriptopt_flush(o, dev);
+		lo = addr;
+		hi = addr + width / 8;
+	}
+	o->lo = lo;
+	o->hi = hi;
+
+	w = &o->w[o->count++];
+	w->addr = addr;
+	w->bytes = width / 8;
+	w->max = s.width / 8;
+	w->val = val;
+	o->writes++;
+	return 1;
+}
+
+/* Bytes of a write in BAR order, in the current endian mode */
+static void
+write_bytes(
+	const scriptopt_write_t *w,
+	unsigned char           *b)
+{
+	unsigned short d16;
+	unsigned int d32;
+
+	switch (w->bytes) {
+		case 1:
+			b[0] = (unsigned char)w->val;
+			break;
+		case 2:
+			d16 = (unsigned short)w->val;
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d16 = bswap_16(d16);
+			}
+			memcpy(b, &d16, 2);
+			break;
+		default:
+			d32 = w->val;
+			if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+				d32 = bswap_32(d32);
+			}
+			memcpy(b, &d32, 4);
+			break;
+	}
+}
+
+/* Widest naturally aligned store of written bytes at off */
+static int
+store_size(
+	scriptopt_t *o,
+	unsigned int off)
+{
+	unsigned int span = o->hi - o->lo;
+	unsigned int addr = o->lo + off;
+	unsigned int i;
+	int size;
+
+	for (size = 16; size > 1; size /= 2) {
+		if ((addr % size) || (off + size > span)) {
+			continue;
+		}
+		for (i = off; i < off + size; i++) {
+			if ((o->owner[i] < 0) || (o->max[i] < size)) {
+				break;
+			}
+		}
+		if (i == off + size) {
+			break;
+		}
+	}
+	return size;
+}
+
+static void
+store(
+	device_t            *dev,
+	unsigned int         addr,
+	const unsigned char *b,
+	int                  size)
+{
+	unsigned long long t0 = accprof_begin(dev);
+	volatile unsigned char *p = dev->addr + addr;
+	unsigned short d16;
+	unsigned int d32;
+	uint64_t d64;
+	vec128_t d128;
+
+	switch (size) {
+		case 1:
+			*p = b[0];
+			break;
+		case 2:
+			memcpy(&d16, b, 2);
+			*(volatile unsigned short *)p = d16;
+			break;
+		case 4:
+			memcpy(&d32, b, 4);
+			*(volatile unsigned int *)p = d32;
+			break;
+		case 8:
+			memcpy(&d64, b, 8);
+			*(volatile uint64_t *)p = d64;
+			break;
+		default:
+			memcpy(&d128, b, 16);
+			*(volatile vec128_t *)p = d128;
+			break;
+	}
+	accprof_end(dev, t0, addr, size * 8, ACCPROF_WRITE);
+}
+
+void
+scriptopt_flush(
+	scriptopt_t *o,
+	device_t    *dev)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start;
+	unsigned int span = o->hi - o->lo;
+	unsigned int off;
+	unsigned char b[4];
+	int kept;
+	int size;
+	int i;
+	int j;
+
+	if (o->count == 0) {
+		return;
+	}
+
+	/* Apply the writes in order to the image of their span */
+	memset(o->owner, 0xFF, span * sizeof(short));
+	for (i = 0; i < o->count; i++) {
+		write_bytes(&o->w[i], b);
+		off = o->w[i].addr - o->lo;
+		for (j = 0; j < o->w[i].bytes; j++) {
+			o->data[off + j] = b[j];
+			o->owner[off + j] = (short)i;
+			o->max[off + j] = (unsigned char)o->w[i].max;
+		}
+	}
+
+	/* A write owning none of the final bytes was overwritten */
+	for (i = 0; i < o->count; i++) {
+		off = o->w[i].addr - o->lo;
+		kept = 0;
+		for (j = 0; j < o->w[i].bytes; j++) {
+			if (o->owner[off + j] == i) {
+				kept = 1;
+				break;
+			}
+		}
+		if (!kept) {
+			o->dropped++;
+		}
+	}
+
+	for (off = 0; off < span; off += size) {
+		if (o->owner[off] < 0) {
+			size = 1;
+			continue;
+		}
+		size = store_size(o, off);
+		store(dev, o->lo + off, o->data + off, size);
+		o->stores++;
+	}
+
+	/* One fence for the whole run, as FENCE_END in the bulk engine */
+	start = ((uintptr_t)dev->addr + o->lo) & ~(page - 1);
+	__sync_synchronize();
+	msync((void *)start, (uintptr_t)dev->addr + o->hi - start,
+		MS_SYNC | MS_INVALIDATE);
+
+	o->count = 0;
+	o->flushes++;
+}
+
+void
+scriptopt_report(
+	scriptopt_t *o,
+	device_t    *dev)
+{
+	if ((dev->coalesce == NULL) || (dev->coalesce->count == 0)) {
+		printf("Optimizer: no range marked with \"coalesce\", "
+			"every write was issued as written\n");
+		return;
+	}
+	printf("Optimizer: %llu writes in coalesced ranges -> %llu stores "
+		"in %llu runs (%llu overwritten and dropped, %llu merged)\n",
+		o->writes, o->stores, o->flushes, o->dropped,
+		o->writes - o->dropped - o->stores);
+	printf("Optimizer: %llu MMIO transactions saved\n",
+		o->writes - o->stores);
+}
@@ -0,0 +1,64 @@
+/* scriptopt.h
+ *
+ * Write optimizer for command files.
+ *
+ * With --optimize, useCmdFile hands every "c" line to the optimizer
+ * first. Writes that lie in a range marked with "coalesce" (plain
+ * memory, see coalesce.h) are held back instead of being issued one by
+ * one; any other line, or a write elsewhere in the BAR, flushes them
+ * first so the order against reads, fills and commands is kept. On a
+ * flush the held writes are applied to a byte image of their span:
+ * bytes written again later keep only the last value (writes fully
+ * overwritten before any read are dropped) and contiguous bytes go out
+ * as naturally aligned stores up to the width of the range (64-bit, or
+ * 128-bit vector stores), followed by a single fence. Writes outside
+ * the marked ranges are never merged nor dropped: doorbells and FIFOs
+ * must see every store, at its width.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef SCRIPTOPT_H
+#define SCRIPTOPT_H
+
+#include "pci_debug.h"
+
+/* Held writes, and the bytes they may span, before a forced flush */
+#define SCRIPTOPT_MAX   1024
+#define SCRIPTOPT_SPAN  4096
+
+typedef struct {
+	unsigned int addr;
+	int          bytes;
+	int          max;       /* widest store allowed by the range, in bytes */
+	unsigned int val;
+} scriptopt_write_t;
+
+typedef struct {
+	scriptopt_write_t  w[SCRIPTOPT_MAX];
+	int                count;
+	unsigned int       lo;          /* span of the held writes */
+	unsigned int       hi;
+
+	/* Flush scratch: value, last writer and store limit of each byte */
+	unsigned char      data[SCRIPTOPT_SPAN];
+	short              owner[SCRIPTOPT_SPAN];
+	unsigned char      max[SCRIPTOPT_SPAN];
+
+	unsigned long long writes;      /* c lines held */
+	unsigned long long dropped;     /* of which overwritten */
+	unsigned long long stores;      /* issued for them */
+	unsigned long long flushes;
+} scriptopt_t;
+
+void scriptopt_start(scriptopt_t *o);
+
+/* Returns 1 when the command line was held, 0 when the caller must
+ * flush and run it
+ */
+int scriptopt_line(scriptopt_t *o, device_t *dev, const char *line);
+
+void scriptopt_flush(scriptopt_t *o, device_t *dev);
+
+void scriptopt_report(scriptopt_t *o, device_t *dev);
+
+#endif /* SCRIPTOPT_H */
@@ -0,0 +1,195 @@
+/* scriptprof.c
+ *
+ * Per-line profiler for command files.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "scriptprof.h"
+
+/* Shortest run the tick rate is measured over */
+#define SCRIPTPROF_CALIBRATE_NS  10000000ULL
+
+void
+scriptprof_start(
+	scriptprof_t *p,
+	device_t     *dev)
+{
+	memset(p, 0, sizeof(*p));
+	p->ns0 = scriptprof_ns();
+	p->tick0 = scriptprof_tick();
+	p->last = p->tick0;
+	p->ops_last = dev->mmio_ops;
+}
+
+void
+scriptprof_mark(
+	scriptprof_t *p,
+	device_t     *dev,
+	int           lineno)
+{
+	unsigned long long now = scriptprof_tick();
+	scriptprof_line_t *l;
+	int n;
+
+	if (lineno >= p->nlines) {
+		n = (p->nlines > 0) ? p->nlines : 1024;
+		while (n <= lineno) {
+			n *= 2;
+		}
+		l = (scriptprof_line_t *)realloc(p->line, n * sizeof(scriptprof_line_t));
+		if (l == NULL) {
+			return;
+		}
+		memset(l + p->nlines, 0, (n - p->nlines) * sizeof(scriptprof_line_t));
+		p->line = l;
+		p->nlines = n;
+	}
+	l = &p->line[lineno];
+	l->ticks += now - p->last;
+	l->ops += dev->mmio_ops - p->ops_last;
+	l->runs++;
+	p->last = now;
+	p->ops_last = dev->mmio_ops;
+}
+
+/* Nanoseconds per tick over the whole run */
+static double
+scriptprof_rate(
+	scriptprof_t *p)
+{
+	struct timespec ts;
+	unsigned long long ns = scriptprof_ns();
+	unsigned long long tick = scriptprof_tick();
+
+	if (ns - p->ns0 < SCRIPTPROF_CALIBRATE_NS) {
+		/* Too short to measure the counter against the clock */
+		ts.tv_sec = 0;
+		ts.tv_nsec = SCRIPTPROF_CALIBRATE_NS;
+		nanosleep(&ts, NULL);
+		ns = scriptprof_ns();
+		tick = scriptprof_tick();
+	}
+	return (tick > p->tick0) ? (double)(ns - p->ns0) / (tick - p->tick0) : 1.0;
+}
+
+static scriptprof_line_t *sort_lines;
+
+static int
+by_ticks(
+	const void *a,
+	const void *b)
+{
+	unsigned long long x = sort_lines[*(const int *)a].ticks;
+	unsigned long long y = sort_lines[*(const int *)b].ticks;
+
+	return (x < y) - (x > y);
+}
+
+void
+scriptprof_report(
+	scriptprof_t *p,
+	const char   *script,
+	const char   *out)
+{
+	char *text[SCRIPTPROF_TOP];
+	int order[SCRIPTPROF_TOP];
+	unsigned long long ticks = 0;
+	unsigned long long ops = 0;
+	scriptprof_line_t *l;
+	int *idx;
+	int top;
+	int n = 0;
+	int i;
+	int k;
+	double rate = scriptprof_rate(p);
+	char *line = NULL;
+	size_t len = 0;
+	int lineno = 0;
+	FILE *in;
+	FILE *fp;
+
+	idx = (int *)malloc((p->nlines + 1) * sizeof(int));
+	if (idx == NULL) {
+		return;
+	}
+	for (i = 0; i < p->nlines; i++) {
+		if (p->line[i].runs > 0) {
+			idx[n++] = i;
+			ticks += p->line[i].ticks;
+			ops += p->line[i].ops;
+		}
+	}
+	sort_lines = p->line;
+	qsort(idx, n, sizeof(int), by_ticks);
+	top = (n < SCRIPTPROF_TOP) ? n : SCRIPTPROF_TOP;
+	for (k = 0; k < top; k++) {
+		order[k] = idx[k];
+		text[k] = NULL;
+	}
+	free(idx);
+
+	/* One pass over the script: annotated copy, text of the top lines */
+	in = fopen(script, "r");
+	fp = (out != NULL) ? fopen(out, "w") : NULL;
+	if ((out != NULL) && (fp == NULL)) {
+		printf("Open failed for file '%s': errno %d, %s\n",
+			out, errno, strerror(errno));
+	}
+	if (fp != NULL) {
+		fprintf(fp, "# %s: %.3f s, %llu MMIO accesses\n", script,
+			ticks * rate / 1e9, ops);
+		fprintf(fp, "#        ms        ops   line | command\n");
+	}
+	while ((in != NULL) && (getline(&line, &len, in) != -1)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		for (k = 0; k < top; k++) {
+			if (order[k] == lineno) {
+				text[k] = strdup(line);
+			}
+		}
+		if (fp == NULL) {
+			continue;
+		}
+		l = (lineno < p->nlines) ? &p->line[lineno] : NULL;
+		if ((l != NULL) && (l->runs > 0)) {
+			fprintf(fp, "%11.3f %10llu %6d | %s\n", l->ticks * rate / 1e6,
+				l->ops, lineno, line);
+		} else {
+			fprintf(fp, "%11s %10s %6d | %s\n", "", "", lineno, line);
+		}
+	}
+	free(line);
+	if (in != NULL) {
+		fclose(in);
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+
+	printf("Script profile: %d command lines, %.3f s, %llu MMIO accesses%s%s%s\n",
+		n, ticks * rate / 1e9, ops, (fp != NULL) ? " (annotated: " : "",
+		(fp != NULL) ? out : "", (fp != NULL) ? ")" : "");
+	printf("   line          ms      %%        ops  command\n");
+	for (k = 0; k < top; k++) {
+		l = &p->line[order[k]];
+		printf(" %6d %11.3f %5.1f%% %10llu  %s\n", order[k], l->ticks * rate / 1e6,
+			(ticks > 0) ? 100.0 * l->ticks / ticks : 0.0, l->ops,
+			(text[k] != NULL) ? text[k] : "");
+		free(text[k]);
+	}
+}
+
+void
+scriptprof_free(
+	scriptprof_t *p)
+{
+	free(p->line);
+	p->line = NULL;
+	p->nlines = 0;
+}
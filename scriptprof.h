@@ -0,0 +1,73 @@
+/* scriptprof.h
+ *
+ * Per-line profiler for command files.
+ *
+ * With --profile, useCmdFile marks the end of every command line: one
+ * time stamp counter read per line, the line's time being the ticks
+ * since the previous mark, plus the MMIO accesses counted meanwhile
+ * (dev->mmio_ops). A multi-line "{ }" block is charged to its first
+ * line. At the end the ticks are converted with a TSC rate measured
+ * against CLOCK_MONOTONIC over the run, the slowest lines are printed
+ * and the script is written out annotated with the time and access
+ * count of each line.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef SCRIPTPROF_H
+#define SCRIPTPROF_H
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "pci_debug.h"
+
+/* Lines in the sorted report */
+#define SCRIPTPROF_TOP  20
+
+typedef struct {
+	unsigned long long ticks;
+	unsigned long long ops;
+	unsigned int       runs;
+} scriptprof_line_t;
+
+typedef struct {
+	scriptprof_line_t *line;      /* by line number */
+	int                nlines;    /* allocated */
+	unsigned long long last;      /* ticks at the previous mark */
+	unsigned long long ops_last;
+	unsigned long long tick0;     /* at start, for the tick rate */
+	unsigned long long ns0;
+} scriptprof_t;
+
+static inline unsigned long long
+scriptprof_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long
+scriptprof_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return scriptprof_ns();
+#endif
+}
+
+void scriptprof_start(scriptprof_t *p, device_t *dev);
+
+/* End of the command on line lineno */
+void scriptprof_mark(scriptprof_t *p, device_t *dev, int lineno);
+
+/* Sorted report on stdout, annotated copy of script in out */
+void scriptprof_report(scriptprof_t *p, const char *script, const char *out);
+
+void scriptprof_free(scriptprof_t *p);
+
+#endif /* SCRIPTPROF_H */
@@ -0,0 +1,560 @@
+/* sriov.c
+ *
+ * SR-IOV: commands across the virtual functions of this device.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <byteswap.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sriov.h"
+#include "bulk.h"
+#include "config.h"
+
+typedef struct {
+	int          write;
+	int          width;
+	unsigned int addr;
+	unsigned int len;       /* d: bytes read */
+	unsigned int val;       /* c */
+	unsigned int offset;    /* d: of the bytes in vf_t.data */
+	char         text[48];
+} vf_op_t;
+
+typedef struct {
+	int            index;       /* N of virtfnN */
+	char           name[16];    /* slot of the VF */
+	char           error[80];   /* empty when all went well */
+	unsigned char *data;        /* what the d commands read */
+} vf_t;
+
+typedef struct {
+	vf_t          *vfs;
+	int            count;
+	int            bar;
+	vf_op_t        ops[SRIOV_MAX_OPS];
+	int            nops;
+	unsigned int   bytes;       /* read per VF */
+	atomic_int     next;
+} vf_run_t;
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int
+vf_cmp(
+	const void *a,
+	const void *b)
+{
+	return ((const vf_t *)a)->index - ((const vf_t *)b)->index;
+}
+
+/* Small sysfs attribute of the device, -1 when absent */
+static long
+sysfs_long(
+	const char *dir,
+	const char *attr)
+{
+	char path[192];
+	char buf[32];
+	long val = -1;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return -1;
+	}
+	if (fgets(buf, sizeof(buf), fp) != NULL) {
+		val = strtol(buf, NULL, 0);
+	}
+	fclose(fp);
+	return val;
+}
+
+/* The VFs of this device in virtfn order, NULL (and a message) when
+ * there are none
+ */
+static vf_t *
+vf_list(
+	device_t *dev,
+	int      *count)
+{
+	struct dirent *e;
+	char dir[128];
+	char path[192];
+	char link[256];
+	const char *slot;
+	vf_t *vfs = NULL;
+	vf_t *p;
+	ssize_t len;
+	long total;
+	int index;
+	int n = 0;
+	DIR *d;
+
+	*count = 0;
+	if (config_dir(dev, dir, sizeof(dir)) < 0) {
+		printf("Error: %s has no sysfs directory (file stand-in)\n", dev->filename);
+		return NULL;
+	}
+	d = opendir(dir);
+	if (d == NULL) {
+		printf("Open failed for directory '%s': errno %d, %s\n",
+			dir, errno, strerror(errno));
+		return NULL;
+	}
+	while ((e = readdir(d)) != NULL) {
+		if (sscanf(e->d_name, "virtfn%d", &index) != 1) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%.31s", dir, e->d_name);
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len <= 0) {
+			continue;
+		}
+		link[len] = '\0';
+		slot = strrchr(link, '/');
+		slot = (slot != NULL) ? slot + 1 : link;
+		p = (vf_t *)realloc(vfs, (n + 1) * sizeof(vf_t));
+		if (p == NULL) {
+			break;
+		}
+		vfs = p;
+		memset(&vfs[n], 0, sizeof(vf_t));
+		vfs[n].index = index;
+		snprintf(vfs[n].name, sizeof(vfs[n].name), "%.15s", slot);
+		n++;
+	}
+	closedir(d);
+
+	if (n == 0) {
+		total = sysfs_long(dir, "sriov_totalvfs");
+		if (total < 0) {
+			printf("%s is not an SR-IOV physical function\n", dir);
+		} else {
+			printf("No VFs enabled (up to %ld: echo N > %s/sriov_numvfs)\n",
+				total, dir);
+		}
+		return NULL;
+	}
+	qsort(vfs, n, sizeof(vf_t), vf_cmp);
+	*count = n;
+	return vfs;
+}
+
+/* "d[8|16|32] addr len" or "c[8|16|32] addr val", 0 on a syntax error */
+static int
+vf_op_parse(
+	const char *s,
+	vf_op_t    *op)
+{
+	int status;
+
+	memset(op, 0, sizeof(vf_op_t));
+	op->width = 32;
+	if ((s[0] != 'c') && (s[0] != 'd')) {
+		return 0;
+	}
+	op->write = (s[0] == 'c');
+	if (s[1] == ' ') {
+		status = sscanf(s, "%*c %x %x", &op->addr, &op->val) + 1;
+	} else {
+		status = sscanf(s, "%*c%d %x %x", &op->width, &op->addr, &op->val);
+	}
+	if ((status != 3) || ((op->width != 8) && (op->width != 16) && (op->width != 32))) {
+		return 0;
+	}
+	if (!op->write) {
+		/* Whole registers, at least one */
+		op->len = op->val - op->val % (op->width / 8);
+		if (op->len == 0) {
+			op->len = op->width / 8;
+		}
+	}
+	snprintf(op->text, sizeof(op->text), "%.*s", (int)strcspn(s, "\r\n"), s);
+	return 1;
+}
+
+/* Adds the commands of a ';' separated list (or a line of a file) */
+static int
+vf_ops_add(
+	vf_run_t *run,
+	char     *list)
+{
+	char *save = NULL;
+	char *s;
+
+	for (s = strtok_r(list, ";\r\n", &save); s != NULL;
+	     s = strtok_r(NULL, ";\r\n", &save)) {
+		s += strspn(s, " \t");
+		if ((*s == '\0') || (*s == '#')) {
+			continue;
+		}
+		if (run->nops == SRIOV_MAX_OPS) {
+			printf("Error: at most %d commands\n", SRIOV_MAX_OPS);
+			return -1;
+		}
+		if (!vf_op_parse(s, &run->ops[run->nops])) {
+			printf("Error: '%s': only d and c commands run on VFs\n", s);
+			return -1;
+		}
+		run->nops++;
+	}
+	return 0;
+}
+
+static int
+vf_script(
+	vf_run_t   *run,
+	const char *path)
+{
+	char line[256];
+	int bar;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		printf("Error: cannot open %s\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "bar%d", &bar) == 1) {
+			run->bar = bar;
+		} else if (vf_ops_add(run, line) < 0) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+static void
+vf_run_one(
+	vf_run_t *run,
+	vf_t     *vf)
+{
+	device_t dev;
+	vf_op_t *op;
+	strategy_t s = STRATEGY_DEFAULT;
+	unsigned char b[4];
+	uint16_t d16;
+	uint32_t d32;
+	int i;
+
+	if (vf->error[0] != '\0') {
+		return;
+	}
+	memset(&dev, 0, sizeof(dev));
+	dev.bar = run->bar;
+	if (dev_open(&dev, vf->name, NULL) < 0) {
+		snprintf(vf->error, sizeof(vf->error), "cannot open BAR%d", run->bar);
+		return;
+	}
+	for (i = 0; i < run->nops; i++) {
+		op = &run->ops[i];
+		if ((unsigned long long)op->addr + (op->write ? op->width / 8 : op->len) > dev.size) {
+			snprintf(vf->error, sizeof(vf->error),
+				"%.40s: beyond the BAR (%.8X bytes)", op->text, dev.size);
+			break;
+		}
+		s.width = op->width;
+		if (!op->write) {
+			if (bulk_read(&dev, &s, op->addr, vf->data + op->offset, op->len, NULL) <
+			    op->len) {
+				snprintf(vf->error, sizeof(vf->error), "%.40s: interrupted", op->text);
+				break;
+			}
+			continue;
+		}
+		switch (op->width) {
+			case 8:
+				b[0] = (unsigned char)op->val;
+				break;
+			case 16:
+				d16 = (uint16_t)op->val;
+				if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+					d16 = bswap_16(d16);
+				}
+				memcpy(b, &d16, 2);
+				break;
+			default:
+				d32 = op->val;
+				if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+					d32 = bswap_32(d32);
+				}
+				memcpy(b, &d32, 4);
+				break;
+		}
+		if (bulk_write(&dev, &s, op->addr, b, op->width / 8, NULL) <
+		    (unsigned int)op->width / 8) {
+			snprintf(vf->error, sizeof(vf->error), "%.40s: interrupted", op->text);
+			break;
+		}
+	}
+	dev_close(&dev);
+}
+
+static void *
+vf_thread(
+	void *arg)
+{
+	vf_run_t *run = (vf_run_t *)arg;
+	int i;
+
+	while ((i = atomic_fetch_add(&run->next, 1)) < run->count) {
+		vf_run_one(run, &run->vfs[i]);
+	}
+	return NULL;
+}
+
+/* "0-61,63" */
+static void
+print_indexes(
+	vf_t *vfs,
+	int  *members,
+	int   n)
+{
+	int i;
+	int k;
+
+	for (i = 0; i < n; i = k) {
+		for (k = i + 1; (k < n) &&
+		     (vfs[members[k]].index == vfs[members[k - 1]].index + 1); k++) {
+		}
+		printf("%s%d", (i > 0) ? "," : "", vfs[members[i]].index);
+		if (k - i > 1) {
+			printf("-%d", vfs[members[k - 1]].index);
+		}
+	}
+}
+
+static void
+print_values(
+	const vf_op_t       *op,
+	const unsigned char *data)
+{
+	unsigned int i;
+	uint16_t d16;
+	uint32_t d32;
+
+	for (i = 0; i < op->len; i += op->width / 8) {
+		if ((op->len > 16) && (i % 16 == 0)) {
+			printf("\n    %.8X:", op->addr + i);
+		}
+		switch (op->width) {
+			case 8:
+				printf(" %.2X", data[i]);
+				break;
+			case 16:
+				memcpy(&d16, data + i, 2);
+				if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+					d16 = bswap_16(d16);
+				}
+				printf(" %.4X", d16);
+				break;
+			default:
+				memcpy(&d32, data + i, 4);
+				if ((big_endian != 0) == (__BYTE_ORDER == __LITTLE_ENDIAN)) {
+					d32 = bswap_32(d32);
+				}
+				printf(" %.8X", d32);
+				break;
+		}
+	}
+	printf("\n");
+}
+
+/* VFs that read the same bytes are listed together, largest group first */
+static void
+vf_report(
+	vf_run_t *run,
+	double    ms)
+{
+	vf_op_t *op;
+	int *group;
+	int *members;
+	int *sizes;
+	int ngroups;
+	int nmembers;
+	int failed = 0;
+	int g;
+	int best;
+	int i;
+	int v;
+
+	printf("%d VFs, BAR%d, %d commands, %.3f ms\n", run->count, run->bar, run->nops, ms);
+	for (v = 0; v < run->count; v++) {
+		if (run->vfs[v].error[0] != '\0') {
+			printf("  VF %d %s: %s\n", run->vfs[v].index, run->vfs[v].name,
+				run->vfs[v].error);
+			failed++;
+		}
+	}
+
+	group = (int *)malloc(run->count * sizeof(int));
+	members = (int *)malloc(run->count * sizeof(int));
+	sizes = (int *)calloc(run->count, sizeof(int));
+	if ((group == NULL) || (members == NULL) || (sizes == NULL)) {
+		free(group);
+		free(members);
+		free(sizes);
+		return;
+	}
+	for (i = 0; i < run->nops; i++) {
+		op = &run->ops[i];
+		if (op->write) {
+			printf("%s: written on %d VFs\n", op->text, run->count - failed);
+			continue;
+		}
+		printf("%s:\n", op->text);
+
+		/* group[v]: first VF with the same bytes */
+		memset(sizes, 0, run->count * sizeof(int));
+		ngroups = 0;
+		for (v = 0; v < run->count; v++) {
+			group[v] = -1;
+			if (run->vfs[v].error[0] != '\0') {
+				continue;
+			}
+			for (g = 0; g < v; g++) {
+				if ((group[g] == g) && (memcmp(run->vfs[g].data + op->offset,
+				    run->vfs[v].data + op->offset, op->len) == 0)) {
+					break;
+				}
+			}
+			group[v] = (g < v) ? g : v;
+			ngroups += (group[v] == v);
+			sizes[group[v]]++;
+		}
+		while (ngroups-- > 0) {
+			best = -1;
+			for (g = 0; g < run->count; g++) {
+				if ((sizes[g] > 0) && ((best < 0) || (sizes[g] > sizes[best]))) {
+					best = g;
+				}
+			}
+			nmembers = 0;
+			for (v = 0; v < run->count; v++) {
+				if (group[v] == best) {
+					members[nmembers++] = v;
+				}
+			}
+			printf("  VF ");
+			print_indexes(run->vfs, members, nmembers);
+			printf(" (%d):", nmembers);
+			print_values(op, run->vfs[best].data + op->offset);
+			sizes[best] = 0;
+		}
+	}
+	free(group);
+	free(members);
+	free(sizes);
+}
+
+int
+sriov_cmd(
+	device_t *dev,
+	char     *cmd)
+{
+	pthread_t threads[SRIOV_THREADS];
+	char path[256];
+	char *rest;
+	vf_run_t *run;
+	double t0;
+	int started;
+	int status = 0;
+	int bar;
+	int i;
+	int v;
+
+	run = (vf_run_t *)calloc(1, sizeof(vf_run_t));
+	if (run == NULL) {
+		printf("Error: out of memory\n");
+		return 0;
+	}
+	run->bar = dev->bar;
+	run->vfs = vf_list(dev, &run->count);
+	if (run->vfs == NULL) {
+		free(run);
+		return 0;
+	}
+
+	/* vf, vf [-b bar] cmds, vf script file */
+	rest = cmd + strcspn(cmd, " \t\r\n");
+	rest += strspn(rest, " \t\r\n");
+	if (*rest == '\0') {
+		for (v = 0; v < run->count; v++) {
+			printf("  VF %-3d %s\n", run->vfs[v].index, run->vfs[v].name);
+		}
+		free(run->vfs);
+		free(run);
+		return 0;
+	}
+	if (sscanf(rest, "-b %d", &bar) == 1) {
+		run->bar = bar;
+		rest += 2;
+		rest += strspn(rest, " \t");
+		rest += strspn(rest, "0123456789");
+	}
+	if (sscanf(rest, "script %255s", path) == 1) {
+		status = vf_script(run, path);
+	} else {
+		status = vf_ops_add(run, rest);
+	}
+	if ((status == 0) && (run->nops == 0)) {
+		printf("Syntax error: vf [-b bar] cmd[; cmd...] | vf script file\n");
+		status = -1;
+	}
+
+	if (status == 0) {
+		for (i = 0; i < run->nops; i++) {
+			run->ops[i].offset = run->bytes;
+			run->bytes += run->ops[i].len;
+		}
+		for (v = 0; v < run->count; v++) {
+			run->vfs[v].data = (unsigned char *)calloc(1, run->bytes + 1);
+			if (run->vfs[v].data == NULL) {
+				snprintf(run->vfs[v].error, sizeof(run->vfs[v].error),
+					"out of memory");
+			}
+		}
+
+		t0 = now_ms();
+		atomic_init(&run->next, 0);
+		for (started = 0; (started < SRIOV_THREADS) && (started < run->count); started++) {
+			if (pthread_create(&threads[started], NULL, vf_thread, run) != 0) {
+				break;
+			}
+		}
+		/* Whatever the threads did not get to, done here */
+		vf_thread(run);
+		for (i = 0; i < started; i++) {
+			pthread_join(threads[i], NULL);
+		}
+		vf_report(run, now_ms() - t0);
+	}
+
+	for (v = 0; v < run->count; v++) {
+		free(run->vfs[v].data);
+	}
+	free(run->vfs);
+	free(run);
+	return 0;
+}
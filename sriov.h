@@ -0,0 +1,28 @@
+/* sriov.h
+ *
+ * SR-IOV: commands across the virtual functions of this device.
+ *
+ * "vf" lists the VFs of the physical function (the virtfnN links of
+ * its sysfs directory). "vf [-b bar] cmds" runs d and c commands (';'
+ * separated) on every VF, "vf script file" the d and c lines of a
+ * commands file (its barN line picks the VF BAR). The VFs are opened,
+ * mapped and run by a pool of at most SRIOV_THREADS threads, and the
+ * results collated per command: VFs that read the same values are
+ * listed together, so the odd ones out stand out among 64 VFs.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef SRIOV_H
+#define SRIOV_H
+
+#include "pci_debug.h"
+
+/* Worker threads, whatever the VF count */
+#define SRIOV_THREADS  8
+
+/* Commands per run */
+#define SRIOV_MAX_OPS  64
+
+int sriov_cmd(device_t *dev, char *cmd);
+
+#endif /* SRIOV_H */
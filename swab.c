@@ -0,0 +1,220 @@
+/* swab.c
+ *
+ * Vectorized in-place byte swapping.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdint.h>
+#include <string.h>
+#include <byteswap.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SWAB_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SWAB_NEON
+#endif
+
+#include "swab.h"
+
+#define SWAB_SCALAR  0
+#define SWAB_SSSE3   1
+#define SWAB_AVX2    2
+#define SWAB_NEONV   3
+
+static const char *impl_names[] = { "scalar", "ssse3", "avx2", "neon" };
+
+static int
+swab_level(void)
+{
+	/* Worst case two threads both probe, with the same answer */
+	static int level = -1;
+
+	if (level < 0) {
+#if defined(SWAB_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			level = SWAB_AVX2;
+		} else if (__builtin_cpu_supports("ssse3")) {
+			level = SWAB_SSSE3;
+		} else {
+			level = SWAB_SCALAR;
+		}
+#elif defined(SWAB_NEON)
+		level = SWAB_NEONV;
+#else
+		level = SWAB_SCALAR;
+#endif
+	}
+	return level;
+}
+
+const char *
+swab_impl(void)
+{
+	return impl_names[swab_level()];
+}
+
+/* ----------------------------------------------------------------
+ * Scalar
+ * ----------------------------------------------------------------
+ */
+static void
+swab16_scalar(
+	unsigned char *p,
+	size_t         n)
+{
+	uint16_t d16;
+	size_t i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		memcpy(&d16, p + i, 2);
+		d16 = bswap_16(d16);
+		memcpy(p + i, &d16, 2);
+	}
+}
+
+static void
+swab32_scalar(
+	unsigned char *p,
+	size_t         n)
+{
+	uint32_t d32;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		memcpy(&d32, p + i, 4);
+		d32 = bswap_32(d32);
+		memcpy(p + i, &d32, 4);
+	}
+}
+
+/* ----------------------------------------------------------------
+ * x86: PSHUFB with a per-lane byte permutation
+ * ----------------------------------------------------------------
+ */
+#ifdef SWAB_X86
+__attribute__((target("avx2")))
+static size_t
+swab_avx2(
+	unsigned char *p,
+	size_t         n,
+	int            size)
+{
+	__m256i mask;
+	__m256i v;
+	size_t i;
+
+	if (size == 2) {
+		mask = _mm256_setr_epi8(
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	} else {
+		mask = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	}
+	for (i = 0; i + 32 <= n; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i));
+		v = _mm256_shuffle_epi8(v, mask);
+		_mm256_storeu_si256((__m256i *)(p + i), v);
+	}
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t
+swab_ssse3(
+	unsigned char *p,
+	size_t         n,
+	int            size)
+{
+	__m128i mask;
+	__m128i v;
+	size_t i;
+
+	if (size == 2) {
+		mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	} else {
+		mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	}
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		v = _mm_shuffle_epi8(v, mask);
+		_mm_storeu_si128((__m128i *)(p + i), v);
+	}
+	return i;
+}
+#endif
+
+/* ----------------------------------------------------------------
+ * ARM: REV16/REV32 on q registers
+ * ----------------------------------------------------------------
+ */
+#ifdef SWAB_NEON
+static size_t
+swab_neon(
+	unsigned char *p,
+	size_t         n,
+	int            size)
+{
+	uint8x16_t v;
+	size_t i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = vld1q_u8(p + i);
+		v = (size == 2) ? vrev16q_u8(v) : vrev32q_u8(v);
+		vst1q_u8(p + i, v);
+	}
+	return i;
+}
+#endif
+
+/* Vector body, returns the number of bytes done */
+static size_t
+swab_vector(
+	unsigned char *p,
+	size_t         n,
+	int            size)
+{
+	switch (swab_level()) {
+#ifdef SWAB_X86
+		case SWAB_AVX2:
+			return swab_avx2(p, n, size);
+		case SWAB_SSSE3:
+			return swab_ssse3(p, n, size);
+#endif
+#ifdef SWAB_NEON
+		case SWAB_NEONV:
+			return swab_neon(p, n, size);
+#endif
+		default:
+			return 0;
+	}
+}
+
+void
+swab16_buf(
+	void   *buf,
+	size_t  len)
+{
+	unsigned char *p = (unsigned char *)buf;
+	size_t done;
+
+	done = swab_vector(p, len, 2);
+	swab16_scalar(p + done, len - done);
+}
+
+void
+swab32_buf(
+	void   *buf,
+	size_t  len)
+{
+	unsigned char *p = (unsigned char *)buf;
+	size_t done;
+
+	done = swab_vector(p, len, 4);
+	swab32_scalar(p + done, len - done);
+}
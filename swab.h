@@ -0,0 +1,23 @@
+/* swab.h
+ *
+ * In-place byte swapping of whole buffers of 16 or 32-bit elements.
+ *
+ * Big-endian bulk transfers swap a chunk at a time in vector
+ * registers (AVX2 or SSSE3 PSHUFB, NEON REV16/REV32), picked at run
+ * time, instead of one bswap per element.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef SWAB_H
+#define SWAB_H
+
+#include <stddef.h>
+
+/* len is in bytes, a trailing partial element is left alone */
+void swab16_buf(void *buf, size_t len);
+void swab32_buf(void *buf, size_t len);
+
+/* Name of the implementation in use, for reports */
+const char *swab_impl(void);
+
+#endif /* SWAB_H */
@@ -0,0 +1,127 @@
+/* pci_debug_tail.c
+ *
+ * Follow a live capture ring ("sample live") from another process.
+ *
+ * Usage: pci_debug_tail [-f] [-e] [-c] [-n count] ring
+ *
+ *   -f  follow: wait for new records until the sampler stops
+ *   -e  start at the end, only records written from now on
+ *   -c  CSV output (t_ns,reg,...) instead of name=value
+ *   -n  stop after count records
+ *
+ * Records overwritten before they could be read are reported on
+ * stderr ("overrun"), the output itself never contains torn records.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "livering.h"
+
+/* Poll interval while waiting for the sampler */
+#define TAIL_POLL_US  1000
+
+static void
+show_usage(void)
+{
+	fprintf(stderr, "\nUsage: pci_debug_tail [-f] [-e] [-c] [-n count] ring\n"
+		"  -f          Follow: wait for new records until the sampler stops\n"
+		"  -e          Start at the end (only new records)\n"
+		"  -c          CSV output\n"
+		"  -n <count>  Stop after count records\n\n");
+}
+
+int
+main(
+	int   argc,
+	char *argv[])
+{
+	live_reader_t r;
+	capture_col_t *cols;
+	unsigned long long count = 0;
+	unsigned long long n = 0;
+	unsigned long long lost_total = 0;
+	uint64_t rec[1 + LIVE_MAX_REGS];
+	uint64_t lost;
+	int follow = 0;
+	int from_end = 0;
+	int csv = 0;
+	int status;
+	int opt;
+	uint32_t i;
+
+	while ((opt = getopt(argc, argv, "fecn:h")) != -1) {
+		switch (opt) {
+			case 'f':
+				follow = 1;
+				break;
+			case 'e':
+				from_end = 1;
+				break;
+			case 'c':
+				csv = 1;
+				break;
+			case 'n':
+				count = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				show_usage();
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		show_usage();
+		return 1;
+	}
+	if (live_open(&r, argv[optind], from_end) < 0) {
+		return 1;
+	}
+	cols = LIVE_COLS(r.hdr);
+	if (csv) {
+		printf("t_ns");
+		for (i = 0; i < r.hdr->nregs; i++) {
+			printf(",%s", cols[i].name);
+		}
+		printf("\n");
+	}
+
+	while ((count == 0) || (n < count)) {
+		status = live_next(&r, rec, &lost);
+		if (lost > 0) {
+			fflush(stdout);
+			fprintf(stderr, "overrun: %llu records lost\n", (unsigned long long)lost);
+			lost_total += lost;
+		}
+		if (status < 0) {
+			break;
+		}
+		if (status == 0) {
+			if (!follow) {
+				break;
+			}
+			fflush(stdout);
+			usleep(TAIL_POLL_US);
+			continue;
+		}
+		printf("%llu", (unsigned long long)rec[0]);
+		for (i = 0; i < r.hdr->nregs; i++) {
+			if (csv) {
+				printf(",%.*llX", cols[i].width / 4, (unsigned long long)rec[1 + i]);
+			} else {
+				printf(" %s=%.*llX", cols[i].name, cols[i].width / 4,
+					(unsigned long long)rec[1 + i]);
+			}
+		}
+		printf("\n");
+		n++;
+	}
+	fflush(stdout);
+	if (lost_total > 0) {
+		fprintf(stderr, "%llu records read, %llu lost to overruns\n", n, lost_total);
+	}
+	live_reader_close(&r);
+	return 0;
+}
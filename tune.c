@@ -0,0 +1,470 @@
+/* tune.c
+ *
+ * Access-strategy tuner and per-device profile cache.
+ *
+ * The search is greedy: starting from the default strategy, each
+ * dimension (width, mapping, threads, chunk, fence) is swept in turn
+ * with the others held at their best value so far. That is a few
+ * dozen timed transfers instead of the full cartesian product.
+ *
+ * The write benchmark stores the window's own contents back, and the
+ * window is restored at the end, so tuning a plain memory window is
+ * not destructive. Do not tune FIFOs or registers with side effects.
+ *
+ * ----------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "tune.h"
+#include "cancel.h"
+
+/* Each trial runs for at least this long (or TUNE_MAX_REPS times) */
+#define TUNE_MIN_TIME  0.1
+#define TUNE_MAX_REPS  8
+
+/* Smallest transfer timed in one go */
+#define TUNE_SLICE     (256*1024)
+
+static const char *op_names[] = { "read", "write" };
+static const char *fence_names[] = { "access", "chunk", "end" };
+
+static const char *
+profile_path(void)
+{
+	static char path[512];
+	const char *env;
+	const char *home;
+
+	env = getenv("PCI_DEBUG_PROFILES");
+	if ((env != NULL) && (env[0] != '\0')) {
+		return env;
+	}
+	home = getenv("HOME");
+	snprintf(path, sizeof(path), "%s/.pci_debug_profiles",
+		(home != NULL) ? home : ".");
+	return path;
+}
+
+/* Parse one profile line, returns the op or -1 */
+static int
+profile_parse(
+	const char      *line,
+	unsigned int    *vendor,
+	unsigned int    *device,
+	unsigned int    *bar,
+	profile_entry_t *e)
+{
+	char op[8];
+	char map[4];
+	char fence[8];
+	int status;
+	int i;
+	int o = -1;
+
+	if (line[0] == '#') {
+		return -1;
+	}
+	memset(e, 0, sizeof(*e));
+	status = sscanf(line, "%x:%x:%u %7s %x %x %d %3s %d %u %7s %lf",
+		vendor, device, bar, op, &e->addr, &e->len,
+		&e->s.width, map, &e->s.threads, &e->s.chunk, fence, &e->mbps);
+	if (status != 12) {
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		if (strcmp(op, op_names[i]) == 0) {
+			o = i;
+		}
+	}
+	e->s.map = (strcmp(map, "wc") == 0) ? MAP_WC : MAP_UC;
+	e->s.fence = -1;
+	for (i = 0; i < 3; i++) {
+		if (strcmp(fence, fence_names[i]) == 0) {
+			e->s.fence = i;
+		}
+	}
+	/* Reject anything the bulk engine cannot run */
+	if ((o < 0) || (e->s.fence < 0) ||
+	    ((e->s.width != 8) && (e->s.width != 16) &&
+	     (e->s.width != 32) && (e->s.width != 64) && (e->s.width != 128)) ||
+	    (e->s.threads < 1) || (e->s.chunk < BULK_MIN_CHUNK) ||
+	    (e->s.chunk % BULK_MIN_CHUNK)) {
+		return -1;
+	}
+	e->valid = 1;
+	return o;
+}
+
+static void
+profile_format(
+	char                  *buf,
+	int                    len,
+	device_t              *dev,
+	int                    op,
+	const profile_entry_t *e)
+{
+	snprintf(buf, len, "%04x:%04x:%u %s %.8X %.8X %d %s %d %u %s %.1f\n",
+		dev->vendor, dev->device, dev->bar, op_names[op],
+		e->addr, e->len, e->s.width,
+		(e->s.map == MAP_WC) ? "wc" : "uc",
+		e->s.threads, e->s.chunk, fence_names[e->s.fence], e->mbps);
+}
+
+void
+profile_load(
+	device_t *dev)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int vendor;
+	unsigned int device;
+	unsigned int bar;
+	profile_entry_t e;
+	int op;
+
+	fp = fopen(profile_path(), "r");
+	if (fp == NULL) {
+		return;
+	}
+	while (getline(&line, &len, fp) != -1) {
+		op = profile_parse(line, &vendor, &device, &bar, &e);
+		if ((op < 0) || (vendor != dev->vendor) ||
+		    (device != dev->device) || (bar != dev->bar)) {
+			continue;
+		}
+		if (dev->profile == NULL) {
+			dev->profile = (struct profile *)calloc(1, sizeof(struct profile));
+			if (dev->profile == NULL) {
+				break;
+			}
+		}
+		/* Later lines win */
+		dev->profile->op[op] = e;
+	}
+	free(line);
+	fclose(fp);
+}
+
+const strategy_t *
+profile_lookup(
+	device_t     *dev,
+	int           op,
+	unsigned int  addr,
+	unsigned int  len)
+{
+	profile_entry_t *e;
+
+	if ((dev->profile == NULL) || (len < PROFILE_MIN_BYTES)) {
+		return NULL;
+	}
+	e = &dev->profile->op[op];
+	/* Only inside the window that was tuned (and hence known to be
+	 * plain memory)
+	 */
+	if (!e->valid || (addr < e->addr) ||
+	    ((unsigned long long)addr + len > (unsigned long long)e->addr + e->len)) {
+		return NULL;
+	}
+	if ((e->s.map == MAP_WC) && (dev->wc_addr == NULL)) {
+		return NULL;
+	}
+	return &e->s;
+}
+
+/* Replace this device's line for op in the profile file */
+static int
+profile_save(
+	device_t              *dev,
+	int                    op,
+	const profile_entry_t *e)
+{
+	const char *path = profile_path();
+	char tmppath[520];
+	char newline[160];
+	FILE *in;
+	FILE *out;
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int vendor;
+	unsigned int device;
+	unsigned int bar;
+	profile_entry_t old;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	out = fopen(tmppath, "w");
+	if (out == NULL) {
+		printf("Error: cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	in = fopen(path, "r");
+	if (in == NULL) {
+		fprintf(out, "# pci_debug access profiles\n");
+		fprintf(out, "# vendor:device:bar op addr len width map threads chunk fence MB/s\n");
+	} else {
+		while (getline(&line, &len, in) != -1) {
+			if ((profile_parse(line, &vendor, &device, &bar, &old) == op) &&
+			    (vendor == dev->vendor) && (device == dev->device) &&
+			    (bar == dev->bar)) {
+				continue;
+			}
+			fputs(line, out);
+		}
+		free(line);
+		fclose(in);
+	}
+	profile_format(newline, sizeof(newline), dev, op, e);
+	fputs(newline, out);
+	if (fclose(out) != 0) {
+		printf("Error: cannot write '%s': %s\n", tmppath, strerror(errno));
+		return -1;
+	}
+	if (rename(tmppath, path) != 0) {
+		printf("Error: cannot update '%s': %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* ----------------------------------------------------------------
+ * Benchmarks
+ * ----------------------------------------------------------------
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Throughput of one strategy in MB/s, 0 when cancelled.
+ *
+ * The window is walked in slices so that a hopeless configuration
+ * (e.g. a fence per access) gives up after TUNE_MIN_TIME instead of
+ * crawling through the whole window TUNE_MAX_REPS times.
+ */
+static double
+tune_trial(
+	device_t         *dev,
+	int               op,
+	const strategy_t *s,
+	unsigned int      addr,
+	unsigned char    *buf,
+	unsigned int      len)
+{
+	double start;
+	double elapsed;
+	unsigned long long bytes = 0;
+	unsigned long long total;
+	unsigned int slice;
+	unsigned int off = 0;
+	unsigned int n;
+	unsigned int done;
+
+	slice = s->chunk * s->threads;
+	if (slice < TUNE_SLICE) {
+		slice = TUNE_SLICE;
+	}
+	total = (unsigned long long)len * TUNE_MAX_REPS;
+
+	start = now();
+	while (bytes < total) {
+		n = len - off;
+		if (n > slice) {
+			n = slice;
+		}
+		if (op == PROFILE_READ) {
+			done = bulk_read(dev, s, addr + off, buf + off, n, NULL);
+		} else {
+			done = bulk_write(dev, s, addr + off, buf + off, n, NULL);
+		}
+		if (done < n) {
+			return 0;
+		}
+		bytes += n;
+		off = (off + n < len) ? off + n : 0;
+		if (now() - start >= TUNE_MIN_TIME) {
+			break;
+		}
+	}
+	elapsed = now() - start;
+	return (elapsed > 0) ? bytes / elapsed / 1e6 : 0;
+}
+
+static void
+tune_report(
+	int               op,
+	const strategy_t *s,
+	double            mbps)
+{
+	char str[64];
+
+	if (verbosity >= 2) {
+		printf("  %-5s %-32s %10.1f MB/s\n", op_names[op],
+			strategy_str(s, str, sizeof(str)), mbps);
+	}
+}
+
+/* Greedy search for op, returns the best throughput found */
+static double
+tune_op(
+	device_t      *dev,
+	int            op,
+	unsigned int   addr,
+	unsigned char *buf,
+	unsigned int   len,
+	strategy_t    *best)
+{
+	static const int widths[] = { 8, 16, 32, 64, 128 };
+	static const int threads[] = { 1, 2, 4, 8 };
+	static const unsigned int chunks[] = { 4096, 16384, 65536, 262144, 1048576 };
+	strategy_t s;
+	double best_mbps;
+	double mbps;
+	long ncpu;
+	int dim;
+	int i;
+	int n;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	best->width = 32;
+	best->map = MAP_UC;
+	best->threads = 1;
+	best->chunk = 65536;
+	best->fence = FENCE_END;
+	best_mbps = tune_trial(dev, op, best, addr, buf, len);
+	tune_report(op, best, best_mbps);
+
+	for (dim = 0; dim < 5; dim++) {
+		n = 0;
+		switch (dim) {
+			case 0: n = 5; break;
+			case 1: n = (dev->wc_addr != NULL) ? 2 : 0; break;
+			case 2: n = 4; break;
+			case 3: n = 5; break;
+			case 4: n = (op == PROFILE_WRITE) ? 3 : 0; break;
+		}
+		for (i = 0; i < n; i++) {
+			if (cancel_pending()) {
+				return 0;
+			}
+			s = *best;
+			switch (dim) {
+				case 0: s.width = widths[i]; break;
+				case 1: s.map = i; break;
+				case 2: s.threads = threads[i]; break;
+				case 3: s.chunk = chunks[i]; break;
+				case 4: s.fence = i; break;
+			}
+			if (memcmp(&s, best, sizeof(s)) == 0) {
+				continue;
+			}
+			/* Pointless configurations */
+			if ((s.threads > ncpu) ||
+			    ((dim == 3) && (i > 0) && (chunks[i-1] >= len))) {
+				continue;
+			}
+			mbps = tune_trial(dev, op, &s, addr, buf, len);
+			tune_report(op, &s, mbps);
+			if (mbps > best_mbps) {
+				best_mbps = mbps;
+				*best = s;
+			}
+		}
+	}
+	return best_mbps;
+}
+
+int
+tune_mem(
+	device_t *dev,
+	char     *cmd)
+{
+	/* Plain 32-bit accesses to save and restore the window */
+	const strategy_t safe = { 32, MAP_UC, 1, 65536, FENCE_CHUNK };
+	unsigned int addr = 0;
+	unsigned int len = 0;
+	unsigned char *saved;
+	unsigned char *scratch;
+	profile_entry_t e[2];
+	char str[64];
+	int saved_ops = 0;
+	int status;
+	int op;
+
+	/* tune addr len */
+	status = sscanf(cmd, "%*s %x %x", &addr, &len);
+	if (status != 2) {
+		printf("Syntax error (use ? for help)\n");
+		return 0;
+	}
+	if ((len == 0) || (addr >= dev->size) || (len > dev->size - addr)) {
+		printf("Error: invalid window (maximum allowed is %.8X)\n", dev->size);
+		return 0;
+	}
+	saved = (unsigned char *)malloc(len);
+	scratch = (unsigned char *)malloc(len);
+	if ((saved == NULL) || (scratch == NULL)) {
+		printf("Error: cannot allocate %u bytes\n", len);
+		free(saved);
+		free(scratch);
+		return 0;
+	}
+
+	/* Keep the window contents, the write trials store them back */
+	if (bulk_read(dev, &safe, addr, saved, len, NULL) < len) {
+		free(saved);
+		free(scratch);
+		return 0;
+	}
+
+	printf("Tuning %04x:%04x:%u window %.8X-%.8X%s\n",
+		dev->vendor, dev->device, dev->bar, addr, addr + len - 1,
+		(dev->wc_addr != NULL) ? " (WC mapping available)" : "");
+	memset(e, 0, sizeof(e));
+	for (op = 0; op < 2; op++) {
+		e[op].addr = addr;
+		e[op].len = len;
+		e[op].mbps = tune_op(dev, op, addr,
+			(op == PROFILE_READ) ? scratch : saved, len, &e[op].s);
+		e[op].valid = (e[op].mbps > 0);
+	}
+
+	/* Restore whatever the trials left behind */
+	bulk_write(dev, &safe, addr, saved, len, NULL);
+	free(saved);
+	free(scratch);
+
+	if (cancel_pending()) {
+		printf("Interrupted: profile not updated\n");
+		return 0;
+	}
+
+	for (op = 0; op < 2; op++) {
+		printf("Best %-5s: %s (%.1f MB/s)\n", op_names[op],
+			strategy_str(&e[op].s, str, sizeof(str)), e[op].mbps);
+		if (!e[op].valid || (profile_save(dev, op, &e[op]) < 0)) {
+			continue;
+		}
+		saved_ops++;
+		if (dev->profile == NULL) {
+			dev->profile = (struct profile *)calloc(1, sizeof(struct profile));
+		}
+		if (dev->profile != NULL) {
+			dev->profile->op[op] = e[op];
+		}
+	}
+	if (saved_ops > 0) {
+		printf("Profile saved to %s\n", profile_path());
+	} else {
+		printf("Profile not updated\n");
+	}
+	return 0;
+}
@@ -0,0 +1,46 @@
+/* tune.h
+ *
+ * Access-strategy tuner and per-device profile cache.
+ *
+ * "tune addr len" benchmarks bulk reads and writes of a BAR window
+ * over the strategy space (width, UC/WC mapping, threads, chunk size,
+ * fence placement) and stores the fastest read and write strategies
+ * in the profile file, keyed by vendor:device:bar. Later runs load
+ * the profile and use it for large d/f operations that fall inside
+ * the tuned window.
+ *
+ * The profile file is $PCI_DEBUG_PROFILES, or ~/.pci_debug_profiles.
+ *
+ * ----------------------------------------------------------------
+ */
+#ifndef TUNE_H
+#define TUNE_H
+
+#include "pci_debug.h"
+#include "bulk.h"
+
+#define PROFILE_READ   0
+#define PROFILE_WRITE  1
+
+/* Smaller operations keep the plain per-element path */
+#define PROFILE_MIN_BYTES  (64*1024)
+
+typedef struct {
+	int          valid;
+	unsigned int addr;
+	unsigned int len;
+	strategy_t   s;
+	double       mbps;
+} profile_entry_t;
+
+struct profile {
+	profile_entry_t op[2];
+};
+
+void profile_load(device_t *dev);
+const strategy_t *profile_lookup(device_t *dev, int op,
+	unsigned int addr, unsigned int len);
+
+int tune_mem(device_t *dev, char *cmd);
+
+#endif /* TUNE_H */